@@ -0,0 +1,435 @@
+use std::fmt::Write;
+use std::sync::Mutex;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::Instant;
+
+use crate::state::{CacheState, Entry};
+use crate::policy::{CacheRP, Access, Origin};
+use crate::policy::weighted::Weighted;
+use crate::state::multi::{MS_MAXSETS, MS_BLOCK};
+use crate::preset::{self, Preset, PresetFn, TLB};
+use crate::search::{self, Algo, Rounds, Trace};
+use crate::steady::{self, Limits};
+
+
+#[derive(PartialEq, Eq, Copy, Clone, Debug)]
+pub enum Mode { Rnd, Dbl, Steady }
+
+impl Mode {
+    pub fn name(&self) -> &'static str {
+        match self {
+            Mode::Rnd => "kickrnd",
+            Mode::Dbl => "kickdbl",
+            Mode::Steady => "steady"
+        }
+    }
+    pub fn from_name(s: &str) -> Option<Self> {
+        match s {
+            "rnd" | "kickrnd" => Some(Mode::Rnd),
+            "dbl" | "kickdbl" => Some(Mode::Dbl),
+            "steady" | "karp" => Some(Mode::Steady),
+            _ => None
+        }
+    }
+}
+
+
+#[derive(Clone, Debug)]
+pub struct Job {
+    pub preset: String,
+    pub orig: Origin,
+    pub algo: Algo,
+    pub mode: Mode,
+    pub rxmem: bool,
+    pub sets: usize,
+    pub maxrnds: usize,
+    pub lim: Limits,
+    /// Latency table overriding the preset's (possibly empty), if weighting by latency
+    pub latency: Option<String>,
+    pub verbose: bool
+}
+
+
+pub struct Config {
+    pub presets: Vec<String>,
+    pub origins: Vec<Origin>,
+    pub algos: Vec<Algo>,
+    pub mode: Mode,
+    pub rxmem: bool,
+    pub sets: usize,
+    pub maxrnds: usize,
+    pub lim: Limits,
+    pub latency: Option<String>,
+    pub jobs: usize,
+    pub verbose: bool
+}
+
+pub const USAGE: &str = "\
+usage: cache-ninja batch [OPTIONS] [@ARGFILE]
+  -p, --preset LIST   comma-separated presets (default: TLB::KABYLAKE); 'all' for every preset
+  -o, --origin LIST   target access origins: data, isn (default: data)
+  -a, --algo LIST     search algorithms: bfs, dijkstra, astar, fringe, idastar, all (default: bfs)
+  -m, --mode MODE     rnd (repeated kickout), dbl (spliced L1+L2) or steady (min. accesses, or
+                      predicted cycles with -L, per eviction over the round-transition graph;
+                      ignores -a) (default: rnd)
+  -S, --slack N       steady mode: also consider rounds up to N accesses longer than the
+                      shortest eviction (default: 0)
+  -G, --nodes N       steady mode: max. round states to expand (default: 64)
+  -r, --rounds N      max. eviction rounds per job (default: 100)
+  -j, --jobs N        worker threads (default: available cores)
+  -x, --rxmem         allow any entry to be re-accessed from any origin (TLB presets only)
+  -L, --latency SRC   weight accesses by predicted cycles instead of flat hit/miss costs, for
+                      dijkstra/astar/fringe/idastar and steady mode: SRC is 'preset' for the
+                      preset's table or a file of 'data|isn 1|2|3|miss CYCLES' lines
+                      overriding it
+  -n, --sets N        evict N targets in distinct sTLB sets sharing one L1 dTLB set,
+                      interleaving their eviction sets (TLB presets, rnd/steady mode, N <= 4)
+  -v, --verbose       also dump the full state trace of each job to stderr
+  @ARGFILE            read further arguments from ARGFILE ('#' starts a comment)
+Each combination of preset, origin and algorithm is run as one job;
+results are printed to stdout as one JSON object per line.";
+
+fn expand_args(args: impl Iterator<Item = String>) -> Result<Vec<String>, String> {
+    let mut out = Vec::new();
+    for a in args {
+        if let Some(fname) = a.strip_prefix('@') {
+            let txt = std::fs::read_to_string(fname).map_err(|e| format!("{}: {}", fname, e))?;
+            let words = txt.lines()
+                .map(|l| l.split('#').next().unwrap())
+                .flat_map(|l| l.split_whitespace())
+                .map(String::from);
+            out.extend(expand_args(words.collect::<Vec<_>>().into_iter())?);
+        } else {
+            out.push(a);
+        }
+    }
+    Ok(out)
+}
+
+fn parse_list<T>(s: &str, what: &str, all: &[T], f: impl Fn(&str) -> Option<T>) -> Result<Vec<T>, String>
+where T: Clone
+{
+    let mut out = Vec::new();
+    for x in s.split(',').filter(|x| !x.is_empty()) {
+        if x == "all" {
+            out.extend_from_slice(all);
+        } else {
+            out.push(f(x).ok_or_else(|| format!("unknown {}: '{}'", what, x))?);
+        }
+    }
+    Ok(out)
+}
+
+pub fn parse_origin(s: &str) -> Option<Origin> {
+    match s {
+        "data" | "d" | "false" => Some(Origin{isnfetch: false}),
+        "isn" | "i" | "isnfetch" | "true" => Some(Origin{isnfetch: true}),
+        _ => None
+    }
+}
+
+impl Config {
+    pub fn parse(args: impl Iterator<Item = String>) -> Result<Self, String> {
+        let mut cfg = Config {
+            presets: Vec::new(),
+            origins: Vec::new(),
+            algos: Vec::new(),
+            mode: Mode::Rnd,
+            rxmem: false,
+            sets: 1,
+            maxrnds: crate::MAXROUNDS,
+            lim: Default::default(),
+            latency: None,
+            jobs: std::thread::available_parallelism().map(|n| n.get()).unwrap_or(1),
+            verbose: false
+        };
+        let args = expand_args(args)?;
+        let mut it = args.iter();
+        while let Some(a) = it.next() {
+            let mut val = || it.next().ok_or_else(|| format!("missing value for '{}'", a));
+            match a.as_str() {
+                "-p" | "--preset" => {
+                    let all: Vec<String> = preset::NAMES.iter().map(|x| x.to_string()).collect();
+                    cfg.presets.extend(parse_list(val()?, "preset", &all, |x| {
+                        preset::NAMES.iter().find(|n| n.eq_ignore_ascii_case(x)).map(|x| x.to_string())
+                    })?);
+                }
+                "-o" | "--origin" => cfg.origins.extend(parse_list(val()?, "origin",
+                    &[Origin{isnfetch: false}, Origin{isnfetch: true}], parse_origin)?),
+                "-a" | "--algo" => cfg.algos.extend(parse_list(val()?, "algorithm", &Algo::ALL, Algo::from_name)?),
+                "-m" | "--mode" => {
+                    let v = val()?;
+                    cfg.mode = Mode::from_name(v).ok_or_else(|| format!("unknown mode: '{}'", v))?;
+                }
+                "-r" | "--rounds" => cfg.maxrnds = val()?.parse().map_err(|e| format!("--rounds: {}", e))?,
+                "-S" | "--slack" => cfg.lim.slack = val()?.parse().map_err(|e| format!("--slack: {}", e))?,
+                "-G" | "--nodes" => cfg.lim.nodes = val()?.parse().map_err(|e| format!("--nodes: {}", e))?,
+                "-j" | "--jobs" => cfg.jobs = val()?.parse().map_err(|e| format!("--jobs: {}", e))?,
+                "-x" | "--rxmem" => cfg.rxmem = true,
+                "-L" | "--latency" => {
+                    cfg.latency = Some(match val()?.as_str() {
+                        "preset" => String::new(),
+                        f => std::fs::read_to_string(f).map_err(|e| format!("{}: {}", f, e))?
+                    });
+                    cfg.lim.weighted = true;
+                }
+                "-n" | "--sets" => {
+                    cfg.sets = val()?.parse().map_err(|e| format!("--sets: {}", e))?;
+                    if cfg.sets < 1 || cfg.sets > MS_MAXSETS {
+                        return Err(format!("--sets must be between 1 and {}", MS_MAXSETS));
+                    }
+                }
+                "-v" | "--verbose" => cfg.verbose = true,
+                "-h" | "--help" => return Err(String::new()),
+                _ => return Err(format!("unknown argument: '{}'", a))
+            }
+        }
+        if cfg.presets.is_empty() {
+            cfg.presets.push("TLB::KABYLAKE".to_string());
+        }
+        if cfg.origins.is_empty() {
+            cfg.origins.push(Default::default());
+        }
+        if cfg.algos.is_empty() {
+            cfg.algos.push(Algo::Bfs);
+        }
+        cfg.jobs = cfg.jobs.max(1);
+        Ok(cfg)
+    }
+
+    pub fn jobs(&self) -> Vec<Job> {
+        let mut out = Vec::new();
+        for p in self.presets.iter() {
+            for &orig in self.origins.iter() {
+                for &algo in self.algos.iter() {
+                    out.push(Job {
+                        preset: p.clone(), orig, algo,
+                        mode: self.mode, rxmem: self.rxmem, sets: self.sets,
+                        maxrnds: self.maxrnds, lim: self.lim, latency: self.latency.clone(), verbose: self.verbose
+                    });
+                }
+            }
+        }
+        out
+    }
+}
+
+
+/// Compact JSON rendering of search results
+pub trait Json {
+    fn json(&self, out: &mut String);
+}
+
+impl Json for str {
+    fn json(&self, out: &mut String) {
+        out.push('"');
+        for c in self.chars() {
+            match c {
+                '"' => out.push_str("\\\""),
+                '\\' => out.push_str("\\\\"),
+                '\n' => out.push_str("\\n"),
+                c if (c as u32) < 0x20 => write!(out, "\\u{:04x}", c as u32).unwrap(),
+                c => out.push(c)
+            }
+        }
+        out.push('"');
+    }
+}
+
+impl Json for Entry {
+    fn json(&self, out: &mut String) {
+        match self {
+            Entry::X => out.push_str("\"X\""),
+            Entry::T => out.push_str("\"T\""),
+            Entry::P(a, c) => write!(out, "\"P{}{}\"", a, if *c { "i" } else { "d" }).unwrap()
+        }
+    }
+}
+
+impl Json for Origin {
+    fn json(&self, out: &mut String) {
+        out.push_str(if self.isnfetch { "\"isn\"" } else { "\"data\"" });
+    }
+}
+
+impl Json for (Entry, Origin) {
+    fn json(&self, out: &mut String) {
+        out.push_str("{\"ent\":");
+        self.0.json(out);
+        out.push_str(",\"orig\":");
+        self.1.json(out);
+        out.push('}');
+    }
+}
+
+impl Json for Access {
+    fn json(&self, out: &mut String) {
+        let (ent, orig) = search::access_entry(self);
+        out.push_str("{\"ent\":");
+        ent.json(out);
+        out.push_str(",\"orig\":");
+        orig.json(out);
+        match self {
+            Access::Hit(l, ..) => write!(out, ",\"hit\":{}}}", l).unwrap(),
+            Access::Miss(..) => out.push_str(",\"hit\":null}")
+        }
+    }
+}
+
+impl<T: Json> Json for [T] {
+    fn json(&self, out: &mut String) {
+        out.push('[');
+        for (i, x) in self.iter().enumerate() {
+            if i > 0 {
+                out.push(',');
+            }
+            x.json(out);
+        }
+        out.push(']');
+    }
+}
+
+impl<T> Json for Rounds<T> {
+    fn json(&self, out: &mut String) {
+        out.push_str("\"rounds\":[");
+        for (i, r) in self.rounds.iter().enumerate() {
+            if i > 0 {
+                out.push(',');
+            }
+            let accs: Vec<Access> = r.search.path.iter().map(|(a, _)| *a).collect();
+            write!(out, "{{\"len\":{},\"cost\":{},\"expanded\":{},\"synced\":{}",
+                   accs.len(), r.search.cost, r.search.expanded, r.synced).unwrap();
+            if r.search.phased {
+                out.push_str(",\"phased\":true");
+            }
+            if let Some(s) = r.synced_l1 {
+                write!(out, ",\"synced_l1\":{}", s).unwrap();
+            }
+            if !r.pre.is_empty() {
+                out.push_str(",\"pre\":");
+                r.pre.json(out);
+            }
+            out.push_str(",\"seq\":");
+            accs.json(out);
+            out.push('}');
+        }
+        out.push(']');
+        match self.cycle {
+            Some((r, p)) => write!(out, ",\"cycle\":{{\"round\":{},\"prev\":{}}}", r, p).unwrap(),
+            None => out.push_str(",\"cycle\":null")
+        }
+        write!(out, ",\"failed\":{}", self.failed).unwrap();
+    }
+}
+
+
+/// Run one batch job on a concrete preset type
+struct RunJob<'a>(&'a Job);
+
+impl<'a> PresetFn for RunJob<'a> {
+    type Output = Result<(String, String), String>;
+
+    fn call<P: Preset>(&self, pres: P) -> Self::Output {
+        let job = self.0;
+        let rp = if job.rxmem {
+            pres.rpx().ok_or_else(|| format!("preset {} has no rxmem variant", job.preset))?
+        } else {
+            pres.rp()
+        };
+        Ok(match &job.latency {
+            Some(txt) => run_rp(job, &Weighted{rp, lat: pres.latency().parse(txt)?}, &pres.newstate()),
+            None => run_rp(job, &rp, &pres.newstate())
+        })
+    }
+}
+
+fn run_rp<T: CacheState, R: CacheRP<State=T>>(job: &Job, rp: &R, st: &T) -> (String, String) {
+    let mut tr = if job.verbose { Trace::on() } else { Trace::off() };
+    let t0 = Instant::now();
+    let res = match job.mode {
+        Mode::Rnd => search::kickrnd(st, rp, job.maxrnds, job.orig, job.algo, &mut tr),
+        Mode::Dbl => search::kickdbl(st, rp, job.maxrnds, job.orig, job.algo, &mut tr),
+        Mode::Steady => steady::steady(st, rp, job.maxrnds, job.orig, job.lim, &mut tr)
+    };
+    let elapsed = t0.elapsed();
+
+    let mut out = String::new();
+    res.json(&mut out);
+    let expanded: usize = res.rounds.iter().map(|r| r.search.expanded).sum();
+    write!(out, ",\"expanded\":{},\"ms\":{:.3}", expanded, elapsed.as_secs_f64() * 1e3).unwrap();
+    (out, tr.take())
+}
+
+/// Interleaved eviction of one target in each of `job.sets` sTLB sets
+fn run_multi(job: &Job) -> Result<(String, String), String> {
+    let pres = TLB::by_name(&job.preset)
+        .ok_or_else(|| format!("multi-set search needs a TLB preset, not {}", job.preset))?;
+    if job.mode == Mode::Dbl || job.rxmem {
+        return Err("multi-set search only supports rnd and steady modes without rxmem".to_string());
+    }
+    let rp = pres.multi(job.sets);
+    let st = rp.newstate(rp.rp1.newpv(), rp.rp2.newpv());
+    Ok(match &job.latency {
+        Some(txt) => run_rp(job, &Weighted{rp, lat: pres.latency().parse(txt)?}, &st),
+        None => run_rp(job, &rp, &st)
+    })
+}
+
+fn run_job(id: usize, job: &Job) -> (String, String) {
+    let mut out = String::new();
+    write!(out, "{{\"id\":{},\"preset\":", id).unwrap();
+    job.preset.json(&mut out);
+    out.push_str(",\"origin\":");
+    job.orig.json(&mut out);
+    write!(out, ",\"algo\":\"{}\",\"mode\":\"{}\",\"rxmem\":{},\"weighted\":{},",
+           job.algo.name(), job.mode.name(), job.rxmem, job.latency.is_some()).unwrap();
+    let res = if job.sets > 1 {
+        write!(out, "\"sets\":{},\"block\":{},", job.sets, MS_BLOCK).unwrap();
+        run_multi(job)
+    } else {
+        preset::by_name(&job.preset, &RunJob(job)).unwrap()
+    };
+    let trace = match res {
+        Ok((res, trace)) => {
+            out.push_str(&res);
+            trace
+        }
+        Err(e) => {
+            out.push_str("\"error\":");
+            e.json(&mut out);
+            String::new()
+        }
+    };
+    out.push('}');
+    (out, trace)
+}
+
+
+/// Run all jobs on `cfg.jobs` worker threads; results are printed in completion order
+pub fn run(cfg: &Config) {
+    use std::io::Write;
+
+    let jobs = cfg.jobs();
+    let next = AtomicUsize::new(0);
+    let outlock = Mutex::new(());
+    std::thread::scope(|s| {
+        for _ in 0..cfg.jobs.min(jobs.len()) {
+            s.spawn(|| loop {
+                let i = next.fetch_add(1, Ordering::Relaxed);
+                if i >= jobs.len() {
+                    break;
+                }
+                let (res, trace) = run_job(i, &jobs[i]);
+                let _guard = outlock.lock().unwrap();
+                if !trace.is_empty() {
+                    let mut err = std::io::stderr().lock();
+                    writeln!(err, "==================== job {}: {} {:?} {}\n{}",
+                             i, jobs[i].preset, jobs[i].orig, jobs[i].algo.name(), trace).unwrap();
+                }
+                let mut stdout = std::io::stdout().lock();
+                writeln!(stdout, "{}", res).unwrap();
+                stdout.flush().unwrap();
+            });
+        }
+    });
+}
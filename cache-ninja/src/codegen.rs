@@ -0,0 +1,437 @@
+use std::fmt::Write;
+
+use crate::state::{CacheState, Entry, PAddr};
+use crate::policy::{CacheRP, Origin, PVRP};
+use crate::policy::weighted::{Latency, Weighted};
+use crate::preset::{self, Preset, PresetFn};
+use crate::search::{self, Algo, Rounds, Trace};
+use crate::steady::{self, Limits};
+use crate::batch::Mode;
+use crate::resync::{self, Params};
+
+
+/// How the generated builder picks pages congruent with the target
+#[derive(PartialEq, Eq, Copy, Clone, Debug)]
+pub enum SetHash {
+    /// Same L1 dTLB set (`page & 0xf`)
+    Dtlb,
+    /// Same L1 dTLB set and same XOR-7 sTLB set (`(page ^ (page >> 7)) & 0x7f`)
+    Stlb,
+    /// Caller-supplied `nexthit` function
+    Ext
+}
+
+impl SetHash {
+    pub fn name(&self) -> &'static str {
+        match self {
+            SetHash::Dtlb => "dtlb",
+            SetHash::Stlb => "stlb",
+            SetHash::Ext => "ext"
+        }
+    }
+    pub fn from_name(s: &str) -> Option<Self> {
+        match s {
+            "dtlb" => Some(SetHash::Dtlb),
+            "stlb" => Some(SetHash::Stlb),
+            "ext" => Some(SetHash::Ext),
+            _ => None
+        }
+    }
+}
+
+
+pub struct Config {
+    pub preset: String,
+    pub level: Option<usize>,
+    pub hash: Option<SetHash>,
+    pub name: String,
+    pub orig: Origin,
+    pub algo: Algo,
+    pub mode: Mode,
+    pub lim: Limits,
+    /// Where the latency table comes from and its text, if weighting by latency
+    pub latency: Option<(String, String)>,
+    pub maxrnds: usize,
+    /// Online re-synchronization table to append, if any
+    pub resync: Option<Params>
+}
+
+pub const USAGE: &str = "\
+usage: cache-ninja gen [OPTIONS]
+  -p, --preset NAME   preset to solve for (default: TLB::KABYLAKE)
+  -l, --level N       cache level to evict the target from; 1 targets the L1 data
+                      policy alone (default: the whole hierarchy)
+  -s, --hash HASH     page selection: dtlb, stlb or ext (caller-supplied nexthit)
+                      (default: stlb for the TLB hierarchy, dtlb for its L1, else ext)
+  -n, --name NAME     prefix for the generated identifiers (default: ninja)
+  -o, --origin ORIG   target access origin: data or isn (default: data)
+  -a, --algo ALGO     search algorithm (default: bfs)
+  -m, --mode MODE     rnd (repeat the search every round) or steady (min. accesses, or
+                      predicted cycles with -L, per eviction over the round-transition graph)
+                      (default: rnd)
+  -S, --slack N       steady mode: rounds up to N accesses over the shortest (default: 0)
+  -G, --nodes N       steady mode: max. round states to expand (default: 64)
+  -L, --latency SRC   weight accesses by predicted cycles ('preset' or a table file, as in batch)
+  -r, --rounds N      max. eviction rounds to reach a steady state (default: 100)
+  -R, --resync N      also emit a belief-state table of up to N entries (at most 255) that tells
+                      the receiver after each timed round whether it can go on or how to get back
+                      to a known state; or, if no timed round branches, the fixed re-sync
+                      schedule that takes its place
+  -P, --noise P       resync: foreign insertions per component and round in the simulation the
+                      header comment reports (default: 0.001)
+      --prep N        resync: fresh pages touched by a full reset (default: 12)
+Prints a C header with a pointer-chain builder and its lead-in/step constants to stdout.";
+
+impl Config {
+    pub fn parse(args: impl Iterator<Item = String>) -> Result<Self, String> {
+        let mut cfg = Config {
+            preset: "TLB::KABYLAKE".to_string(),
+            level: None,
+            hash: None,
+            name: "ninja".to_string(),
+            orig: Default::default(),
+            algo: Algo::Bfs,
+            mode: Mode::Rnd,
+            lim: Default::default(),
+            latency: None,
+            maxrnds: crate::MAXROUNDS,
+            resync: None
+        };
+        let mut par = Params{nodes: 0, prep: 12, noise: 0.001};
+        let args: Vec<String> = args.collect();
+        let mut it = args.iter();
+        while let Some(a) = it.next() {
+            let mut val = || it.next().ok_or_else(|| format!("missing value for '{}'", a));
+            match a.as_str() {
+                "-p" | "--preset" => {
+                    let v = val()?;
+                    cfg.preset = preset::NAMES.iter().find(|n| n.eq_ignore_ascii_case(v))
+                        .ok_or_else(|| format!("unknown preset: '{}'", v))?.to_string();
+                }
+                "-l" | "--level" => cfg.level = Some(val()?.parse().map_err(|e| format!("--level: {}", e))?),
+                "-s" | "--hash" => {
+                    let v = val()?;
+                    cfg.hash = Some(SetHash::from_name(v).ok_or_else(|| format!("unknown set hash: '{}'", v))?);
+                }
+                "-n" | "--name" => {
+                    let v = val()?;
+                    if v.is_empty() || v.starts_with(|c: char| c.is_ascii_digit())
+                        || !v.chars().all(|c| c.is_ascii_alphanumeric() || c == '_') {
+                        return Err(format!("not a C identifier: '{}'", v));
+                    }
+                    cfg.name = v.to_string();
+                }
+                "-o" | "--origin" => cfg.orig = match val()?.as_str() {
+                    "data" => Origin{isnfetch: false},
+                    "isn" => Origin{isnfetch: true},
+                    v => return Err(format!("unknown origin: '{}'", v))
+                },
+                "-a" | "--algo" => {
+                    let v = val()?;
+                    cfg.algo = Algo::from_name(v).ok_or_else(|| format!("unknown algorithm: '{}'", v))?;
+                }
+                "-m" | "--mode" => {
+                    let v = val()?;
+                    cfg.mode = match Mode::from_name(v) {
+                        Some(Mode::Dbl) => return Err("spliced (dbl) rounds are not supported".to_string()),
+                        Some(m) => m,
+                        None => return Err(format!("unknown mode: '{}'", v))
+                    };
+                }
+                "-S" | "--slack" => cfg.lim.slack = val()?.parse().map_err(|e| format!("--slack: {}", e))?,
+                "-G" | "--nodes" => cfg.lim.nodes = val()?.parse().map_err(|e| format!("--nodes: {}", e))?,
+                "-L" | "--latency" => {
+                    let v = val()?;
+                    let txt = match v.as_str() {
+                        "preset" => String::new(),
+                        f => std::fs::read_to_string(f).map_err(|e| format!("{}: {}", f, e))?
+                    };
+                    cfg.latency = Some((v.clone(), txt));
+                    cfg.lim.weighted = true;
+                }
+                "-r" | "--rounds" => cfg.maxrnds = val()?.parse().map_err(|e| format!("--rounds: {}", e))?,
+                "-R" | "--resync" => {
+                    par.nodes = val()?.parse().map_err(|e| format!("--resync: {}", e))?;
+                    if par.nodes < 2 || par.nodes > 255 {
+                        return Err("--resync must be between 2 and 255".to_string());
+                    }
+                }
+                "-P" | "--noise" => {
+                    par.noise = val()?.parse().map_err(|e| format!("--noise: {}", e))?;
+                    if !(0.0..=1.0).contains(&par.noise) {
+                        return Err("--noise must be a probability".to_string());
+                    }
+                }
+                "--prep" => {
+                    par.prep = val()?.parse().map_err(|e| format!("--prep: {}", e))?;
+                    if par.prep > 255 {
+                        return Err("--prep must be at most 255".to_string());
+                    }
+                }
+                "-h" | "--help" => return Err(String::new()),
+                _ => return Err(format!("unknown argument: '{}'", a))
+            }
+        }
+        if par.nodes > 0 {
+            cfg.resync = Some(par);
+        }
+        Ok(cfg)
+    }
+}
+
+
+/// Cache line size and lines per page, for spreading a chain's pointer slots over the page
+const LINESZ: usize = 64;
+const LINES: usize = 4096 / LINESZ;
+
+/// A repeated eviction flattened into one pointer chase: a lead-in followed by a
+/// steady-state cycle that loops back onto itself
+pub struct Chain {
+    /// Page index of every access, pages numbered by first use
+    pub seq: Vec<usize>,
+    /// Accesses per round, lead-in rounds first
+    pub rounds: Vec<usize>,
+    /// Number of lead-in rounds; the remaining rounds form the cycle
+    pub leadin: usize,
+    pub npages: usize
+}
+
+impl Chain {
+    pub fn from_rounds<T>(res: &Rounds<T>) -> Result<Self, String> {
+        let (ri, pos) = match res.cycle {
+            Some(c) if !res.failed => c,
+            _ => return Err("no steady-state eviction cycle found".to_string())
+        };
+        let mut pages: Vec<PAddr> = Vec::new();
+        let mut seq = Vec::new();
+        let mut rounds = Vec::new();
+        for rnd in &res.rounds[..ri] {
+            if !rnd.pre.is_empty() {
+                return Err("spliced (kickdbl) rounds are not supported".to_string());
+            }
+            for (acc, _) in &rnd.search.path {
+                let (ent, orig) = search::access_entry(acc);
+                let a = match ent {
+                    Entry::P(a, _) if !orig.isnfetch => a,
+                    Entry::P(..) => return Err("sequence needs instruction fetches; \
+                                                only data-load chains can be generated".to_string()),
+                    _ => unreachable!()
+                };
+                seq.push(pages.iter().position(|&x| x == a).unwrap_or_else(|| {
+                    pages.push(a);
+                    pages.len() - 1
+                }));
+            }
+            rounds.push(rnd.search.path.len());
+        }
+        Ok(Self{seq, rounds, leadin: pos, npages: pages.len()})
+    }
+
+    /// Index in `seq` where the cycle starts
+    pub fn loopstart(&self) -> usize {
+        self.rounds[..self.leadin].iter().sum()
+    }
+    /// Accesses to chase before the first measurement: the lead-in plus the first cyclic round
+    pub fn init(&self) -> usize {
+        self.loopstart() + self.rounds[self.leadin]
+    }
+    /// Accesses per cyclic round, starting after `init()`
+    pub fn steps(&self) -> Vec<usize> {
+        let cyc = &self.rounds[self.leadin..];
+        cyc[1..].iter().chain(&cyc[..1]).copied().collect()
+    }
+    /// Word slot within its page used by every access: the k-th use of a page takes word k
+    pub fn slots(&self) -> Vec<(usize, usize)> {
+        let mut uses = vec![0; self.npages];
+        self.seq.iter().map(|&p| {
+            uses[p] += 1;
+            (p, uses[p] - 1)
+        }).collect()
+    }
+
+    /// First cache line of each page's slots, slot k taking the k-th line after it. Lines are
+    /// handed out in turn, so that no two hops share an L1D or L2 set while the chain's slots fit
+    /// in a page; longer chains pack the remaining pages into its last lines.
+    pub fn lines(&self) -> Vec<usize> {
+        let mut uses = vec![0; self.npages];
+        for &p in &self.seq {
+            uses[p] += 1;
+        }
+        let mut next = 0;
+        uses.iter().map(|&n| {
+            let l = next.min(LINES - n.min(LINES));
+            next += n;
+            l
+        }).collect()
+    }
+
+    /// Sequence diagram in the style of the hand-written builders' comments
+    fn diagram(&self) -> String {
+        let mut out = String::new();
+        let mut i = 0;
+        for (r, &n) in self.rounds.iter().enumerate() {
+            if r == self.leadin {
+                out.push('(');
+            }
+            let s: Vec<String> = self.seq[i..i+n].iter().map(|p| p.to_string()).collect();
+            out.push_str(&s.join(" "));
+            out.push_str(if r + 1 == self.rounds.len() { ")" } else { " | " });
+            i += n;
+        }
+        out
+    }
+
+    /// Write the header; `extra` goes in just before its end
+    pub fn emit(&self, cfg: &Config, hash: SetHash, extra: &str, out: &mut String) -> std::fmt::Result {
+        let name = &cfg.name;
+        let uname = name.to_ascii_uppercase();
+        let steps = self.steps();
+        let slots = self.slots();
+        let nslots = slots.iter().map(|s| s.1 + 1).max().unwrap_or(0);
+        let lines = self.lines();
+
+        writeln!(out, "/* Generated by cache-ninja; do not edit.")?;
+        let mode = match cfg.mode {
+            Mode::Steady => format!(" -m steady -S {} -G {}", cfg.lim.slack, cfg.lim.nodes),
+            _ => String::new()
+        };
+        let lat = cfg.latency.as_ref().map_or(String::new(), |(src, _)| format!(" -L {}", src));
+        let rs = cfg.resync.map_or(String::new(), |p| format!(" -R {} -P {} --prep {}", p.nodes, p.noise, p.prep));
+        writeln!(out, " * gen -p {} -l {} -s {} -n {} -o {} -a {}{}{} -r {}{}",
+                 cfg.preset, cfg.level.map_or("max".to_string(), |l| l.to_string()), hash.name(), name,
+                 if cfg.orig.isnfetch { "isn" } else { "data" }, cfg.algo.name(), mode, lat, cfg.maxrnds, rs)?;
+        writeln!(out, " *")?;
+        writeln!(out, " * Pages accessed per eviction round; the parenthesized rounds repeat:")?;
+        writeln!(out, " * {}", self.diagram())?;
+        writeln!(out, " */")?;
+        // A header with a resync section is a different file from the plain chain's
+        let guard = format!("{}{}_H", uname, if cfg.resync.is_some() { "_RESYNC" } else { "" });
+        writeln!(out, "#ifndef {}", guard)?;
+        writeln!(out, "#define {}\n", guard)?;
+        writeln!(out, "#include <stdint.h>\n")?;
+        writeln!(out, "#define {}_NPAGES ({})", uname, self.npages)?;
+        writeln!(out, "#define {}_NSLOTS ({}) /* pointer slots used per page */", uname, nslots)?;
+        writeln!(out, "#define {}_LINESZ ({})", uname, LINESZ)?;
+        writeln!(out, "/* First cache line of each page's pointer slots: slot k of page i sits in line")?;
+        if slots.len() <= LINES {
+            writeln!(out, " * {}_line[i] + k, so that no two hops share an L1D or L2 set */", name)?;
+        } else {
+            writeln!(out, " * {}_line[i] + k; the chain has more slots than a page has lines, so some share */", name)?;
+        }
+        let lv: Vec<String> = lines.iter().map(|l| l.to_string()).collect();
+        writeln!(out, "static const unsigned char {}_line[{}_NPAGES] = {{{}}};", name, uname, lv.join(", "))?;
+        writeln!(out, "#define {}_INIT ({})", uname, self.init())?;
+        if steps.iter().all(|&s| s == steps[0]) {
+            writeln!(out, "#define {}_STEP ({})", uname, steps[0])?;
+        }
+        writeln!(out, "#define {}_NSTEPS ({})", uname, steps.len())?;
+        let sv: Vec<String> = steps.iter().map(|s| s.to_string()).collect();
+        writeln!(out, "static const unsigned char {}_steps[{}_NSTEPS] = {{{}}};\n", name, uname, sv.join(", "))?;
+
+        let nexthit = match hash {
+            SetHash::Ext => "nexthit".to_string(),
+            _ => {
+                writeln!(out, "static void *{}_nexthit(void *cur, uintptr_t targ)", name)?;
+                writeln!(out, "{{")?;
+                writeln!(out, "\tuintptr_t t = targ >> 12;")?;
+                writeln!(out, "\tuintptr_t p = (uintptr_t)cur >> 12;")?;
+                writeln!(out, "\tdo {{")?;
+                writeln!(out, "\t\tp++;")?;
+                match hash {
+                    SetHash::Dtlb => writeln!(out, "\t}} while (p == t || (p & 0xf) != (t & 0xf));")?,
+                    _ => writeln!(out, "\t}} while (p == t || (p & 0xf) != (t & 0xf) ||\n\t         \
+                                        ((p ^ (p >> 7)) & 0x7f) != ((t ^ (t >> 7)) & 0x7f));")?
+                }
+                writeln!(out, "\treturn (void *)(p << 12);")?;
+                writeln!(out, "}}\n")?;
+                format!("{}_nexthit", name)
+            }
+        };
+
+        if hash == SetHash::Ext {
+            writeln!(out, "static void **{}_prep(void *base, uintptr_t targ, void *(*nexthit)(void *cur, uintptr_t targ))", name)?;
+        } else {
+            writeln!(out, "static void **{}_prep(void *base, uintptr_t targ)", name)?;
+        }
+        writeln!(out, "{{")?;
+        writeln!(out, "\tvoid *p = base;")?;
+        writeln!(out, "\tvoid *(*ev[{}_NPAGES])[{}_LINESZ / sizeof(void *)];", uname, uname)?;
+        writeln!(out, "\tfor (int i = 0; i < {}_NPAGES; i++) {{", uname)?;
+        writeln!(out, "\t\tp = {}(p, targ);", nexthit)?;
+        writeln!(out, "\t\tev[i] = (void *)(((uintptr_t)p & ~(uintptr_t)0xfff) + {}_LINESZ * {}_line[i]);", uname, name)?;
+        writeln!(out, "\t}}")?;
+        let ls = self.loopstart();
+        for p in 0..self.npages {
+            for (i, &(q, k)) in slots.iter().enumerate() {
+                if q != p {
+                    continue;
+                }
+                let (nq, nk) = slots[if i + 1 < slots.len() { i + 1 } else { ls }];
+                write!(out, "\tev[{}][{}][0] = &ev[{}][{}];", q, k, nq, nk)?;
+                writeln!(out, "{}", if i + 1 == slots.len() { " // <-- looplink here" } else { "" })?;
+            }
+            if p + 1 < self.npages {
+                writeln!(out)?;
+            }
+        }
+        writeln!(out, "\n\treturn ev[0][0];")?;
+        writeln!(out, "}}\n")?;
+        out.push_str(extra);
+        writeln!(out, "#endif /* {} */", guard)
+    }
+}
+
+
+/// Run the eviction search on a concrete preset type, at the requested level
+struct Gen<'a>(&'a Config);
+
+impl<'a> Gen<'a> {
+    fn run<T: CacheState, R: CacheRP<State=T>>(&self, rp: &R, st: &T, hash: SetHash) -> Result<String, String> {
+        let cfg = self.0;
+        let res = match cfg.mode {
+            Mode::Steady => steady::steady(st, rp, cfg.maxrnds, cfg.orig, cfg.lim, &mut Trace::off()),
+            _ => search::kickrnd(st, rp, cfg.maxrnds, cfg.orig, cfg.algo, &mut Trace::off())
+        };
+        let chain = Chain::from_rounds(&res)?;
+        let mut extra = String::new();
+        if let Some(par) = &cfg.resync {
+            resync::plan(rp, st, &chain, cfg.orig, par)?.emit(&cfg.name, par, &mut extra).unwrap();
+        }
+        let mut out = String::new();
+        chain.emit(cfg, hash, &extra, &mut out).unwrap();
+        Ok(out)
+    }
+    fn run_lat<T: CacheState, R: CacheRP<State=T>>(&self, rp: R, st: &T, hash: SetHash, lat: Latency) -> Result<String, String> {
+        match &self.0.latency {
+            Some((_, txt)) => self.run(&Weighted{rp, lat: lat.parse(txt)?}, st, hash),
+            None => self.run(&rp, st, hash)
+        }
+    }
+}
+
+impl<'a> PresetFn for Gen<'a> {
+    type Output = Result<String, String>;
+
+    fn call<P: Preset>(&self, pres: P) -> Self::Output {
+        let cfg = self.0;
+        let tlb = cfg.preset.starts_with("TLB::");
+        let level = cfg.level.unwrap_or(pres.levels());
+        let hash = cfg.hash.unwrap_or(match (tlb, level) {
+            (true, 1) => SetHash::Dtlb,
+            (true, _) => SetHash::Stlb,
+            _ => SetHash::Ext
+        });
+        if level == pres.levels() {
+            self.run_lat(pres.rp(), &pres.newstate(), hash, pres.latency())
+        } else if level == 1 {
+            let rp: PVRP = pres.l1().unwrap();
+            self.run_lat(rp, &rp.newpv(), hash, pres.latency())
+        } else {
+            Err(format!("preset {} has no standalone model of level {}", cfg.preset, level))
+        }
+    }
+}
+
+pub fn run(cfg: &Config) -> Result<String, String> {
+    preset::by_name(&cfg.preset, &Gen(cfg)).unwrap()
+}
@@ -0,0 +1,298 @@
+use std::fmt::Write;
+use std::sync::Mutex;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use crate::state::{CacheState, Entry, PAddr, QVec};
+use crate::state::hier::H2SState;
+use crate::policy::{CacheRP, Access, Origin, PVRP, QLRU};
+use crate::policy::hier::H2SRP;
+
+
+#[derive(PartialEq, Eq, Copy, Clone, Debug)]
+pub enum Family { Pvrp, Qlru, Tlb }
+
+impl Family {
+    pub const ALL: [Family; 3] = [Family::Pvrp, Family::Qlru, Family::Tlb];
+
+    pub fn name(&self) -> &'static str {
+        match self {
+            Family::Pvrp => "pvrp",
+            Family::Qlru => "qlru",
+            Family::Tlb => "tlb"
+        }
+    }
+    pub fn from_name(s: &str) -> Option<Self> {
+        Self::ALL.iter().copied().find(|f| f.name() == s)
+    }
+}
+
+pub struct Config {
+    pub traces: Vec<String>,
+    pub families: Vec<Family>,
+    pub ways: usize,
+    pub level: u8,
+    pub top: usize,
+    pub jobs: usize
+}
+
+pub const USAGE: &str = "\
+usage: cache-ninja fit [OPTIONS] TRACE...
+  -f, --family LIST   policy families to search: pvrp (all PVRP presets), qlru (the QLRU
+                      parameter grid), tlb (two-level TLB hierarchies of PVRP components with
+                      every miss/propagation flag combination), all (default: all)
+  -w, --ways N        associativity for the qlru family (default: 16)
+  -l, --level N       an observed hit means a hit in level N or below (default: 3, i.e. any level)
+  -k, --top N         also list up to N best inconsistent policies when fewer are consistent
+                      (default: 10)
+  -j, --jobs N        worker threads (default: available cores)
+Each TRACE file holds one experiment per line, replayed from the empty set: whitespace-separated
+accesses NAME (data load of page NAME), NAME/i (instruction fetch) or * (a fresh page, never
+reused), any of which may end in =h or =m for the observed hit or miss; '#' starts a comment.
+Prints every policy consistent with the observations, best fit first, as JSON.";
+
+impl Config {
+    pub fn parse(args: impl Iterator<Item = String>) -> Result<Self, String> {
+        let mut cfg = Config {
+            traces: Vec::new(),
+            families: Vec::new(),
+            ways: 16,
+            level: 3,
+            top: 10,
+            jobs: std::thread::available_parallelism().map(|n| n.get()).unwrap_or(1)
+        };
+        let args: Vec<String> = args.collect();
+        let mut it = args.iter();
+        while let Some(a) = it.next() {
+            let mut val = || it.next().ok_or_else(|| format!("missing value for '{}'", a));
+            match a.as_str() {
+                "-f" | "--family" => {
+                    for f in val()?.split(',') {
+                        match f {
+                            "all" => cfg.families.extend_from_slice(&Family::ALL),
+                            _ => cfg.families.push(Family::from_name(f).ok_or_else(|| format!("unknown family: '{}'", f))?)
+                        }
+                    }
+                }
+                "-w" | "--ways" => {
+                    cfg.ways = val()?.parse().map_err(|e| format!("--ways: {}", e))?;
+                    if cfg.ways < 1 || cfg.ways > crate::state::LANES {
+                        return Err(format!("--ways must be between 1 and {}", crate::state::LANES));
+                    }
+                }
+                "-l" | "--level" => cfg.level = val()?.parse().map_err(|e| format!("--level: {}", e))?,
+                "-k" | "--top" => cfg.top = val()?.parse().map_err(|e| format!("--top: {}", e))?,
+                "-j" | "--jobs" => cfg.jobs = val()?.parse().map_err(|e| format!("--jobs: {}", e))?,
+                "-h" | "--help" => return Err(String::new()),
+                _ if a.starts_with('-') => return Err(format!("unknown argument: '{}'", a)),
+                _ => cfg.traces.push(a.clone())
+            }
+        }
+        if cfg.traces.is_empty() {
+            return Err("no trace files given".to_string());
+        }
+        if cfg.families.is_empty() {
+            cfg.families.extend_from_slice(&Family::ALL);
+        }
+        cfg.families.dedup();
+        cfg.jobs = cfg.jobs.max(1);
+        Ok(cfg)
+    }
+}
+
+
+/// One access of an experiment, with its page numbered per line and the observation if any
+#[derive(Copy, Clone, Debug)]
+struct Probe {
+    page: PAddr,
+    orig: Origin,
+    obs: Option<bool>
+}
+
+type Line = Vec<Probe>;
+
+fn parse_trace(txt: &str, fname: &str, out: &mut Vec<Line>) -> Result<(), String> {
+    for (n, l) in txt.lines().enumerate() {
+        let err = |m: &str| format!("{}:{}: {}", fname, n + 1, m);
+        let mut names: Vec<&str> = Vec::new();
+        let mut line = Vec::new();
+        for tok in l.split('#').next().unwrap().split_whitespace() {
+            let (acc, obs) = match tok.rsplit_once('=') {
+                Some((a, "h")) => (a, Some(true)),
+                Some((a, "m")) => (a, Some(false)),
+                Some(_) => return Err(err(&format!("bad observation in '{}'", tok))),
+                None => (tok, None)
+            };
+            let (name, isnfetch) = match acc.strip_suffix("/i") {
+                Some(n) => (n, true),
+                None => (acc, false)
+            };
+            if name.is_empty() {
+                return Err(err(&format!("missing page name in '{}'", tok)));
+            }
+            let page = match names.iter().position(|&x| x == name && name != "*") {
+                Some(p) => p,
+                None => {
+                    names.push(name);
+                    names.len() - 1
+                }
+            };
+            if page >= crate::state::ADDRS - 2 {
+                return Err(err("too many distinct pages in one experiment"));
+            }
+            line.push(Probe{page: page as PAddr, orig: Origin{isnfetch}, obs});
+        }
+        if !line.is_empty() {
+            out.push(line);
+        }
+    }
+    Ok(())
+}
+
+
+/// Number of observations that `rp` mispredicts. Pages take the color of the origin they are
+/// first accessed from, as in the searches.
+fn mismatches<T: CacheState, R: CacheRP<State=T>>(rp: &R, st0: &T, lines: &[Line], level: u8, cap: usize) -> usize {
+    let mut bad = 0;
+    for line in lines {
+        let mut st = st0.clone();
+        let mut cols = [None; crate::state::ADDRS];
+        for p in line {
+            let col = *cols[p.page as usize].get_or_insert(p.orig.isnfetch);
+            let (ns, acc) = rp.update(&st, Entry::P(p.page, col), p.orig);
+            if let Some(obs) = p.obs {
+                let hit = match acc {
+                    Access::Hit(l, ..) => l.max(1) <= level,
+                    Access::Miss(..) => false
+                };
+                if hit != obs {
+                    bad += 1;
+                    if bad > cap {
+                        return bad;
+                    }
+                }
+            }
+            st = ns;
+        }
+    }
+    bad
+}
+
+/// A candidate policy, type-erased to its scoring function
+struct Cand {
+    name: String,
+    score: Box<dyn Fn(&[Line], u8, usize) -> usize + Send + Sync>
+}
+
+fn pvrp_name(rp: PVRP) -> String {
+    format!("PVRP::{:?}", rp)
+}
+
+const PVRPS: [PVRP; 5] = [PVRP::PLRU4, PVRP::PLRU8, PVRP::PLRU16, PVRP::LRU3PLRU4, PVRP::MRU3PLRU4];
+
+fn candidates(fam: Family, ways: usize) -> Vec<Cand> {
+    let mut out = Vec::new();
+    match fam {
+        Family::Pvrp => {
+            for rp in PVRPS {
+                out.push(Cand{name: pvrp_name(rp), score: Box::new(move |l, lv, cap| mismatches(&rp, &rp.newpv(), l, lv, cap))});
+            }
+        }
+        Family::Qlru => {
+            for hi in 0..256usize {
+                let h = [(hi & 3) as u8, (hi >> 2 & 3) as u8, (hi >> 4 & 3) as u8, (hi >> 6) as u8];
+                for m in 0..4 {
+                    for r in 0..4 {
+                        for u in 0..4 {
+                            for umo in [false, true] {
+                                let name = format!("{:?} ({} ways)", QLRU{h, m, r, u, umo}, ways);
+                                out.push(Cand{name, score: Box::new(move |l, lv, cap| {
+                                    let rp = QLRU{h, m, r, u, umo};
+                                    let st = rp.fillup(&QVec::new(ways), Entry::X);
+                                    mismatches(&rp, &st, l, lv, cap)
+                                })});
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        Family::Tlb => {
+            for rp1i in PVRPS {
+                for rp1d in PVRPS {
+                    for rp2 in PVRPS {
+                        for flags in 0..64u32 {
+                            let f = |i: u32| flags & 1 << i != 0;
+                            let rp = H2SRP {
+                                rp1i, rp1d, rp2, rxmem: false,
+                                miss_l1i: f(0), miss_l1d: f(1), miss_l2: f(2),
+                                prop_upi: f(3), prop_upd: f(4), prop_dn: f(5)
+                            };
+                            let name = format!("H2SRP {{ rp1i: {}, rp1d: {}, rp2: {}, rxmem: false, \
+                                                miss_l1i: {}, miss_l1d: {}, miss_l2: {}, \
+                                                prop_upi: {}, prop_upd: {}, prop_dn: {} }}",
+                                               pvrp_name(rp1i), pvrp_name(rp1d), pvrp_name(rp2),
+                                               rp.miss_l1i, rp.miss_l1d, rp.miss_l2,
+                                               rp.prop_upi, rp.prop_upd, rp.prop_dn);
+                            out.push(Cand{name, score: Box::new(move |l, lv, cap| {
+                                let st = H2SState{l1i: rp1i.newpv(), l1d: rp1d.newpv(), l2: rp2.newpv()};
+                                mismatches(&rp, &st, l, lv, cap)
+                            })});
+                        }
+                    }
+                }
+            }
+        }
+    }
+    out
+}
+
+
+pub fn run(cfg: &Config) -> Result<String, String> {
+    let mut lines = Vec::new();
+    for f in &cfg.traces {
+        let txt = std::fs::read_to_string(f).map_err(|e| format!("{}: {}", f, e))?;
+        parse_trace(&txt, f, &mut lines)?;
+    }
+    let nobs: usize = lines.iter().flatten().filter(|p| p.obs.is_some()).count();
+    if nobs == 0 {
+        return Err("traces contain no observations".to_string());
+    }
+
+    let cands: Vec<Cand> = cfg.families.iter().flat_map(|&f| candidates(f, cfg.ways)).collect();
+    // Scoring stops early once a candidate is worse than the `top`-th best so far; such partial
+    // counts are never among the ones printed
+    let next = AtomicUsize::new(0);
+    let best = Mutex::new(Vec::new());
+    let scores = Mutex::new(vec![usize::MAX; cands.len()]);
+    std::thread::scope(|s| {
+        for _ in 0..cfg.jobs.min(cands.len()) {
+            s.spawn(|| loop {
+                let i = next.fetch_add(1, Ordering::Relaxed);
+                if i >= cands.len() {
+                    break;
+                }
+                let cap = {
+                    let b = best.lock().unwrap();
+                    if b.len() < cfg.top.max(1) { nobs } else { b[b.len() - 1] }
+                };
+                let m = (cands[i].score)(&lines, cfg.level, cap);
+                scores.lock().unwrap()[i] = m;
+                let mut b = best.lock().unwrap();
+                let pos = b.partition_point(|&x| x <= m);
+                b.insert(pos, m);
+                b.truncate(cfg.top.max(1));
+            });
+        }
+    });
+    let scores = scores.into_inner().unwrap();
+
+    let mut order: Vec<usize> = (0..cands.len()).collect();
+    order.sort_by_key(|&i| scores[i]);
+    let nconsistent = order.iter().take_while(|&&i| scores[i] == 0).count();
+    let mut out = String::new();
+    for (rank, &i) in order.iter().take(nconsistent.max(cfg.top)).enumerate() {
+        writeln!(out, "{{\"rank\":{},\"policy\":\"{}\",\"mismatches\":{},\"observations\":{},\"fit\":{:.4},\"consistent\":{}}}",
+                 rank, cands[i].name, scores[i], nobs, 1.0 - scores[i] as f64 / nobs as f64, scores[i] == 0).unwrap();
+    }
+    Ok(out)
+}
@@ -0,0 +1,521 @@
+use std::collections::{HashMap, VecDeque};
+use std::fmt::Write;
+
+use crate::state::{CacheState, Entry, PAddr, PColor};
+use crate::policy::{CacheRP, Origin, PVRP};
+use crate::policy::stochastic::{StochasticRP, Noisy, Random};
+use crate::preset::{self, Preset, PresetFn};
+use crate::search;
+use crate::batch::Json;
+
+
+pub struct Config {
+    pub preset: String,
+    pub level: Option<usize>,
+    pub orig: Origin,
+    /// Probability of a foreign insertion after each access
+    pub noise: f64,
+    /// Maximize the eviction probability within this many accesses; `None` minimizes the
+    /// expected number of accesses instead
+    pub horizon: Option<usize>,
+    pub maxstates: usize,
+    pub maxlen: usize,
+    /// Max. number of concrete states tracked while deriving the fixed schedule
+    pub support: usize,
+    pub rows: usize
+}
+
+pub const USAGE: &str = "\
+usage: cache-ninja mdp [OPTIONS]
+  -p, --preset NAME   preset to model (default: TLB::KABYLAKE), or RANDOM:N for random
+                      replacement over N ways
+  -l, --level N       1 models the L1 data policy alone (default: the whole hierarchy)
+  -o, --origin ORIG   target access origin: data or isn (default: data)
+  -P, --noise P       probability of a foreign insertion into a random component after each
+                      access (default: 0)
+  -k, --horizon K     maximize the probability of eviction within K accesses (default: minimize
+                      the expected number of accesses until eviction)
+  -N, --states N      max. number of states to explore (default: 1000000)
+  -r, --len N         max. length of the fixed schedule when minimizing expected accesses
+                      (default: 64)
+  -B, --support N     max. number of possible states tracked while deriving the fixed schedule;
+                      the mass of dropped states counts as not evicted (default: 1000)
+  -T, --table N       max. decision table rows to print (default: 32)
+Solves the eviction problem as a Markov decision process over canonical states and prints the
+optimal value, a fixed access schedule derived from it and the optimal decision table as JSON.";
+
+impl Config {
+    pub fn parse(args: impl Iterator<Item = String>) -> Result<Self, String> {
+        let mut cfg = Config {
+            preset: "TLB::KABYLAKE".to_string(),
+            level: None,
+            orig: Origin{isnfetch: false},
+            noise: 0.0,
+            horizon: None,
+            maxstates: 1_000_000,
+            maxlen: 64,
+            support: 1000,
+            rows: 32
+        };
+        let args: Vec<String> = args.collect();
+        let mut it = args.iter();
+        while let Some(a) = it.next() {
+            let mut val = || it.next().ok_or_else(|| format!("missing value for '{}'", a));
+            match a.as_str() {
+                "-p" | "--preset" => {
+                    let v = val()?;
+                    cfg.preset = match random_ways(v) {
+                        Some(_) => v.to_ascii_uppercase(),
+                        None => preset::NAMES.iter().find(|n| n.eq_ignore_ascii_case(v))
+                            .ok_or_else(|| format!("unknown preset: '{}'", v))?.to_string()
+                    };
+                }
+                "-l" | "--level" => cfg.level = Some(val()?.parse().map_err(|e| format!("--level: {}", e))?),
+                "-o" | "--origin" => cfg.orig = match val()?.as_str() {
+                    "data" => Origin{isnfetch: false},
+                    "isn" => Origin{isnfetch: true},
+                    v => return Err(format!("unknown origin: '{}'", v))
+                },
+                "-P" | "--noise" => {
+                    cfg.noise = val()?.parse().map_err(|e| format!("--noise: {}", e))?;
+                    if !(0.0..1.0).contains(&cfg.noise) {
+                        return Err("--noise must be in [0, 1)".to_string());
+                    }
+                }
+                "-k" | "--horizon" => cfg.horizon = Some(val()?.parse().map_err(|e| format!("--horizon: {}", e))?),
+                "-N" | "--states" => cfg.maxstates = val()?.parse().map_err(|e| format!("--states: {}", e))?,
+                "-r" | "--len" => cfg.maxlen = val()?.parse().map_err(|e| format!("--len: {}", e))?,
+                "-B" | "--support" => cfg.support = val()?.parse().map_err(|e| format!("--support: {}", e))?,
+                "-T" | "--table" => cfg.rows = val()?.parse().map_err(|e| format!("--table: {}", e))?,
+                "-h" | "--help" => return Err(String::new()),
+                _ => return Err(format!("unknown argument: '{}'", a))
+            }
+        }
+        cfg.support = cfg.support.max(1);
+        if random_ways(&cfg.preset).map_or(false, |w| w < 1 || w > crate::state::LANES) {
+            return Err(format!("RANDOM needs between 1 and {} ways", crate::state::LANES));
+        }
+        Ok(cfg)
+    }
+}
+
+fn random_ways(name: &str) -> Option<usize> {
+    let (pre, n) = name.split_once(':')?;
+    if pre.eq_ignore_ascii_case("random") { n.parse().ok() } else { None }
+}
+
+
+/// Access to canonical attacker address `a` (the next fresh page if `a` is not in the state)
+type Act = (PAddr, PColor, Origin);
+
+/// Canonical states reachable from the initial distribution, with every action's outcome
+/// distribution over state indices. Evicted states are absorbing and have no actions.
+struct Model<T> {
+    states: Vec<T>,
+    index: HashMap<T, usize>,
+    acts: Vec<Vec<(Act, Vec<(f64, usize)>)>>,
+    goal: Vec<bool>,
+    init: Vec<(f64, usize)>
+}
+
+fn live_addrs<T: CacheState>(st: &T) -> Vec<(PAddr, PColor)> {
+    let mut out: Vec<(PAddr, PColor)> = Vec::new();
+    for e in st.entries() {
+        if let Entry::P(a, c) = e {
+            if !out.iter().any(|&(x, _)| x == a) {
+                out.push((a, c));
+            }
+        }
+    }
+    out
+}
+
+/// Actions in state `st`: every live address with its own color, and a fresh page of every kind
+fn actions<T: CacheState>(st: &T, kinds: &[(PColor, Origin)]) -> Vec<Act> {
+    let mut out = Vec::new();
+    let live = live_addrs(st);
+    for &(a, c) in &live {
+        for &(kc, o) in kinds {
+            if kc == c {
+                out.push((a, c, o));
+            }
+        }
+    }
+    let fresh = st.next_free_paddr();
+    for &(c, o) in kinds {
+        out.push((fresh, c, o));
+    }
+    out
+}
+
+impl<T: CacheState> Model<T> {
+    fn intern<R: StochasticRP<State=T>>(&mut self, rp: &R, st: T, queue: &mut VecDeque<(usize, usize)>,
+                                        depth: usize, max: usize) -> Result<usize, String> {
+        let st = st.canon();
+        if let Some(&i) = self.index.get(&st) {
+            return Ok(i);
+        }
+        if self.states.len() == max {
+            return Err(format!("more than {} reachable states; lower --horizon or use a smaller preset", max));
+        }
+        let i = self.states.len();
+        self.goal.push(rp.evicted(&st));
+        self.index.insert(st.clone(), i);
+        self.states.push(st);
+        self.acts.push(Vec::new());
+        queue.push_back((i, depth));
+        Ok(i)
+    }
+
+    fn build<R: StochasticRP<State=T>>(rp: &R, st0: &T, orig: Origin, kinds: &[(PColor, Origin)],
+                                       maxdepth: usize, max: usize) -> Result<Self, String> {
+        let mut m = Model{states: Vec::new(), index: HashMap::new(), acts: Vec::new(), goal: Vec::new(), init: Vec::new()};
+        let mut queue = VecDeque::new();
+        for (p, st, _) in rp.outcomes(st0, Entry::T, orig) {
+            let i = m.intern(rp, st, &mut queue, 0, max)?;
+            m.init.push((p, i));
+        }
+        while let Some((i, depth)) = queue.pop_front() {
+            if m.goal[i] || depth == maxdepth {
+                continue;
+            }
+            let st = m.states[i].clone();
+            let mut acts = Vec::new();
+            for act in actions(&st, kinds) {
+                let mut outs = Vec::new();
+                for (p, ns, _) in rp.outcomes(&st, Entry::P(act.0, act.1), act.2) {
+                    outs.push((p, m.intern(rp, ns, &mut queue, depth + 1, max)?));
+                }
+                acts.push((act, outs));
+            }
+            m.acts[i] = acts;
+        }
+        Ok(m)
+    }
+
+    fn expect(outs: &[(f64, usize)], v: &[f64]) -> f64 {
+        outs.iter().map(|&(p, j)| p * v[j]).sum()
+    }
+
+    /// Finite-horizon value iteration: `v[t][s]` is the highest probability of eviction within
+    /// `t` more accesses, `pol[t][s]` the action achieving it. Among equally likely actions,
+    /// the one with the largest `area[t][s]`, the probability of being evicted after 0..=t
+    /// accesses summed, wins, so that no accesses are wasted when the horizon is longer than
+    /// needed.
+    fn horizon(&self, k: usize) -> (Vec<Vec<f64>>, Vec<Vec<f64>>, Vec<Vec<usize>>) {
+        let n = self.states.len();
+        let v0: Vec<f64> = self.goal.iter().map(|&g| if g { 1.0 } else { 0.0 }).collect();
+        let mut area = vec![v0.clone()];
+        let mut v = vec![v0];
+        let mut pol = vec![vec![usize::MAX; n]];
+        for t in 1..=k {
+            let mut vt = v[t - 1].clone();
+            let mut at: Vec<f64> = (0..n).map(|s| if self.goal[s] { (t + 1) as f64 } else { 0.0 }).collect();
+            let mut pt = vec![usize::MAX; n];
+            for s in 0..n {
+                let mut tie = f64::NEG_INFINITY;
+                for (a, (_, outs)) in self.acts[s].iter().enumerate() {
+                    let q = Self::expect(outs, &v[t - 1]);
+                    let q2 = Self::expect(outs, &area[t - 1]);
+                    if pt[s] == usize::MAX || q > vt[s] + 1e-12 || q > vt[s] - 1e-12 && q2 > tie + 1e-12 {
+                        vt[s] = q;
+                        pt[s] = a;
+                        tie = q2;
+                    }
+                }
+                if pt[s] != usize::MAX {
+                    at[s] = tie;
+                }
+            }
+            v.push(vt);
+            area.push(at);
+            pol.push(pt);
+        }
+        (v, area, pol)
+    }
+
+    /// Value iteration for the expected number of accesses until eviction, in place
+    /// (Gauss-Seidel) until the largest change drops below `eps`. States that cannot reach an
+    /// evicted one keep growing and are reported as infinite.
+    fn expected(&self, eps: f64, maxiter: usize) -> (Vec<f64>, Vec<usize>) {
+        let n = self.states.len();
+        let mut v = vec![0.0; n];
+        let mut pol = vec![usize::MAX; n];
+        for _ in 0..maxiter {
+            let mut delta: f64 = 0.0;
+            for s in 0..n {
+                if self.goal[s] {
+                    continue;
+                }
+                let mut best = f64::INFINITY;
+                for (a, (_, outs)) in self.acts[s].iter().enumerate() {
+                    let q = 1.0 + Self::expect(outs, &v);
+                    if q < best - 1e-12 {
+                        best = q;
+                        pol[s] = a;
+                    }
+                }
+                delta = delta.max(best - v[s]);
+                v[s] = best;
+            }
+            if delta < eps {
+                return (v, pol);
+            }
+        }
+        for s in 0..n {
+            if v[s] > maxiter as f64 / 2.0 {
+                v[s] = f64::INFINITY;
+            }
+        }
+        (v, pol)
+    }
+}
+
+
+/// Open-loop schedule: the attacker cannot observe the cache state, so at each step the action
+/// is chosen that is best on average over the current state distribution, valuing each
+/// successor by its fully observable optimum (`score`, higher is better, with a tie-breaker).
+/// Also returns the total probability mass pruned from the tracked distribution.
+fn schedule<T: CacheState, R: StochasticRP<State=T>>(rp: &R, m: &Model<T>, st0: &T, orig: Origin,
+                                                      kinds: &[(PColor, Origin)], len: usize, support: usize,
+                                                      score: impl Fn(usize, usize) -> (f64, f64))
+                                                      -> (Vec<(Entry, Origin)>, Vec<f64>, f64) {
+    let mut dist: HashMap<T, f64> = HashMap::new();
+    for (p, st, _) in rp.outcomes(st0, Entry::T, orig) {
+        *dist.entry(st).or_insert(0.0) += p;
+    }
+    let mut done = dist.iter().filter(|(s, _)| rp.evicted(s)).fold(0.0, |a, (_, &p)| a + p);
+    dist.retain(|s, _| !rp.evicted(s));
+    let mut seq = Vec::new();
+    let mut evicted = Vec::new();
+    let mut dropped = 0.0;
+    for t in 0..len {
+        if dist.is_empty() {
+            break;
+        }
+        // Candidate actions: live addresses of any possible state, and fresh pages
+        let used = dist.keys().fold(0u128, |m, s| m | s.paddr_mask());
+        if used.count_ones() as usize >= crate::state::ADDRS - 2 {
+            break;
+        }
+        let mut cands: Vec<Act> = Vec::new();
+        for s in dist.keys() {
+            for (a, c) in live_addrs(s) {
+                for &(kc, o) in kinds {
+                    if kc == c && !cands.contains(&(a, c, o)) {
+                        cands.push((a, c, o));
+                    }
+                }
+            }
+        }
+        let fresh = (!used).trailing_zeros() as PAddr;
+        for &(c, o) in kinds {
+            cands.push((fresh, c, o));
+        }
+        let value = |act: &Act| -> (f64, f64) {
+            let mut q = (0.0, 0.0);
+            for (s, &p) in &dist {
+                for (pp, ns, _) in rp.outcomes(s, Entry::P(act.0, act.1), act.2) {
+                    let sc = m.index.get(&ns.canon()).map_or((f64::NEG_INFINITY, 0.0), |&j| score(t, j));
+                    q.0 += p * pp * sc.0;
+                    q.1 += p * pp * sc.1;
+                }
+            }
+            q
+        };
+        let mut best = ((f64::NEG_INFINITY, f64::NEG_INFINITY), cands[0]);
+        for act in &cands {
+            let q = value(act);
+            if q.0 > best.0.0 + 1e-12 || q.0 > best.0.0 - 1e-12 && q.1 > best.0.1 + 1e-12 {
+                best = (q, *act);
+            }
+        }
+        let act = best.1;
+        let mut nd: HashMap<T, f64> = HashMap::new();
+        for (s, p) in dist.drain() {
+            for (pp, ns, _) in rp.outcomes(&s, Entry::P(act.0, act.1), act.2) {
+                if rp.evicted(&ns) {
+                    done += p * pp;
+                } else {
+                    *nd.entry(ns).or_insert(0.0) += p * pp;
+                }
+            }
+        }
+        // Keep only the `support` likeliest states, scaled up to the same total: the
+        // distribution over concrete states otherwise grows with every random replacement,
+        // and unlikely states would pin addresses forever
+        if nd.len() > support {
+            let total: f64 = nd.values().sum();
+            let mut ps: Vec<f64> = nd.values().copied().collect();
+            ps.sort_unstable_by(|a, b| b.partial_cmp(a).unwrap());
+            let cut = ps[support - 1];
+            let mut kept = 0;
+            nd.retain(|_, p| {
+                let keep = *p > cut || *p == cut && kept < support;
+                kept += keep as usize;
+                keep
+            });
+            let left: f64 = nd.values().sum();
+            dropped += total - left;
+            for p in nd.values_mut() {
+                *p *= total / left;
+            }
+        }
+        dist = nd;
+        seq.push((Entry::P(act.0, act.1), act.2));
+        evicted.push(done);
+    }
+    (seq, evicted, dropped)
+}
+
+fn fmt_f64(x: f64) -> String {
+    if x.is_finite() { format!("{:.6}", x) } else { "null".to_string() }
+}
+
+struct Solve<'a>(&'a Config);
+
+impl<'a> Solve<'a> {
+    fn run<T: CacheState, R: StochasticRP<State=T>>(&self, rp: &R, st0: &T, kinds: &[(PColor, Origin)])
+                                                    -> Result<String, String> {
+        let cfg = self.0;
+        let m = Model::build(rp, st0, cfg.orig, kinds, cfg.horizon.unwrap_or(usize::MAX), cfg.maxstates)?;
+        let mut out = String::new();
+        write!(out, "\"states\":{},", m.states.len()).unwrap();
+        // Decision table rows: (steps left, state, action), reachable under the optimal policy
+        let mut rows: Vec<(usize, usize, Act, f64)> = Vec::new();
+        let mut nrows = 0;
+        let mut seen = std::collections::HashSet::new();
+        let mut queue: VecDeque<(usize, usize)> = VecDeque::new();
+        let (val, seq, evicted, dropped);
+        match cfg.horizon {
+            Some(k) => {
+                let (v, area, pol) = m.horizon(k);
+                val = m.init.iter().map(|&(p, s)| p * v[k][s]).sum::<f64>();
+                for &(_, s) in &m.init {
+                    queue.push_back((k, s));
+                }
+                while let Some((t, s)) = queue.pop_front() {
+                    if t == 0 || m.goal[s] || !seen.insert((t, s)) {
+                        continue;
+                    }
+                    let (act, outs) = &m.acts[s][pol[t][s]];
+                    nrows += 1;
+                    if rows.len() < cfg.rows {
+                        rows.push((t, s, *act, v[t][s]));
+                    }
+                    queue.extend(outs.iter().map(|&(_, j)| (t - 1, j)));
+                }
+                let r = schedule(rp, &m, st0, cfg.orig, kinds, k, cfg.support, |t, j| (v[k - t - 1][j], area[k - t - 1][j]));
+                seq = r.0;
+                evicted = r.1;
+                dropped = r.2;
+            }
+            None => {
+                let (v, pol) = m.expected(1e-9, 100_000);
+                val = m.init.iter().map(|&(p, s)| p * v[s]).sum::<f64>();
+                for &(_, s) in &m.init {
+                    queue.push_back((0, s));
+                }
+                while let Some((_, s)) = queue.pop_front() {
+                    if m.goal[s] || pol[s] == usize::MAX || !seen.insert((0, s)) {
+                        continue;
+                    }
+                    let (act, outs) = &m.acts[s][pol[s]];
+                    nrows += 1;
+                    if rows.len() < cfg.rows {
+                        rows.push((0, s, *act, v[s]));
+                    }
+                    queue.extend(outs.iter().map(|&(_, j)| (0, j)));
+                }
+                let r = schedule(rp, &m, st0, cfg.orig, kinds, cfg.maxlen, cfg.support, |_, j| (-v[j], 0.0));
+                seq = r.0;
+                evicted = r.1;
+                dropped = r.2;
+            }
+        }
+        write!(out, "\"value\":{},", fmt_f64(val)).unwrap();
+        // Value of the fixed schedule: eviction probability by its end, or expected accesses
+        // summed over its length (a lower bound if `residual` probability is left unevicted);
+        // both approximate if `dropped` mass was pruned from the tracked distribution
+        let last = evicted.last().copied().unwrap_or(1.0);
+        write!(out, "\"schedule\":{{\"dropped\":{:.3e},", dropped).unwrap();
+        match cfg.horizon {
+            Some(_) => write!(out, "\"value\":{},", fmt_f64(last)).unwrap(),
+            None => {
+                // Sum of the probabilities of not being evicted after 0, 1, ... accesses
+                let d0 = m.init.iter().filter(|&&(_, s)| m.goal[s]).fold(0.0, |a, &(p, _)| a + p);
+                let e = (1.0 - d0) + evicted.iter().rev().skip(1).fold(0.0, |a, d| a + 1.0 - d);
+                write!(out, "\"value\":{},\"residual\":{:.3e},",
+                       fmt_f64(e), (1.0 - last).max(0.0)).unwrap();
+            }
+        }
+        out.push_str("\"seq\":");
+        seq.json(&mut out);
+        out.push_str(",\"evicted\":[");
+        for (i, d) in evicted.iter().enumerate() {
+            write!(out, "{}{:.6}", if i > 0 { "," } else { "" }, d).unwrap();
+        }
+        write!(out, "]}},\"rows\":{},\"table\":[", nrows).unwrap();
+        for (i, &(t, s, act, v)) in rows.iter().enumerate() {
+            if i > 0 {
+                out.push(',');
+            }
+            if cfg.horizon.is_some() {
+                write!(out, "{{\"left\":{},", t).unwrap();
+            } else {
+                out.push('{');
+            }
+            write!(out, "\"state\":\"{:?}\",\"act\":", m.states[s]).unwrap();
+            (Entry::P(act.0, act.1), act.2).json(&mut out);
+            write!(out, ",\"value\":{}}}", fmt_f64(v)).unwrap();
+        }
+        out.push(']');
+        Ok(out)
+    }
+
+    /// Deterministic policy with noise; access kinds are those its own search uses
+    fn run_det<T: CacheState, R: CacheRP<State=T>>(&self, rp: R, st0: &T) -> Result<String, String> {
+        let mut kinds: Vec<(PColor, Origin)> = Vec::new();
+        for acc in rp.outedges(&rp.victim(st0, self.0.orig)).1 {
+            if let (Entry::P(_, c), o) = search::access_entry(&acc) {
+                if !kinds.contains(&(c, o)) {
+                    kinds.push((c, o));
+                }
+            }
+        }
+        self.run(&Noisy{rp, p: self.0.noise}, st0, &kinds)
+    }
+}
+
+impl<'a> PresetFn for Solve<'a> {
+    type Output = Result<String, String>;
+
+    fn call<P: Preset>(&self, pres: P) -> Self::Output {
+        let cfg = self.0;
+        match cfg.level {
+            None => self.run_det(pres.rp(), &pres.newstate()),
+            Some(l) if l == pres.levels() => self.run_det(pres.rp(), &pres.newstate()),
+            Some(1) => {
+                let rp: PVRP = pres.l1().unwrap();
+                self.run_det(rp, &rp.newpv())
+            }
+            Some(l) => Err(format!("preset {} has no standalone model of level {}", cfg.preset, l))
+        }
+    }
+}
+
+pub fn run(cfg: &Config) -> Result<String, String> {
+    let solve = Solve(cfg);
+    let res = match random_ways(&cfg.preset) {
+        Some(ways) => {
+            let rp = Noisy{rp: Random{ways}, p: cfg.noise};
+            solve.run(&rp, &rp.rp.newstate(), &[(false, Origin{isnfetch: false})])
+        }
+        None => preset::by_name(&cfg.preset, &solve).unwrap()
+    }?;
+    let objective = match cfg.horizon {
+        Some(k) => format!("\"horizon\",\"k\":{}", k),
+        None => "\"expected\"".to_string()
+    };
+    Ok(format!("{{\"preset\":\"{}\",\"noise\":{},\"objective\":{},{}}}\n", cfg.preset, cfg.noise, objective, res))
+}
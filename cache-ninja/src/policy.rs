@@ -24,10 +24,44 @@ pub trait CacheRP: std::fmt::Debug {
     fn evictim1(&self, st: &Self::State) -> Entry;
     fn update(&self, st: &Self::State, val: Entry, orig: Origin) -> (Self::State, Access);
     fn update_shallow(&self, st: &Self::State, val: Entry, orig: Origin) -> (Self::State, Access);
+    /// Number of independently updated components (cache structures) in the state
+    fn ncomp(&self) -> usize { 1 }
+    /// Insert a foreign entry into component `comp` only (components in state field order),
+    /// modelling noise such as page walks or sibling-thread accesses
+    fn noise(&self, st: &Self::State, comp: usize) -> Self::State;
+
+    /// Cost of one access, as used by the cost-aware searches
+    fn access_cost(&self, acc: &Access) -> usize {
+        match acc {
+            Access::Hit(..) => Self::HIT_COST,
+            Access::Miss(..) => Self::MISS_COST
+        }
+    }
 
     fn update_def(&self, st: &Self::State, val: Entry) -> (Self::State, Access) {
         self.update(st, val, Default::default())
     }
+    /// State after the victim accesses its target(s)
+    fn victim(&self, st: &Self::State, orig: Origin) -> Self::State {
+        self.update(st, Entry::T, orig).0
+    }
+    /// Whether every target has been evicted
+    fn evicted(&self, st: &Self::State) -> bool {
+        !st.contains(Entry::T)
+    }
+    /// Lower bound on the cost of reaching an `evicted` state
+    fn heur_evict(&self, st: &Self::State) -> usize {
+        self.heur(st, Entry::T)
+    }
+    /// Number of targets that can also be evicted one after the other, should evicting them
+    /// all in one search be out of reach; phase `ph` evicts the `ph`-th
+    fn nphases(&self) -> usize { 1 }
+    /// Whether an access belongs to phase `ph`, i.e. only touches the sets of its target
+    fn in_phase(&self, _acc: &Access, _ph: usize) -> bool { true }
+    /// Whether the target of phase `ph` has been evicted
+    fn phase_done(&self, st: &Self::State, _ph: usize) -> bool {
+        self.evicted(st)
+    }
     fn outedges_priced(&self, st: &Self::State) -> (Vec<Self::State>, Vec<Access>, Vec<usize>) {
         use std::iter::{once, repeat};
 
@@ -58,17 +92,24 @@ pub trait CacheRP: std::fmt::Debug {
     fn successors(&self, st: &Self::State) -> Vec<Self::State> {
         self.outedges_priced(st).0
     }
-    fn find_outedge(&self, st: &Self::State, nx: &Self::State) -> Option<Access> {
-        let (s, e) = self.outedges(st);
-        if let Some(i) = s.iter().position(|x| x == nx) {
-            Some(e[i])
-        } else {
-            None
+}
+
+
+/// Widen permutation tables to `LANES`-byte shuffle masks, zeroing unused lanes
+const fn shuf_table<const N: usize, const M: usize>(pi: &[[u8; N]; M]) -> [[u8; LANES]; M] {
+    let mut out = [[0x80; LANES]; M];
+    let mut i = 0;
+    while i < M {
+        let mut j = 0;
+        while j < N {
+            out[i][j] = pi[i][j];
+            j += 1;
         }
+        i += 1;
     }
+    out
 }
 
-
 #[derive(PartialEq, Eq, Hash, Copy, Clone, Debug)]
 pub enum PVRP { PLRU4, PLRU8, PLRU16, LRU3PLRU4, MRU3PLRU4 }
 impl PVRP {
@@ -145,6 +186,12 @@ impl PVRP {
     ];
     const HF_MRU3PLRU4: [u8; 12] = [4, 4, 4, 4, 4, 4, 3, 3, 3, 2, 2, 1];
 
+    const SH_PLRU4: [[u8; LANES]; 5] = shuf_table(&Self::PI_PLRU4);
+    const SH_PLRU8: [[u8; LANES]; 9] = shuf_table(&Self::PI_PLRU8);
+    const SH_PLRU16: [[u8; LANES]; 17] = shuf_table(&Self::PI_PLRU16);
+    const SH_LRU3PLRU4: [[u8; LANES]; 13] = shuf_table(&Self::PI_LRU3PLRU4);
+    const SH_MRU3PLRU4: [[u8; LANES]; 13] = shuf_table(&Self::PI_MRU3PLRU4);
+
     const fn pilen(&self) -> usize {
         use PVRP::*;
         match self {
@@ -155,14 +202,15 @@ impl PVRP {
             MRU3PLRU4 => 12
         }
     }
-    const fn pi(&self, i: usize) -> &'static [u8] {
+    /// Permutation `i` as a byte-shuffle mask over the packed state
+    const fn shuf(&self, i: usize) -> &'static [u8; LANES] {
         use PVRP::*;
         match self {
-            PLRU4 => &Self::PI_PLRU4[i],
-            PLRU8 => &Self::PI_PLRU8[i],
-            PLRU16 => &Self::PI_PLRU16[i],
-            LRU3PLRU4 => &Self::PI_LRU3PLRU4[i],
-            MRU3PLRU4 => &Self::PI_MRU3PLRU4[i]
+            PLRU4 => &Self::SH_PLRU4[i],
+            PLRU8 => &Self::SH_PLRU8[i],
+            PLRU16 => &Self::SH_PLRU16[i],
+            LRU3PLRU4 => &Self::SH_LRU3PLRU4[i],
+            MRU3PLRU4 => &Self::SH_MRU3PLRU4[i]
         }
     }
     const fn hf(&self, i: usize) -> usize {
@@ -179,8 +227,8 @@ impl PVRP {
     pub fn newpv(&self) -> PVec {
         PVec::new(self.pilen())
     }
-    fn permute(&self, pv: &Vec<Entry>, i: usize) -> Vec<Entry> {
-        self.pi(i).iter().map(|&x| pv[x as usize]).collect()
+    fn permute(&self, pv: &PVec, i: usize) -> PVec {
+        PVec::from_raw(lane_shuffle(pv.raw(), self.shuf(i)), pv.len())
     }
 }
 
@@ -195,24 +243,29 @@ impl CacheRP for PVRP {
         }
     }
     fn evictim(&self, st: &PVec) -> Entry {
-        st.0[st.0.len()-1]
+        st.get(st.len()-1)
     }
     fn evictim1(&self, st: &PVec) -> Entry {
         self.evictim(st)
     }
     fn update(&self, st: &PVec, val: Entry, orig: Origin) -> (PVec, Access) {
         match st.rank(val) {
-            Some(i) => (PVec(self.permute(&st.0, i)), Access::Hit(0, val, orig)),
+            Some(i) => (self.permute(st, i), Access::Hit(0, val, orig)),
             None => {
-                let mut nv = self.permute(&st.0, self.pilen());
-                nv[0] = val;
-                (PVec(nv), Access::Miss(val, orig))
+                let mut nv = self.permute(st, self.pilen());
+                nv.set(0, val);
+                (nv, Access::Miss(val, orig))
             }
         }
     }
     fn update_shallow(&self, st: &PVec, val: Entry, orig: Origin) -> (PVec, Access) {
         self.update(st, val, orig)
     }
+    fn noise(&self, st: &PVec, _comp: usize) -> PVec {
+        let mut nv = self.permute(st, self.pilen());
+        nv.set(0, Entry::X);
+        nv
+    }
 }
 
 
@@ -226,7 +279,7 @@ pub struct QLRU {
 }
 
 impl QLRU {
-    fn ageup(&self, av: &mut Vec<u8>, trigi: usize) {
+    fn ageup(&self, av: &mut [u8], trigi: usize) {
         let maxage = av.iter().copied().max().unwrap_or_default();
         let incby = if self.u & 2 != 0 { 1 } else { 3 - maxage };
         if maxage < 3 {
@@ -240,25 +293,28 @@ impl QLRU {
         }
     }
     fn handle_hit(&self, st: &QVec, i: usize) -> QVec {
-        let mut nav = st.age.to_vec();
-        nav[i] = self.h[st.age[i] as usize];
+        let mut nav = st.ages();
+        nav[i] = self.h[st.age(i) as usize];
         if !self.umo {
-            self.ageup(&mut nav, i);
+            self.ageup(&mut nav[..st.len()], i);
         }
-        QVec{age: nav, ent: st.ent.to_vec()}
+        let mut ns = *st;
+        ns.set_ages(&nav);
+        ns
     }
     fn handle_miss(&self, st: &QVec, val: Entry) -> QVec {
-        let evi = st.evictim().unwrap_or(if self.r & 2 != 0 { st.age.len() - 1 } else { 0 });
-        let mut nev = st.ent.to_vec();
-        let mut nav = st.age.to_vec();
-        nev[evi] = val;
+        let evi = st.evictim().unwrap_or(if self.r & 2 != 0 { st.len() - 1 } else { 0 });
+        let mut ns = *st;
+        let mut nav = st.ages();
+        ns.set(evi, val);
         nav[evi] = self.m;
-        self.ageup(&mut nav, evi);
-        QVec{age: nav, ent: nev}
+        self.ageup(&mut nav[..st.len()], evi);
+        ns.set_ages(&nav);
+        ns
     }
     pub fn fillup(&self, st: &QVec, val: Entry) -> QVec {
         let mut s = self.handle_miss(st, val);
-        for _ in 1..st.age.len() {
+        for _ in 1..st.len() {
             s = self.handle_miss(&s, val);
         }
         s
@@ -271,15 +327,17 @@ impl CacheRP for QLRU {
 
     fn heur(&self, st: &QVec, val: Entry) -> usize {
         match st.rank(val) {
-            Some((age, i)) => 1 +
-                st.age.iter().map(|x| if *x > age {1} else {0} as usize).sum::<usize>() +
-                st.age.iter().take(i).map(|x| if *x == age {1} else {0}).sum::<usize>(),
+            Some((age, i)) => {
+                let av = st.ages();
+                let av = &av[..st.len()];
+                1 + av.iter().filter(|&&x| x > age).count() + av.iter().take(i).filter(|&&x| x == age).count()
+            }
             _ => 0
         }
     }
     fn evictim(&self, st: &QVec) -> Entry {
         match st.evictim() {
-            Some(i) => st.ent[i],
+            Some(i) => st.get(i),
             None => Entry::X
         }
     }
@@ -295,6 +353,9 @@ impl CacheRP for QLRU {
     fn update_shallow(&self, st: &QVec, val: Entry, orig: Origin) -> (QVec, Access) {
         self.update(st, val, orig)
     }
+    fn noise(&self, st: &QVec, _comp: usize) -> QVec {
+        self.handle_miss(st, Entry::X)
+    }
 }
 
 
@@ -348,6 +409,13 @@ pub mod hier {
             (H2UState{l1: self.rp1.update_def(&st.l1, val).0, l2: st.l2.clone()},
              if st.l1.contains(val) { Access::Hit(1, val, orig) } else { Access::Miss(val, orig) })
         }
+        fn ncomp(&self) -> usize { 2 }
+        fn noise(&self, st: &Self::State, comp: usize) -> Self::State {
+            match comp {
+                0 => H2UState{l1: self.rp1.noise(&st.l1, 0), l2: st.l2.clone()},
+                _ => H2UState{l1: st.l1.clone(), l2: self.rp2.noise(&st.l2, 0)}
+            }
+        }
     }
 
 
@@ -414,6 +482,16 @@ pub mod hier {
             (H3UState{l1: self.rp1.update_def(&st.l1, val).0, l2: st.l2.clone(), l3: st.l3.clone()},
              if st.l1.contains(val) { Access::Hit(1, val, orig) } else { Access::Miss(val, orig) })
         }
+        fn ncomp(&self) -> usize { 3 }
+        fn noise(&self, st: &Self::State, comp: usize) -> Self::State {
+            let mut ns = st.clone();
+            match comp {
+                0 => ns.l1 = self.rp1.noise(&st.l1, 0),
+                1 => ns.l2 = self.rp2.noise(&st.l2, 0),
+                _ => ns.l3 = self.rp3.noise(&st.l3, 0)
+            }
+            ns
+        }
     }
 
 
@@ -491,6 +569,16 @@ pub mod hier {
                  if st.l1d.contains(val) { Access::Hit(1, val, orig) } else { Access::Miss(val, orig) })
              }
         }
+        fn ncomp(&self) -> usize { 3 }
+        fn noise(&self, st: &Self::State, comp: usize) -> Self::State {
+            let mut ns = st.clone();
+            match comp {
+                0 => ns.l1i = self.rp1i.noise(&st.l1i, 0),
+                1 => ns.l1d = self.rp1d.noise(&st.l1d, 0),
+                _ => ns.l2 = self.rp2.noise(&st.l2, 0)
+            }
+            ns
+        }
         fn outedges_priced(&self, st: &Self::State) -> (Vec<Self::State>, Vec<Access>, Vec<usize>) {
             const DATACOL: PColor = false;
             const ISNFCOL: PColor = true;
@@ -547,3 +635,405 @@ pub mod hier {
         }
     }
 }
+
+
+pub mod multi {
+    use crate::state::*;
+    use crate::state::multi::*;
+    use crate::policy::*;
+
+    /// Two-level policy where `nsets` sets of the second level share one first-level set,
+    /// with one target per second-level set
+    #[derive(Debug)]
+    pub struct MSRP<RP1: CacheRP<EVict=Entry>, RP2: CacheRP<EVict=Entry>> {
+        pub rp1: RP1,
+        pub rp2: RP2,
+        pub nsets: usize,
+        pub miss_l1: bool,
+        pub miss_l2: bool,
+        pub prop_up: bool,
+        pub prop_dn: bool
+    }
+
+    impl<RP1, RP2> MSRP<RP1, RP2>
+    where RP1: CacheRP<EVict=Entry>, RP2: CacheRP<EVict=Entry>, RP2::State: Copy
+    {
+        pub fn newstate(&self, l1: RP1::State, l2: RP2::State) -> MSState<RP1::State, RP2::State> {
+            MSState::new(l1, l2, self.nsets)
+        }
+    }
+
+    impl<RP1, RP2> CacheRP for MSRP<RP1, RP2>
+    where RP1: CacheRP<EVict=Entry>, RP2: CacheRP<EVict=Entry>, RP2::State: Copy
+    {
+        type State = MSState<RP1::State, RP2::State>;
+        type EVict = Entry;
+
+        fn heur(&self, st: &Self::State, val: Entry) -> usize {
+            let l2h = match val {
+                Entry::P(a, _) if ms_set(a) < self.nsets => self.rp2.heur(&st.l2[ms_set(a)], val),
+                _ => 0
+            };
+            std::cmp::max(self.rp1.heur(&st.l1, val), l2h)
+        }
+        fn evictim(&self, st: &Self::State) -> Self::EVict {
+            self.rp1.evictim(&st.l1)
+        }
+        fn evictim1(&self, st: &Self::State) -> Entry {
+            self.evictim(st)
+        }
+        fn update(&self, st: &Self::State, val: Entry, orig: Origin) -> (Self::State, Access) {
+            let set = match val {
+                Entry::P(a, _) => ms_set(a),
+                _ => panic!("MSRP only handles addressed entries, got {:?}", val)
+            };
+            let mut ns = st.clone();
+            let acc = if st.l1.contains(val) {
+                ns.l1 = self.rp1.update_def(&st.l1, val).0;
+                if self.prop_dn {
+                    ns.l2[set] = self.rp2.update_def(&st.l2[set], val).0;
+                }
+                Access::Hit(1, val, orig)
+            } else if st.l2[set].contains(val) {
+                if self.prop_up {
+                    ns.l1 = self.rp1.update_def(&st.l1, val).0;
+                }
+                ns.l2[set] = self.rp2.update_def(&st.l2[set], val).0;
+                Access::Hit(2, val, orig)
+            } else {
+                if self.miss_l1 {
+                    ns.l1 = self.rp1.update_def(&st.l1, val).0;
+                }
+                if self.miss_l2 {
+                    ns.l2[set] = self.rp2.update_def(&st.l2[set], val).0;
+                }
+                Access::Miss(val, orig)
+            };
+            (ns, acc)
+        }
+        fn update_shallow(&self, st: &Self::State, val: Entry, orig: Origin) -> (Self::State, Access) {
+            (MSState{l1: self.rp1.update_def(&st.l1, val).0, ..*st},
+             if st.l1.contains(val) { Access::Hit(1, val, orig) } else { Access::Miss(val, orig) })
+        }
+        /// Component 1 stands for every second-level set, each receiving its own insertion
+        fn ncomp(&self) -> usize { 2 }
+        fn noise(&self, st: &Self::State, comp: usize) -> Self::State {
+            let mut ns = st.clone();
+            match comp {
+                0 => ns.l1 = self.rp1.noise(&st.l1, 0),
+                _ => for set in 0..self.nsets {
+                    ns.l2[set] = self.rp2.noise(&st.l2[set], 0);
+                }
+            }
+            ns
+        }
+        fn outedges_priced(&self, st: &Self::State) -> (Vec<Self::State>, Vec<Access>, Vec<usize>) {
+            use std::iter::repeat;
+
+            let hits = st.entries().filter(|x| match x {
+                Entry::P(a, _) => !ms_is_target(*a) && !cfg!(feature = "nohit"),
+                _ => false
+            });
+            let misses = (0..self.nsets).map(|set| Entry::P(st.free_paddr(set), false));
+            let (vst, vacc): (Vec<Self::State>, Vec<Access>) =
+                hits.chain(misses).map(|x| self.update_def(st, x)).unzip();
+            let costs = repeat(Self::HIT_COST).take(vst.len() - self.nsets)
+                .chain(repeat(Self::MISS_COST).take(self.nsets)).collect();
+            (vst, vacc, costs)
+        }
+
+        fn victim(&self, st: &Self::State, orig: Origin) -> Self::State {
+            (0..self.nsets).fold(st.clone(), |s, set| self.update(&s, ms_target(set), orig).0)
+        }
+        fn evicted(&self, st: &Self::State) -> bool {
+            (0..self.nsets).all(|set| !st.contains(ms_target(set)))
+        }
+        /// Every access touches exactly one second-level set, so per-set bounds add up
+        fn heur_evict(&self, st: &Self::State) -> usize {
+            let l1h = (0..self.nsets).map(|set| self.rp1.heur(&st.l1, ms_target(set))).max().unwrap_or(0);
+            let l2h = (0..self.nsets).map(|set| self.rp2.heur(&st.l2[set], ms_target(set))).sum();
+            std::cmp::max(l1h, l2h)
+        }
+        /// Set by set, each phase only accessing its own set's addresses
+        fn nphases(&self) -> usize {
+            self.nsets
+        }
+        fn in_phase(&self, acc: &Access, ph: usize) -> bool {
+            match acc {
+                Access::Hit(_, Entry::P(a, _), _) | Access::Miss(Entry::P(a, _), _) => ms_set(*a) == ph,
+                _ => false
+            }
+        }
+        fn phase_done(&self, st: &Self::State, ph: usize) -> bool {
+            !st.contains(ms_target(ph))
+        }
+    }
+}
+
+
+pub mod weighted {
+    use crate::policy::*;
+
+    /// Predicted cycles per access, by origin (data, isn) and by the level that hits
+    #[derive(PartialEq, Eq, Copy, Clone, Debug)]
+    pub struct Latency {
+        /// Hit in level 1, 2 or 3
+        pub hit: [[usize; 3]; 2],
+        /// Miss in every level
+        pub miss: [usize; 2]
+    }
+
+    impl Latency {
+        /// The unweighted model: every hit costs `HIT_COST`, every miss `MISS_COST`
+        pub const FLAT: Latency = Latency{hit: [[1; 3]; 2], miss: [2; 2]};
+
+        pub fn cost(&self, acc: &Access) -> usize {
+            match acc {
+                Access::Hit(l, _, o) => self.hit[o.isnfetch as usize][(*l).clamp(1, 3) as usize - 1],
+                Access::Miss(_, o) => self.miss[o.isnfetch as usize]
+            }
+        }
+        pub fn min(&self) -> usize {
+            self.hit.iter().flatten().chain(&self.miss).copied().min().unwrap()
+        }
+
+        /// Parse a table of `ORIGIN LEVEL CYCLES` lines, ORIGIN being `data` or `isn` and LEVEL
+        /// `1`-`3` or `miss`; '#' starts a comment. Entries not given keep their value in `self`.
+        pub fn parse(&self, txt: &str) -> Result<Latency, String> {
+            let mut lat = *self;
+            for (n, line) in txt.lines().enumerate() {
+                let words: Vec<&str> = line.split('#').next().unwrap().split_whitespace().collect();
+                if words.is_empty() {
+                    continue;
+                }
+                let err = || format!("line {}: expected 'data|isn 1|2|3|miss CYCLES'", n + 1);
+                if words.len() != 3 {
+                    return Err(err());
+                }
+                let o = match words[0] {
+                    "data" => 0,
+                    "isn" => 1,
+                    _ => return Err(err())
+                };
+                let c = words[2].parse().map_err(|_| err())?;
+                match words[1] {
+                    "miss" => lat.miss[o] = c,
+                    l => match l.parse::<usize>() {
+                        Ok(l) if (1..=3).contains(&l) => lat.hit[o][l - 1] = c,
+                        _ => return Err(err())
+                    }
+                }
+            }
+            Ok(lat)
+        }
+    }
+
+    /// Any policy, with access costs taken from a latency table instead of the flat
+    /// hit/miss costs, so that cost-aware searches minimize predicted cycles
+    #[derive(Debug)]
+    pub struct Weighted<R: CacheRP> {
+        pub rp: R,
+        pub lat: Latency
+    }
+
+    impl<R: CacheRP> Weighted<R> {
+        /// Scale a bound in flat costs (at least `HIT_COST` per access, at most `MISS_COST`)
+        /// to one in cycles, keeping it admissible
+        fn scale(&self, h: usize) -> usize {
+            h * self.lat.min() / R::MISS_COST
+        }
+    }
+
+    impl<R: CacheRP> CacheRP for Weighted<R> {
+        type State = R::State;
+        type EVict = R::EVict;
+
+        fn heur(&self, st: &Self::State, val: Entry) -> usize {
+            self.scale(self.rp.heur(st, val))
+        }
+        fn evictim(&self, st: &Self::State) -> Self::EVict {
+            self.rp.evictim(st)
+        }
+        fn evictim1(&self, st: &Self::State) -> Entry {
+            self.rp.evictim1(st)
+        }
+        fn update(&self, st: &Self::State, val: Entry, orig: Origin) -> (Self::State, Access) {
+            self.rp.update(st, val, orig)
+        }
+        fn update_shallow(&self, st: &Self::State, val: Entry, orig: Origin) -> (Self::State, Access) {
+            self.rp.update_shallow(st, val, orig)
+        }
+        fn ncomp(&self) -> usize {
+            self.rp.ncomp()
+        }
+        fn noise(&self, st: &Self::State, comp: usize) -> Self::State {
+            self.rp.noise(st, comp)
+        }
+        fn access_cost(&self, acc: &Access) -> usize {
+            self.lat.cost(acc)
+        }
+        fn victim(&self, st: &Self::State, orig: Origin) -> Self::State {
+            self.rp.victim(st, orig)
+        }
+        fn evicted(&self, st: &Self::State) -> bool {
+            self.rp.evicted(st)
+        }
+        fn heur_evict(&self, st: &Self::State) -> usize {
+            self.scale(self.rp.heur_evict(st))
+        }
+        fn nphases(&self) -> usize {
+            self.rp.nphases()
+        }
+        fn in_phase(&self, acc: &Access, ph: usize) -> bool {
+            self.rp.in_phase(acc, ph)
+        }
+        fn phase_done(&self, st: &Self::State, ph: usize) -> bool {
+            self.rp.phase_done(st, ph)
+        }
+        fn outedges_priced(&self, st: &Self::State) -> (Vec<Self::State>, Vec<Access>, Vec<usize>) {
+            let (sts, accs, _) = self.rp.outedges_priced(st);
+            let costs = accs.iter().map(|a| self.lat.cost(a)).collect();
+            (sts, accs, costs)
+        }
+    }
+}
+
+
+pub mod stochastic {
+    use crate::policy::*;
+
+    /// Replacement policy whose updates have random outcomes: each access yields a
+    /// distribution over successor states instead of a single one
+    pub trait StochasticRP: std::fmt::Debug {
+        type State: CacheState;
+
+        /// Successor states with their probabilities, which sum to 1
+        fn outcomes(&self, st: &Self::State, val: Entry, orig: Origin) -> Vec<(f64, Self::State, Access)>;
+        fn ncomp(&self) -> usize { 1 }
+        /// Distribution of states after a foreign insertion into component `comp`
+        fn noise_outcomes(&self, st: &Self::State, comp: usize) -> Vec<(f64, Self::State)>;
+        fn evicted(&self, st: &Self::State) -> bool {
+            !st.contains(Entry::T)
+        }
+    }
+
+    /// Every deterministic policy is a stochastic one with a single certain outcome
+    impl<R: CacheRP> StochasticRP for R {
+        type State = R::State;
+
+        fn outcomes(&self, st: &Self::State, val: Entry, orig: Origin) -> Vec<(f64, Self::State, Access)> {
+            let (ns, acc) = self.update(st, val, orig);
+            vec![(1.0, ns, acc)]
+        }
+        fn ncomp(&self) -> usize {
+            CacheRP::ncomp(self)
+        }
+        fn noise_outcomes(&self, st: &Self::State, comp: usize) -> Vec<(f64, Self::State)> {
+            vec![(1.0, self.noise(st, comp))]
+        }
+        fn evicted(&self, st: &Self::State) -> bool {
+            CacheRP::evicted(self, st)
+        }
+    }
+
+    /// Add `p` to the probability of `st` in `out`, merging equal outcomes
+    fn merge<T: PartialEq>(out: &mut Vec<(f64, T, Access)>, p: f64, st: T, acc: Access) {
+        match out.iter_mut().find(|o| o.1 == st) {
+            Some(o) => o.0 += p,
+            None => out.push((p, st, acc))
+        }
+    }
+
+    /// Any policy, with a foreign insertion into a uniformly chosen component after each
+    /// access with probability `p` (page walks, sibling threads), as in `robust`
+    #[derive(Debug)]
+    pub struct Noisy<R: StochasticRP> {
+        pub rp: R,
+        pub p: f64
+    }
+
+    impl<R: StochasticRP> StochasticRP for Noisy<R> {
+        type State = R::State;
+
+        fn outcomes(&self, st: &Self::State, val: Entry, orig: Origin) -> Vec<(f64, Self::State, Access)> {
+            let ncomp = self.rp.ncomp();
+            let mut out = Vec::new();
+            for (p, ns, acc) in self.rp.outcomes(st, val, orig) {
+                merge(&mut out, p * (1.0 - self.p), ns.clone(), acc);
+                for c in 0..ncomp {
+                    for (q, nns) in self.rp.noise_outcomes(&ns, c) {
+                        merge(&mut out, p * q * self.p / ncomp as f64, nns, acc);
+                    }
+                }
+            }
+            out.retain(|o| o.0 > 0.0);
+            out
+        }
+        fn ncomp(&self) -> usize {
+            self.rp.ncomp()
+        }
+        fn noise_outcomes(&self, st: &Self::State, comp: usize) -> Vec<(f64, Self::State)> {
+            self.rp.noise_outcomes(st, comp)
+        }
+        fn evicted(&self, st: &Self::State) -> bool {
+            self.rp.evicted(st)
+        }
+    }
+
+    /// Random replacement over `ways` entries: a miss replaces a uniformly chosen way.
+    /// The set starts out full of foreign entries (X). Way positions do not matter to the
+    /// policy, so entries are kept sorted and equivalent states compare equal.
+    #[derive(Debug)]
+    pub struct Random {
+        pub ways: usize
+    }
+
+    impl Random {
+        pub fn newstate(&self) -> PVec {
+            PVec::new(self.ways)
+        }
+        fn sorted(&self, st: &PVec) -> PVec {
+            // Data pages, then instruction pages, each by address, then T and X: canonical
+            // renumbering (`CacheState::canon`) keeps this order
+            let key = |e: &Entry| match *e {
+                Entry::P(a, c) => (c as u8, a),
+                Entry::T => (2, 0),
+                Entry::X => (3, 0)
+            };
+            let mut ents: Vec<Entry> = st.entries().collect();
+            ents.sort_unstable_by_key(key);
+            let mut ns = PVec::new(self.ways);
+            for (i, &e) in ents.iter().enumerate() {
+                ns.set(i, e);
+            }
+            ns
+        }
+        fn replace(&self, st: &PVec, val: Entry) -> Vec<(f64, PVec)> {
+            let mut out: Vec<(f64, PVec)> = Vec::new();
+            for i in 0..self.ways {
+                let mut ns = *st;
+                ns.set(i, val);
+                let ns = self.sorted(&ns);
+                match out.iter_mut().find(|o| o.1 == ns) {
+                    Some(o) => o.0 += 1.0 / self.ways as f64,
+                    None => out.push((1.0 / self.ways as f64, ns))
+                }
+            }
+            out
+        }
+    }
+
+    impl StochasticRP for Random {
+        type State = PVec;
+
+        fn outcomes(&self, st: &PVec, val: Entry, orig: Origin) -> Vec<(f64, PVec, Access)> {
+            match st.rank(val) {
+                Some(_) => vec![(1.0, *st, Access::Hit(0, val, orig))],
+                None => self.replace(st, val).into_iter().map(|(p, ns)| (p, ns, Access::Miss(val, orig))).collect()
+            }
+        }
+        fn noise_outcomes(&self, st: &PVec, _comp: usize) -> Vec<(f64, PVec)> {
+            self.replace(st, Entry::X)
+        }
+    }
+}
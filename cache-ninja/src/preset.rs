@@ -2,14 +2,64 @@ use crate::state::*;
 use crate::state::hier::*;
 use crate::policy::*;
 use crate::policy::hier::*;
+use crate::policy::multi::MSRP;
+use crate::policy::weighted::Latency;
 
 pub trait Preset {
-    type State: CacheState;
-    type RP: CacheRP<State=Self::State>;
+    type State: CacheState + Sync;
+    type RP: CacheRP<State=Self::State> + Sync;
 
     fn rp(&self) -> Self::RP;
     fn rpx(&self) -> Option<Self::RP> { None }
     fn newstate(&self) -> Self::State;
+    /// Number of cache levels modelled
+    fn levels(&self) -> usize { 1 }
+    /// Policy of the first-level data cache, for targeting that level alone
+    fn l1(&self) -> Option<PVRP> { None }
+    /// Approximate cycles per access, for latency-weighted searches
+    fn latency(&self) -> Latency { Latency::FLAT }
+}
+
+/// Operation generic over the concrete preset type, for selecting presets by name at runtime
+pub trait PresetFn {
+    type Output;
+
+    fn call<P: Preset>(&self, pres: P) -> Self::Output;
+}
+
+pub const NAMES: [&str; 11] = [
+    "PVRP::PLRU4", "PVRP::PLRU8", "PVRP::PLRU16", "PVRP::LRU3PLRU4", "PVRP::MRU3PLRU4",
+    "TLB::IVYBRIDGE", "TLB::HASWELL", "TLB::KABYLAKE",
+    "dcache::NEHALEM", "dcache::HASWELL", "dcache::KABYLAKE"
+];
+
+pub fn by_name<F: PresetFn>(name: &str, f: &F) -> Option<F::Output> {
+    Some(match name {
+        "PVRP::PLRU4" => f.call(PVRP::PLRU4),
+        "PVRP::PLRU8" => f.call(PVRP::PLRU8),
+        "PVRP::PLRU16" => f.call(PVRP::PLRU16),
+        "PVRP::LRU3PLRU4" => f.call(PVRP::LRU3PLRU4),
+        "PVRP::MRU3PLRU4" => f.call(PVRP::MRU3PLRU4),
+        "TLB::IVYBRIDGE" => f.call(TLB::IVYBRIDGE),
+        "TLB::HASWELL" => f.call(TLB::HASWELL),
+        "TLB::KABYLAKE" => f.call(TLB::KABYLAKE),
+        "dcache::NEHALEM" => f.call(dcache::NEHALEM),
+        "dcache::HASWELL" => f.call(dcache::HASWELL),
+        "dcache::KABYLAKE" => f.call(dcache::KABYLAKE),
+        _ => return None
+    })
+}
+
+impl Preset for PVRP {
+    type State = PVec;
+    type RP = PVRP;
+
+    fn rp(&self) -> Self::RP {
+        *self
+    }
+    fn newstate(&self) -> Self::State {
+        self.newpv()
+    }
 }
 
 pub enum TLB { IVYBRIDGE, HASWELL, KABYLAKE }
@@ -30,6 +80,25 @@ impl TLB {
         prop_upi: true, prop_upd: true, prop_dn: false
     };
 }
+impl TLB {
+    pub fn by_name(name: &str) -> Option<Self> {
+        match name {
+            "TLB::IVYBRIDGE" => Some(TLB::IVYBRIDGE),
+            "TLB::HASWELL" => Some(TLB::HASWELL),
+            "TLB::KABYLAKE" => Some(TLB::KABYLAKE),
+            _ => None
+        }
+    }
+    /// Data side of the TLB, with `nsets` sTLB sets sharing one L1 dTLB set
+    pub fn multi(&self, nsets: usize) -> MSRP<PVRP, PVRP> {
+        let rp = self.rp();
+        MSRP {
+            rp1: rp.rp1d, rp2: rp.rp2, nsets,
+            miss_l1: rp.miss_l1d, miss_l2: rp.miss_l2,
+            prop_up: rp.prop_upd, prop_dn: rp.prop_dn
+        }
+    }
+}
 impl Preset for TLB {
     type State = H2SState<PVec, PVec, PVec>;
     type RP = H2SRP<PVRP, PVRP, PVRP>;
@@ -45,6 +114,19 @@ impl Preset for TLB {
     fn rpx(&self) -> Option<Self::RP> {
         Some(H2SRP{rxmem: true, ..self.rp()})
     }
+    fn levels(&self) -> usize { 2 }
+    fn l1(&self) -> Option<PVRP> { Some(self.rp().rp1d) }
+    /// Load-to-use latency of a pointer chase with an L1 hit, an sTLB hit or a page walk with
+    /// cached paging structures; instruction fetches pay for the extra jump through the page.
+    /// Rough figures from published measurements; load measured ones with `-L FILE`.
+    fn latency(&self) -> Latency {
+        use TLB::*;
+        match self {
+            IVYBRIDGE => Latency{hit: [[4, 11, 11], [6, 13, 13]], miss: [35, 37]},
+            HASWELL => Latency{hit: [[4, 13, 13], [6, 15, 15]], miss: [35, 37]},
+            KABYLAKE => Latency{hit: [[4, 13, 13], [6, 15, 15]], miss: [30, 32]}
+        }
+    }
     fn newstate(&self) -> Self::State {
         let rp = self.rp();
         H2SState{ l1i: rp.rp1i.newpv(), l1d: rp.rp1d.newpv(), l2: rp.rp2.newpv()}
@@ -56,8 +138,12 @@ pub mod dcache {
     use crate::state::hier::*;
     use crate::policy::*;
     use crate::policy::hier::*;
+    use crate::policy::weighted::Latency;
     use crate::preset::Preset;
 
+    // Latencies below are the usual load-to-use figures for L1/L2/L3 hits and DRAM; rough,
+    // like the TLB ones
+
     pub struct NEHALEM;
     impl Preset for NEHALEM {
         type State = H3UState<PVec, PVec, QVec>;
@@ -71,6 +157,11 @@ pub mod dcache {
                 prop_up: true, prop_dn: false
             }
         }
+        fn levels(&self) -> usize { 3 }
+        fn l1(&self) -> Option<PVRP> { Some(self.rp().rp1) }
+        fn latency(&self) -> Latency {
+            Latency{hit: [[4, 10, 40]; 2], miss: [200; 2]}
+        }
         fn newstate(&self) -> Self::State {
             let rp = self.rp();
             H3UState{l1: rp.rp1.newpv(), l2: rp.rp2.newpv(), l3: rp.rp3.fillup(&QVec::new(16), Entry::X)}
@@ -90,6 +181,11 @@ pub mod dcache {
                 prop_up: true, prop_dn: false
             }
         }
+        fn levels(&self) -> usize { 3 }
+        fn l1(&self) -> Option<PVRP> { Some(self.rp().rp1) }
+        fn latency(&self) -> Latency {
+            Latency{hit: [[4, 12, 36]; 2], miss: [200; 2]}
+        }
         fn newstate(&self) -> Self::State {
             let rp = self.rp();
             H3UState{l1: rp.rp1.newpv(), l2: rp.rp2.newpv(), l3: rp.rp3.fillup(&QVec::new(16), Entry::X)}
@@ -109,6 +205,11 @@ pub mod dcache {
                 prop_up: true, prop_dn: false
             }
         }
+        fn levels(&self) -> usize { 3 }
+        fn l1(&self) -> Option<PVRP> { Some(self.rp().rp1) }
+        fn latency(&self) -> Latency {
+            Latency{hit: [[4, 12, 42]; 2], miss: [200; 2]}
+        }
         fn newstate(&self) -> Self::State {
             let rp = self.rp();
             H3UState{l1: rp.rp1.newpv(), l2: rp.rp2.fillup(&QVec::new(4), Entry::X), l3: rp.rp3.fillup(&QVec::new(16), Entry::X)}
@@ -0,0 +1,514 @@
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::collections::hash_map::DefaultHasher;
+use std::fmt::Write;
+use std::hash::{Hash, Hasher};
+
+use crate::state::{CacheState, Entry, PAddr, ADDRS};
+use crate::policy::{CacheRP, Origin};
+use crate::codegen::Chain;
+use crate::robust::Rng;
+
+
+/// Attacker address of the page touched by a reset; renumbered away right after each access
+const FRESH: PAddr = (ADDRS - 2) as PAddr;
+/// Most possible states a node may track before it counts as lost
+const MAXBELIEF: usize = 64;
+/// Timed rounds simulated per strategy when estimating the table's payoff
+const MCROUNDS: usize = 1 << 20;
+/// Rounds between full resets in the fixed schedule the table is compared against
+/// (`NINJA_THRESH` in madtlb)
+const PERIOD: usize = 2048;
+
+#[derive(Copy, Clone, Debug)]
+pub struct Params {
+    /// Max. number of table entries, at most 255 so that they fit the C table's bytes
+    pub nodes: usize,
+    /// Fresh pages touched by a full reset (`TLB_PREPSZ` in madtlb)
+    pub prep: usize,
+    /// Probability of a foreign insertion into each component per round
+    pub noise: f64
+}
+
+/// What the receiver does in a table entry
+#[derive(PartialEq, Eq, Copy, Clone, Debug)]
+pub enum Act {
+    /// Chase and time the next round, then go to `next[slow]`
+    Cont([usize; 2]),
+    /// Chase the next round without using its timing, then go to the given entry
+    Skip(usize),
+    /// Touch this many fresh pages, restart the chain and chase the lead-in; back to entry 0
+    Reset(usize)
+}
+
+pub struct Node {
+    /// Cyclic round chased next
+    pub phase: usize,
+    pub act: Act
+}
+
+pub struct Table {
+    pub nodes: Vec<Node>,
+    /// Accesses per cyclic round
+    pub hops: Vec<usize>,
+    /// A timed round is slow if its predicted cost exceeds this. Model units, for planning only:
+    /// the receiver classifies by its own calibrated cut.
+    pub thresh: Vec<usize>,
+    pub leadin: usize,
+    /// If no timed round ever branches, there is no table to follow, just a fixed schedule: the
+    /// cyclic rounds to chase untimed after a full reset, and the timed rounds between full
+    /// resets (0 if a foreign insertion is forgotten by itself)
+    pub fixed: Option<(usize, usize)>,
+    /// Monte Carlo comparison with a full reset every `PERIOD` rounds
+    pub stats: String
+}
+
+/// Entry 1 stands for every belief the table gave up on: it does a full reset
+const LOST: usize = 1;
+
+fn state_key<T: Hash>(st: &T) -> u64 {
+    let mut h = DefaultHasher::new();
+    st.hash(&mut h);
+    h.finish()
+}
+
+/// Possible states at some point of the chain, sorted so that equal beliefs compare equal
+type Belief<T> = Vec<T>;
+
+fn belief<T: CacheState>(states: HashSet<T>) -> Belief<T> {
+    let mut b: Vec<T> = states.into_iter().collect();
+    b.sort_by_cached_key(state_key);
+    b
+}
+
+/// The chain with its pages at addresses `0..npages`, replayed against the policy
+struct Model<'a, R> {
+    rp: &'a R,
+    torig: Origin,
+    npages: usize,
+    /// Pages of the lead-in rounds, then of each cyclic round
+    leadin: Vec<Vec<Entry>>,
+    cycle: Vec<Vec<Entry>>
+}
+
+impl<'a, T: CacheState, R: CacheRP<State=T>> Model<'a, R> {
+    fn new(rp: &'a R, chain: &Chain, torig: Origin) -> Self {
+        let mut rounds = Vec::new();
+        let mut i = 0;
+        for &n in &chain.rounds {
+            rounds.push(chain.seq[i..i+n].iter().map(|&p| Entry::P(p as PAddr, false)).collect());
+            i += n;
+        }
+        let cycle = rounds.split_off(chain.leadin);
+        Self{rp, torig, npages: chain.npages, leadin: rounds, cycle}
+    }
+
+    /// Renumber the foreign pages left by resets densely after the chain's own, so that states
+    /// differing only in their names compare equal
+    fn norm(&self, st: &T) -> T {
+        let mut map = [0; ADDRS];
+        let mut next = self.npages;
+        for x in st.entries() {
+            if let Entry::P(a, _) = x {
+                if a as usize >= self.npages && map[a as usize] == 0 {
+                    map[a as usize] = next as PAddr;
+                    next += 1;
+                }
+            }
+        }
+        for (a, m) in map.iter_mut().enumerate().take(self.npages) {
+            *m = a as PAddr;
+        }
+        st.relabel(&map)
+    }
+    fn fresh(&self, st: &T) -> T {
+        self.norm(&self.rp.update(st, Entry::P(FRESH, false), Default::default()).0)
+    }
+    /// Chase one round's pages; returns the state and its predicted cost
+    fn play(&self, st: &T, pages: &[Entry]) -> (T, usize) {
+        pages.iter().fold((st.clone(), 0), |(s, c), &e| {
+            let (ns, acc) = self.rp.update(&s, e, Default::default());
+            (ns, c + self.rp.access_cost(&acc))
+        })
+    }
+    /// What may happen between two rounds: the target accessed or not. Noise is left out: a
+    /// belief holding every state one foreign insertion away would rarely decode; instead the
+    /// planner checks that the chain forgets such insertions by itself.
+    fn events(&self, st: &T) -> [(bool, T); 2] {
+        [(true, self.rp.victim(st, self.torig)), (false, st.clone())]
+    }
+    /// Chase the lead-in rounds from the start of the chain, with events before each
+    fn leadin(&self, b: &[T]) -> Belief<T> {
+        let mut cur: HashSet<T> = b.iter().cloned().collect();
+        for pages in &self.leadin {
+            cur = cur.iter().flat_map(|s| self.events(s))
+                .map(|(_, s)| self.norm(&self.play(&s, pages).0)).collect();
+        }
+        belief(cur)
+    }
+}
+
+/// Everything the next timed round in `phase` may end in, split by whether the round is slow;
+/// the round decodes iff exactly the target accesses make it slow
+fn observe<T: CacheState, R: CacheRP<State=T>>(m: &Model<R>, thresh: &[usize], phase: usize, b: &[T])
+                                               -> (bool, [HashSet<T>; 2]) {
+    let mut ok = true;
+    let mut out = [HashSet::new(), HashSet::new()];
+    for s in b {
+        for (v, se) in m.events(s) {
+            let (ns, cost) = m.play(&se, &m.cycle[phase]);
+            let slow = cost > thresh[phase];
+            ok &= slow == v;
+            out[slow as usize].insert(m.norm(&ns));
+        }
+    }
+    (ok, out)
+}
+
+pub fn plan<T, R>(rp: &R, st0: &T, chain: &Chain, torig: Origin, par: &Params) -> Result<Table, String>
+where T: CacheState, R: CacheRP<State=T>
+{
+    let m = Model::new(rp, chain, torig);
+    let ncyc = m.cycle.len();
+    let hops: Vec<usize> = m.cycle.iter().map(|r| r.len()).collect();
+    let leadin: usize = m.leadin.iter().map(|r| r.len()).sum();
+
+    let prepped = (0..par.prep).fold(st0.clone(), |s, _| m.fresh(&s));
+    let root = m.leadin(&[prepped.clone()]);
+
+    // Thresholds from the intended trajectory, with the target accessed before every round:
+    // halfway between the cost of a round after a target access and one after none. The first
+    // cycle after the lead-in may not be steady yet, so they come from the cycle that repeats.
+    let mut st = m.leadin.iter().fold(prepped.clone(), |s, pages| m.play(&rp.victim(&s, torig), pages).0);
+    let mut seen = HashSet::new();
+    while seen.insert(m.norm(&st)) {
+        st = m.cycle.iter().fold(st, |s, pages| m.play(&rp.victim(&s, torig), pages).0);
+    }
+    let mut thresh = Vec::new();
+    for pages in &m.cycle {
+        let (ns, cv) = m.play(&rp.victim(&st, torig), pages);
+        let (_, cn) = m.play(&st, pages);
+        // A round that cannot tell is never timed: the planner skips it
+        thresh.push(if cv > cn { (cv + cn) / 2 } else { usize::MAX });
+        st = ns;
+    }
+    if thresh.iter().all(|&t| t == usize::MAX) {
+        return Err("no cyclic round is slower after a target access".to_string());
+    }
+
+    // Fewest fresh pages that bring every state of a belief back to the one after a full reset
+    let resetk = |b: &[T]| (0..=par.prep).find(|&k| {
+        b.iter().all(|s| (0..k).fold(s.clone(), |s, _| m.fresh(&s)) == prepped)
+    });
+
+    let mut ids: HashMap<(usize, Belief<T>), usize> = HashMap::new();
+    let mut queue = VecDeque::new();
+    let mut nodes = vec![Node{phase: 0, act: Act::Cont([0; 2])}, Node{phase: 0, act: Act::Reset(par.prep)}];
+    let mut beliefs = vec![root.clone(), Vec::new()];
+    ids.insert((0, root.clone()), 0);
+    queue.push_back((0, 0, root));
+    let mut intern = |phase: usize, b: Belief<T>, nodes: &mut Vec<Node>, beliefs: &mut Vec<Belief<T>>,
+                      queue: &mut VecDeque<_>| {
+        if b.is_empty() || b.len() > MAXBELIEF {
+            return LOST;
+        }
+        let key = (phase, b);
+        if let Some(&i) = ids.get(&key) {
+            return i;
+        }
+        if nodes.len() >= par.nodes {
+            return LOST;
+        }
+        let i = nodes.len();
+        nodes.push(Node{phase, act: Act::Cont([0; 2])});
+        beliefs.push(key.1.clone());
+        queue.push_back((i, phase, key.1.clone()));
+        ids.insert(key, i);
+        i
+    };
+
+    while let Some((i, phase, b)) = queue.pop_front() {
+        let next = (phase + 1) % ncyc;
+        let (ok, [fast, slow]) = observe(&m, &thresh, phase, &b);
+        nodes[i].act = if ok {
+            let f = intern(next, belief(fast), &mut nodes, &mut beliefs, &mut queue);
+            let s = intern(next, belief(slow), &mut nodes, &mut beliefs, &mut queue);
+            Act::Cont([f, s])
+        } else {
+            // Cheapest way back to a round that decodes: chase on blind until the belief has
+            // narrowed down enough, or reset
+            let k = resetk(&b).unwrap_or(par.prep);
+            let reset = k + leadin;
+            let blind = belief(fast.into_iter().chain(slow).collect());
+            let mut cost = hops[phase];
+            let mut cur = blind.clone();
+            let mut p = next;
+            let mut skip = false;
+            while cost < reset && cur.len() <= MAXBELIEF {
+                let (ok, [f, s]) = observe(&m, &thresh, p, &cur);
+                if ok {
+                    skip = true;
+                    break;
+                }
+                cost += hops[p];
+                cur = belief(f.into_iter().chain(s).collect());
+                p = (p + 1) % ncyc;
+            }
+            if skip {
+                Act::Skip(intern(next, blind, &mut nodes, &mut beliefs, &mut queue))
+            } else {
+                Act::Reset(k)
+            }
+        };
+    }
+
+    // Every reset leads back to entry 0, so the receiver only ever gets stuck if that cannot
+    // reach a timed round without resetting again
+    let mut i = 0;
+    while let Act::Skip(to) = nodes[i].act {
+        i = to;
+    }
+    if let Act::Reset(_) = nodes[i].act {
+        return Err("no timed round decodes after a full reset".to_string());
+    }
+
+    let mut tab = Table{nodes, hops, thresh, leadin, fixed: None, stats: String::new()};
+    let fg = forget(&m, &tab, &beliefs);
+    tab.stats = match fg {
+        Some(0) => "a foreign insertion never flips a timed round\n".to_string(),
+        Some(r) => format!("a foreign insertion may flip timed rounds for {} rounds at most\n", r),
+        None => "foreign insertions may keep flipping timed rounds; keep a periodic full reset\n".to_string()
+    };
+    tab.fixed = fixed(&tab.nodes).map(|skip| (skip, if fg.is_some() { 0 } else { PERIOD }));
+    tab.stats += &simulate(&m, &tab, st0, par);
+    Ok(tab)
+}
+
+/// Rounds skipped from entry 0 if the table is no more than a fixed schedule: some untimed
+/// rounds, then a cycle of timed rounds that go on to the same entry whether slow or not. That is
+/// the case whenever the chain evicts all the target access brought in within the round.
+fn fixed(nodes: &[Node]) -> Option<usize> {
+    let mut seen = vec![false; nodes.len()];
+    let (mut i, mut skip, mut timed) = (0, 0, false);
+    while !seen[i] {
+        seen[i] = true;
+        i = match nodes[i].act {
+            Act::Skip(to) if !timed => {
+                skip += 1;
+                to
+            }
+            Act::Cont([f, s]) if f == s => {
+                timed = true;
+                f
+            }
+            _ => return None
+        };
+    }
+    if timed { Some(skip) } else { None }
+}
+
+/// Rounds a foreign insertion is followed for; one that can still flip a timed round in the
+/// second half counts as never forgotten
+const MAXFORGET: usize = 64;
+
+/// Rounds after a foreign insertion, into any component of any state of any timed entry, during
+/// which timed rounds may still decode wrongly; None if that may go on indefinitely. States that
+/// differ from the expected ones but decode alike (say, a foreign entry the chain never evicts)
+/// do no harm and are followed on.
+fn forget<T: CacheState, R: CacheRP<State=T>>(m: &Model<R>, tab: &Table, beliefs: &[Belief<T>]) -> Option<usize> {
+    let mut worst = 0;
+    for (i, b) in beliefs.iter().enumerate() {
+        if !matches!(tab.nodes[i].act, Act::Cont(_)) {
+            continue;
+        }
+        for s in b {
+            for c in 0..m.rp.ncomp() {
+                let mut cur: HashSet<(usize, T)> = HashSet::new();
+                cur.insert((i, m.norm(&m.rp.noise(s, c))));
+                for r in 0..MAXFORGET {
+                    cur.retain(|(j, x)| !beliefs[*j].contains(x));
+                    if cur.is_empty() {
+                        break;
+                    }
+                    if cur.len() > MAXBELIEF * MAXBELIEF {
+                        return None;
+                    }
+                    let mut nx = HashSet::new();
+                    for (j, x) in cur {
+                        let node = &tab.nodes[j];
+                        let step = |xe: &T| {
+                            let (ns, cost) = m.play(xe, &m.cycle[node.phase]);
+                            (cost > tab.thresh[node.phase], m.norm(&ns))
+                        };
+                        match node.act {
+                            Act::Cont(next) => for (v, xe) in m.events(&x) {
+                                let (slow, ns) = step(&xe);
+                                if slow != v {
+                                    if r >= MAXFORGET / 2 {
+                                        return None;
+                                    }
+                                    worst = worst.max(r + 1);
+                                }
+                                nx.insert((next[slow as usize], ns));
+                            },
+                            Act::Skip(to) => for (_, xe) in m.events(&x) {
+                                nx.insert((to, step(&xe).1));
+                            },
+                            Act::Reset(k) => {
+                                let st = (0..k).fold(x, |s, _| m.fresh(&s));
+                                nx.extend(m.leadin(&[st]).into_iter().map(|s| (0, s)));
+                            }
+                        }
+                    }
+                    cur = nx;
+                }
+            }
+        }
+    }
+    Some(worst)
+}
+
+
+/// Totals of one Monte Carlo run
+#[derive(Default)]
+struct Tally {
+    /// Timed rounds decoded, and wrongly so
+    bits: usize,
+    errors: usize,
+    /// Accesses in timed rounds and in skipped rounds or resets
+    hops: usize,
+    resync: usize
+}
+
+/// Run the table and the fixed schedule against a random target access pattern with noise
+fn simulate<T: CacheState, R: CacheRP<State=T>>(m: &Model<R>, tab: &Table, st0: &T, par: &Params) -> String {
+    let ncyc = tab.hops.len();
+    let event = |st: &T, rng: &mut Rng| -> (bool, T) {
+        let mut st = st.clone();
+        for c in 0..m.rp.ncomp() {
+            if par.noise > 0.0 && rng.next_f64() < par.noise {
+                st = m.rp.noise(&st, c);
+            }
+        }
+        let v = rng.next_u64() & 1 != 0;
+        (v, if v { m.rp.victim(&st, m.torig) } else { st })
+    };
+    let reset = |st: &T, k: usize, rng: &mut Rng| -> T {
+        let st = (0..k).fold(st.clone(), |s, _| m.fresh(&s));
+        m.leadin.iter().fold(st, |s, pages| m.norm(&m.play(&event(&s, rng).1, pages).0))
+    };
+
+    let mut rng = Rng::new(1);
+    let mut tt = Tally::default();
+    let mut st = reset(st0, par.prep, &mut rng);
+    let mut n = 0;
+    while tt.bits < MCROUNDS {
+        let node = &tab.nodes[n];
+        let (v, se) = event(&st, &mut rng);
+        match node.act {
+            Act::Cont(next) => {
+                let (ns, cost) = m.play(&se, &m.cycle[node.phase]);
+                let slow = cost > tab.thresh[node.phase];
+                tt.bits += 1;
+                tt.errors += (slow != v) as usize;
+                tt.hops += tab.hops[node.phase];
+                st = m.norm(&ns);
+                n = next[slow as usize];
+            }
+            Act::Skip(to) => {
+                st = m.norm(&m.play(&se, &m.cycle[node.phase]).0);
+                tt.resync += tab.hops[node.phase];
+                n = to;
+            }
+            Act::Reset(k) => {
+                st = reset(&st, k, &mut rng);
+                tt.resync += k + tab.leadin;
+                n = 0;
+            }
+        }
+    }
+
+    let mut rng = Rng::new(1);
+    let mut ft = Tally::default();
+    let mut st = st0.clone();
+    let mut phase = 0;
+    for r in 0.. {
+        if ft.bits >= MCROUNDS {
+            break;
+        }
+        if r % PERIOD == 0 {
+            st = reset(&st, par.prep, &mut rng);
+            ft.resync += par.prep + tab.leadin;
+            phase = 0;
+        }
+        let (v, se) = event(&st, &mut rng);
+        let (ns, cost) = m.play(&se, &m.cycle[phase]);
+        if tab.thresh[phase] != usize::MAX {
+            ft.bits += 1;
+            ft.errors += ((cost > tab.thresh[phase]) != v) as usize;
+        }
+        ft.hops += tab.hops[phase];
+        st = m.norm(&ns);
+        phase = (phase + 1) % ncyc;
+    }
+
+    let mut out = String::new();
+    let name = if tab.fixed.is_some() { "no resets" } else { "table" };
+    for (name, t) in [(name, &tt), ("fixed", &ft)] {
+        writeln!(out, "{}: {} errors in {} rounds, {} resync accesses ({:.4} per round, {:.2}% of all)",
+                 name, t.errors, t.bits, t.resync, t.resync as f64 / t.bits as f64,
+                 100.0 * t.resync as f64 / (t.hops + t.resync) as f64).unwrap();
+    }
+    out
+}
+
+impl Table {
+    /// C table for the receiver's probe loop, to be placed in the header `Chain::emit` writes; or,
+    /// if there is nothing to follow, the fixed schedule that takes its place
+    pub fn emit(&self, name: &str, par: &Params, out: &mut String) -> std::fmt::Result {
+        let uname = name.to_ascii_uppercase();
+        if self.fixed.is_some() {
+            writeln!(out, "/* Online re-synchronization: no table exists for this chain. No timed round's")?;
+            writeln!(out, " * outcome changes what the chain can be in after it, so a receiver has nothing to")?;
+            writeln!(out, " * follow. Instead, after a full reset ({0}_RS_PREP fresh pages, then {0}_RS_LEADIN", uname)?;
+            writeln!(out, " * accesses from the head), chase {}_RS_SKIP cyclic rounds untimed, then time every", uname)?;
+            writeln!(out, " * round; reset again after {}_RS_PERIOD timed rounds, or never if 0.", uname)?;
+        } else {
+            writeln!(out, "/* Online re-synchronization: start in entry 0 right after {}_prep() and a full", name)?;
+            writeln!(out, " * reset ({} fresh pages, then {}_RS_LEADIN accesses from the head). In an entry", par.prep, uname)?;
+            writeln!(out, " * with act CONT, chase and time {}_rs_hops[phase] accesses; whether the round is", name)?;
+            writeln!(out, " * slow is up to the receiver's calibrated cut, and the next entry is next[slow].")?;
+            writeln!(out, " * SKIP chases the round untimed and goes to next[0]; RESET touches arg fresh pages,")?;
+            writeln!(out, " * restarts at the head, chases the lead-in and goes to 0.")?;
+        }
+        writeln!(out, " *")?;
+        writeln!(out, " * Simulated with random target accesses and noise {} per component and round:", par.noise)?;
+        for l in self.stats.lines() {
+            writeln!(out, " *   {}", l)?;
+        }
+        writeln!(out, " */")?;
+        if let Some((skip, period)) = self.fixed {
+            writeln!(out, "#define {}_RS_PREP ({})", uname, par.prep)?;
+            writeln!(out, "#define {}_RS_LEADIN ({})", uname, self.leadin)?;
+            writeln!(out, "#define {}_RS_SKIP ({})", uname, skip)?;
+            return writeln!(out, "#define {}_RS_PERIOD ({})\n", uname, period);
+        }
+        writeln!(out, "#define {}_RS_NNODES ({})", uname, self.nodes.len())?;
+        writeln!(out, "#define {}_RS_LEADIN ({})", uname, self.leadin)?;
+        writeln!(out, "enum {{ {0}_RS_CONT, {0}_RS_SKIP, {0}_RS_RESET }};", uname)?;
+        let hv: Vec<String> = self.hops.iter().map(|h| h.to_string()).collect();
+        writeln!(out, "static const unsigned char {}_rs_hops[{}_NSTEPS] = {{{}}};", name, uname, hv.join(", "))?;
+        writeln!(out, "static const struct {{")?;
+        writeln!(out, "\tunsigned char phase, act, arg, next[2];")?;
+        writeln!(out, "}} {}_rs[{}_RS_NNODES] = {{", name, uname)?;
+        for (i, n) in self.nodes.iter().enumerate() {
+            let (act, arg, next) = match n.act {
+                Act::Cont(nx) => ("CONT", 0, nx),
+                Act::Skip(to) => ("SKIP", 0, [to, to]),
+                Act::Reset(k) => ("RESET", k, [0, 0])
+            };
+            writeln!(out, "\t{{{}, {}_RS_{}, {}, {{{}, {}}}}},{}", n.phase, uname, act, arg, next[0], next[1],
+                     if i == LOST { " /* lost track */" } else { "" })?;
+        }
+        writeln!(out, "}};\n")
+    }
+}
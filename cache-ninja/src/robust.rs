@@ -0,0 +1,311 @@
+use std::fmt::Write;
+
+use crate::state::{CacheState, Entry, PAddr};
+use crate::policy::{CacheRP, Origin};
+use crate::preset::{self, Preset, PresetFn};
+use crate::search::{self, Algo, Rounds, Trace};
+use crate::batch::{self, Json};
+
+
+pub struct Config {
+    pub preset: String,
+    pub orig: Origin,
+    /// Per-access probability of a foreign insertion, per state component
+    pub noise: Vec<f64>,
+    pub trials: usize,
+    pub rounds: usize,
+    pub maxpad: usize,
+    pub seed: u64,
+    pub jobs: usize
+}
+
+pub const USAGE: &str = "\
+usage: cache-ninja robust [OPTIONS]
+  -p, --preset NAME   preset to evaluate (default: TLB::KABYLAKE)
+  -o, --origin ORIG   target access origin: data or isn (default: data)
+  -N, --noise LIST    per-access probability of a foreign entry being inserted, per state
+                      component in field order, e.g. l1i,l1d,l2 for TLB presets; missing
+                      components take the last rate given (default: 0.01)
+  -t, --trials N      Monte Carlo trials per candidate (default: 1000)
+  -R, --rounds N      eviction rounds per trial, i.e. rounds between full resyncs (default: 256)
+  -k, --pad N         also try ninja sequences padded with up to N extra hits per round (default: 2)
+  -s, --seed N        random seed (default: 1)
+  -j, --jobs N        worker threads (default: available cores)
+Scores candidate eviction schedules by their probability of evicting the target each round
+under noise; prints one JSON object per candidate, marking the length/robustness Pareto front
+and the best evictions per access.";
+
+impl Config {
+    pub fn parse(args: impl Iterator<Item = String>) -> Result<Self, String> {
+        let mut cfg = Config {
+            preset: "TLB::KABYLAKE".to_string(),
+            orig: Default::default(),
+            noise: vec![0.01],
+            trials: 1000,
+            rounds: 256,
+            maxpad: 2,
+            seed: 1,
+            jobs: std::thread::available_parallelism().map(|n| n.get()).unwrap_or(1)
+        };
+        let args: Vec<String> = args.collect();
+        let mut it = args.iter();
+        while let Some(a) = it.next() {
+            let mut val = || it.next().ok_or_else(|| format!("missing value for '{}'", a));
+            match a.as_str() {
+                "-p" | "--preset" => {
+                    let v = val()?;
+                    cfg.preset = preset::NAMES.iter().find(|n| n.eq_ignore_ascii_case(v))
+                        .ok_or_else(|| format!("unknown preset: '{}'", v))?.to_string();
+                }
+                "-o" | "--origin" => {
+                    let v = val()?;
+                    cfg.orig = batch::parse_origin(v).ok_or_else(|| format!("unknown origin: '{}'", v))?;
+                }
+                "-N" | "--noise" => {
+                    cfg.noise = val()?.split(',').map(|x| match x.parse::<f64>() {
+                        Ok(r) if (0.0..=1.0).contains(&r) => Ok(r),
+                        _ => Err(format!("bad noise rate: '{}'", x))
+                    }).collect::<Result<_, _>>()?;
+                }
+                "-t" | "--trials" => cfg.trials = val()?.parse().map_err(|e| format!("--trials: {}", e))?,
+                "-R" | "--rounds" => cfg.rounds = val()?.parse().map_err(|e| format!("--rounds: {}", e))?,
+                "-k" | "--pad" => cfg.maxpad = val()?.parse().map_err(|e| format!("--pad: {}", e))?,
+                "-s" | "--seed" => cfg.seed = val()?.parse().map_err(|e| format!("--seed: {}", e))?,
+                "-j" | "--jobs" => cfg.jobs = val()?.parse().map_err(|e| format!("--jobs: {}", e))?,
+                "-h" | "--help" => return Err(String::new()),
+                _ => return Err(format!("unknown argument: '{}'", a))
+            }
+        }
+        cfg.jobs = cfg.jobs.max(1);
+        cfg.rounds = cfg.rounds.max(1);
+        Ok(cfg)
+    }
+}
+
+
+/// xorshift64* generator; one per worker, so runs are reproducible for a given seed and job count
+pub struct Rng(u64);
+
+impl Rng {
+    pub fn new(seed: u64) -> Self {
+        Self(seed.wrapping_mul(0x9e37_79b9_7f4a_7c15) | 1)
+    }
+    pub fn next_u64(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_f491_4f6c_dd1d)
+    }
+    /// Uniform in [0, 1)
+    pub fn next_f64(&mut self) -> f64 {
+        (self.next_u64() >> 11) as f64 / (1u64 << 53) as f64
+    }
+}
+
+
+type Seq = Vec<(Entry, Origin)>;
+
+/// Periodic attacker schedule: the lead-in rounds run once, then the cycle rounds repeat
+#[derive(Clone)]
+pub struct Schedule {
+    pub name: String,
+    pub leadin: Vec<Seq>,
+    pub cycle: Vec<Seq>
+}
+
+impl Schedule {
+    pub fn from_rounds<T>(name: String, res: &Rounds<T>) -> Option<Self> {
+        let (ri, pos) = res.cycle?;
+        let seqs: Vec<Seq> = res.rounds[..ri].iter().map(|r| {
+            r.pre.iter().copied().chain(r.search.path.iter().map(|(acc, _)| search::access_entry(acc))).collect()
+        }).collect();
+        Some(Self{name, leadin: seqs[..pos].to_vec(), cycle: seqs[pos..].to_vec()})
+    }
+    /// Round-robin over `n` pages every round, as the naive eviction sets do
+    pub fn naive(n: usize) -> Self {
+        let round: Seq = (0..n).map(|a| (Entry::P(a as PAddr, false), Default::default())).collect();
+        Self{name: format!("naive{}", n), leadin: Vec::new(), cycle: vec![round]}
+    }
+    /// Append `k` hits to every cyclic round by re-accessing its last page, which is resident and
+    /// most recently used, so the replacement state is left as the round put it
+    pub fn padded(&self, k: usize) -> Option<Self> {
+        let cycle = self.cycle.iter().map(|seq| {
+            let last = *seq.last()?;
+            Some(seq.iter().copied().chain(std::iter::repeat(last).take(k)).collect())
+        }).collect::<Option<_>>()?;
+        Some(Self{name: format!("{}+pad{}", self.name, k), leadin: self.leadin.clone(), cycle})
+    }
+    /// Mean accesses per cyclic round
+    pub fn len(&self) -> f64 {
+        self.cycle.iter().map(|s| s.len()).sum::<usize>() as f64 / self.cycle.len() as f64
+    }
+}
+
+
+fn play<T: CacheState, R: CacheRP<State=T>>(rp: &R, st: T, seq: &[(Entry, Origin)], noise: &[f64], rng: &mut Rng) -> T {
+    let mut st = st;
+    for &(ent, orig) in seq {
+        for (comp, &rate) in noise.iter().enumerate() {
+            if rate > 0.0 && rng.next_f64() < rate {
+                st = rp.noise(&st, comp);
+            }
+        }
+        st = rp.update(&st, ent, orig).0;
+    }
+    st
+}
+
+/// Number of cyclic rounds (out of `rounds`) after which the target was evicted, in one trial
+fn trial<T: CacheState, R: CacheRP<State=T>>(rp: &R, st0: &T, sched: &Schedule, torig: Origin,
+                                              noise: &[f64], rounds: usize, rng: &mut Rng) -> usize {
+    let mut st = st0.clone();
+    for seq in &sched.leadin {
+        st = play(rp, rp.victim(&st, torig), seq, noise, rng);
+    }
+    let mut ok = 0;
+    for r in 0..rounds {
+        st = play(rp, rp.victim(&st, torig), &sched.cycle[r % sched.cycle.len()], noise, rng);
+        if rp.evicted(&st) {
+            ok += 1;
+        }
+    }
+    ok
+}
+
+/// Monte Carlo estimate of the per-round eviction probability, with trials spread over `jobs` threads
+pub fn evaluate<T, R>(rp: &R, st0: &T, sched: &Schedule, cfg: &Config, noise: &[f64], trials: usize) -> f64
+where T: CacheState + Sync, R: CacheRP<State=T> + Sync
+{
+    let jobs = cfg.jobs.min(trials).max(1);
+    let ok: usize = std::thread::scope(|s| {
+        let hs: Vec<_> = (0..jobs).map(|j| s.spawn(move || {
+            let mut rng = Rng::new(cfg.seed ^ (j as u64) << 32);
+            let n = trials / jobs + if j < trials % jobs { 1 } else { 0 };
+            (0..n).map(|_| trial(rp, st0, sched, cfg.orig, noise, cfg.rounds, &mut rng)).sum::<usize>()
+        })).collect();
+        hs.into_iter().map(|h| h.join().unwrap()).sum()
+    });
+    ok as f64 / (trials * cfg.rounds).max(1) as f64
+}
+
+
+pub struct Scored {
+    pub sched: Schedule,
+    pub len: f64,
+    /// Eviction probability without noise
+    pub p0: f64,
+    pub p: f64,
+    pub pareto: bool
+}
+
+impl Scored {
+    /// Successful evictions per access; proportional to the useful sample rate of a probe loop
+    pub fn rate(&self) -> f64 {
+        self.p / self.len
+    }
+}
+
+/// Mark candidates not dominated in (shorter, more robust)
+pub fn pareto(cands: &mut [Scored]) {
+    for i in 0..cands.len() {
+        let (li, pi) = (cands[i].len, cands[i].p);
+        cands[i].pareto = !cands.iter().any(|c| c.len <= li && c.p >= pi && (c.len < li || c.p > pi));
+    }
+}
+
+
+struct Robust<'a>(&'a Config);
+
+impl<'a> Robust<'a> {
+    fn run<T, R>(&self, rp: &R, st0: &T) -> Result<Vec<Scored>, String>
+    where T: CacheState + Sync, R: CacheRP<State=T> + Sync
+    {
+        let cfg = self.0;
+        let mut noise = cfg.noise.clone();
+        if noise.len() > rp.ncomp() {
+            return Err(format!("{} noise rates given, preset has {} components", noise.len(), rp.ncomp()));
+        }
+        noise.resize(rp.ncomp(), *noise.last().unwrap_or(&0.0));
+
+        let mut scheds = Vec::new();
+        for &algo in Algo::ALL.iter() {
+            let res = search::kickrnd(st0, rp, crate::MAXROUNDS, cfg.orig, algo, &mut Trace::off());
+            if let Some(s) = Schedule::from_rounds(algo.name().to_string(), &res) {
+                if !scheds.iter().any(|x: &Schedule| x.leadin == s.leadin && x.cycle == s.cycle) {
+                    scheds.push(s);
+                }
+            }
+        }
+        let ninjas = scheds.len();
+        for i in 0..ninjas {
+            for k in 1..=cfg.maxpad {
+                scheds.extend(scheds[i].padded(k));
+            }
+        }
+
+        let nonoise = vec![0.0; noise.len()];
+        let mut out = Vec::new();
+        for (i, sched) in scheds.into_iter().enumerate() {
+            let p0 = evaluate(rp, st0, &sched, cfg, &nonoise, 1);
+            // A hit still updates policies with per-entry ages; drop paddings that break the eviction
+            if i >= ninjas && p0 < 1.0 {
+                continue;
+            }
+            let p = evaluate(rp, st0, &sched, cfg, &noise, cfg.trials);
+            out.push(Scored{len: sched.len(), sched, p0, p, pareto: false});
+        }
+        // Naive sets, growing until they reliably evict without noise
+        let mut hits = 0;
+        for n in 2..=64 {
+            let sched = Schedule::naive(n);
+            let p0 = evaluate(rp, st0, &sched, cfg, &nonoise, 1);
+            if p0 < 1.0 {
+                continue;
+            }
+            let p = evaluate(rp, st0, &sched, cfg, &noise, cfg.trials);
+            out.push(Scored{len: sched.len(), sched, p0, p, pareto: false});
+            hits += 1;
+            if hits > cfg.maxpad {
+                break;
+            }
+        }
+        pareto(&mut out);
+        Ok(out)
+    }
+}
+
+impl<'a> PresetFn for Robust<'a> {
+    type Output = Result<Vec<Scored>, String>;
+
+    fn call<P: Preset>(&self, pres: P) -> Self::Output {
+        self.run(&pres.rp(), &pres.newstate())
+    }
+}
+
+fn json_rounds(rounds: &[Seq], out: &mut String) {
+    out.push('[');
+    for (i, r) in rounds.iter().enumerate() {
+        if i > 0 {
+            out.push(',');
+        }
+        r.json(out);
+    }
+    out.push(']');
+}
+
+pub fn run(cfg: &Config) -> Result<String, String> {
+    let cands = preset::by_name(&cfg.preset, &Robust(cfg)).unwrap()?;
+    let best = (0..cands.len()).filter(|&i| cands[i].p0 >= 1.0)
+        .max_by(|&a, &b| cands[a].rate().partial_cmp(&cands[b].rate()).unwrap());
+    let mut out = String::new();
+    for (i, c) in cands.iter().enumerate() {
+        write!(out, "{{\"preset\":\"{}\",\"cand\":\"{}\",\"len\":{:.3},\"p_nonoise\":{:.4},\"p_evict\":{:.4},\
+                     \"evict_per_access\":{:.4},\"pareto\":{},\"best\":{},\"leadin\":",
+               cfg.preset, c.sched.name, c.len, c.p0, c.p, c.rate(), c.pareto, best == Some(i)).unwrap();
+        json_rounds(&c.sched.leadin, &mut out);
+        out.push_str(",\"cycle\":");
+        json_rounds(&c.sched.cycle, &mut out);
+        out.push_str("}\n");
+    }
+    Ok(out)
+}
@@ -0,0 +1,333 @@
+use std::cell::Cell;
+use std::collections::HashMap;
+use std::fmt::Write;
+
+use crate::state::{CacheState, Entry};
+use crate::policy::{CacheRP, Access, Origin};
+
+
+/// Optional, lazily formatted trace of a search run.
+/// Formatting whole states with `{:?}` dominates run time on large hierarchies,
+/// so nothing is formatted unless the trace is enabled.
+pub struct Trace(Option<String>);
+
+impl Trace {
+    pub fn on() -> Self {
+        Self(Some(String::new()))
+    }
+    pub fn off() -> Self {
+        Self(None)
+    }
+    pub fn line(&mut self, f: impl FnOnce(&mut String) -> std::fmt::Result) {
+        if let Some(s) = self.0.as_mut() {
+            f(s).unwrap();
+            s.push('\n');
+        }
+    }
+    pub fn take(&mut self) -> String {
+        self.0.as_mut().map(std::mem::take).unwrap_or_default()
+    }
+}
+
+macro_rules! trace {
+    ($t:expr, $($arg:tt)*) => {
+        $t.line(|s| write!(s, $($arg)*))
+    };
+}
+
+
+#[derive(PartialEq, Eq, Copy, Clone, Debug)]
+pub enum Algo { Bfs, Dijkstra, AStar, Fringe, IdaStar }
+
+impl Algo {
+    pub const ALL: [Algo; 5] = [Algo::Bfs, Algo::Dijkstra, Algo::AStar, Algo::Fringe, Algo::IdaStar];
+
+    pub fn name(&self) -> &'static str {
+        use Algo::*;
+        match self {
+            Bfs => "bfs",
+            Dijkstra => "dijkstra",
+            AStar => "astar",
+            Fringe => "fringe",
+            IdaStar => "idastar"
+        }
+    }
+    pub fn from_name(s: &str) -> Option<Self> {
+        Self::ALL.iter().copied().find(|a| a.name().eq_ignore_ascii_case(s))
+    }
+}
+
+
+/// Result of a single eviction search
+pub struct Search<T> {
+    pub path: Vec<(Access, T)>,
+    pub cost: usize,
+    pub expanded: usize,
+    /// Whether the targets were evicted one phase at a time (see `CacheRP::nphases`)
+    pub phased: bool
+}
+
+pub fn access_entry(acc: &Access) -> (Entry, Origin) {
+    match acc {
+        Access::Hit(_, ent, orig) => (*ent, *orig),
+        Access::Miss(ent, orig) => (*ent, *orig)
+    }
+}
+
+/// Search for an access sequence evicting the target from `t`.
+/// The search runs over canonical states (see `CacheState::canon`), so states differing only
+/// in the naming of attacker addresses are visited once; the resulting path is then replayed
+/// on `t` to recover the concrete accesses and states.
+/// Should a search over several targets run out of its state budget, they are evicted one
+/// phase at a time instead, each phase a search of its own (BFS, or Dijkstra for the cost-aware
+/// algorithms, as per-target bounds do not carry over to a phase).
+pub fn kickout<T: CacheState, R: CacheRP<State=T>>(t: &T, rp: &R, algo: Algo) -> Option<Search<T>> {
+    use pathfinding::prelude::*;
+
+    // Successor states handed to a search bound the size of its visited set; past the budget,
+    // states have no successors, so the search drains and reports failure
+    let expanded = Cell::new(0usize);
+    let generated = Cell::new(0usize);
+    let search = |start: &T, ph: Option<usize>| {
+        generated.set(0);
+        let succp = |x: &T| {
+            if generated.get() >= crate::MAXSTATES {
+                return Vec::new();
+            }
+            expanded.set(expanded.get() + 1);
+            let mut v = match ph {
+                None => rp.successors_priced(x),
+                Some(ph) => {
+                    let (sts, accs, costs) = rp.outedges_priced(x);
+                    sts.into_iter().zip(costs).zip(&accs)
+                        .filter_map(|(s, acc)| if rp.in_phase(acc, ph) { Some(s) } else { None })
+                        .collect()
+                }
+            };
+            v.iter_mut().for_each(|s| s.0 = s.0.canon());
+            generated.set(generated.get() + v.len());
+            v
+        };
+        let succ = |x: &T| succp(x).into_iter().map(|s| s.0).collect::<Vec<_>>();
+        let heur = |x: &T| rp.heur_evict(x);
+        let done = |x: &T| match ph {
+            Some(ph) => rp.phase_done(x, ph),
+            None => rp.evicted(x)
+        };
+        match (algo, ph) {
+            (Algo::Bfs, _) => bfs(start, succ, done),
+            (_, Some(_)) | (Algo::Dijkstra, _) => dijkstra(start, succp, done).map(|r| r.0),
+            (Algo::AStar, None) => astar(start, succp, heur, done).map(|r| r.0),
+            (Algo::Fringe, None) => fringe(start, succp, heur, done).map(|r| r.0),
+            (Algo::IdaStar, None) => idastar(start, succp, heur, done).map(|r| r.0)
+        }
+    };
+
+    let start = t.canon();
+    let mut phased = false;
+    let sres = match search(&start, None) {
+        Some(r) => r,
+        None if generated.get() >= crate::MAXSTATES && rp.nphases() > 1 => {
+            phased = true;
+            let mut r = vec![start];
+            for ph in 0..rp.nphases() {
+                let from = r.last().unwrap().clone();
+                if !rp.phase_done(&from, ph) {
+                    r.extend(search(&from, Some(ph))?.into_iter().skip(1));
+                }
+            }
+            r
+        }
+        None => return None
+    };
+
+    let mut pst = t.clone();
+    let mut path = Vec::new();
+    for cst in sres.iter().skip(1) {
+        let (sts, accs) = rp.outedges(&pst);
+        let i = sts.iter().position(|x| x.canon() == *cst).unwrap();
+        pst = sts[i].clone();
+        path.push((accs[i], pst.clone()));
+    }
+    let cost = path.iter().map(|(acc, _)| rp.access_cost(acc)).sum();
+    Some(Search {
+        path,
+        cost,
+        expanded: expanded.get(),
+        phased
+    })
+}
+
+
+pub fn applyseq<T: CacheState, R: CacheRP<State=T>>(t: &T, rp: &R, accs: &[(Entry, Origin)], tr: &mut Trace) -> T {
+    let mut st = t.clone();
+    trace!(tr, "Applying sequence to initial state:\n{:?}", st);
+    for (ent, orig) in accs.iter().copied() {
+        let (ns, acc) = rp.update(&st, ent, orig);
+        trace!(tr, "\n{:?}: {:?}\n{:?}", ent, acc, ns);
+        st = ns;
+    }
+    st
+}
+
+
+/// One round of a repeated eviction: optional L1 accesses, then the L2 eviction path
+pub struct Round<T> {
+    pub init: T,
+    pub pre: Vec<(Entry, Origin)>,
+    pub search: Search<T>,
+    pub synced: bool,
+    pub synced_l1: Option<bool>
+}
+
+pub struct Rounds<T> {
+    pub rounds: Vec<Round<T>>,
+    /// (round, earlier round) with an identical initial state
+    pub cycle: Option<(usize, usize)>,
+    pub failed: bool
+}
+
+impl<T> Rounds<T> {
+    pub fn new() -> Self {
+        Self{rounds: Vec::new(), cycle: None, failed: false}
+    }
+}
+
+
+pub fn kickrnd<T: CacheState, R: CacheRP<State=T>>(t: &T, rp: &R, maxrnds: usize, torig: Origin, algo: Algo, tr: &mut Trace) -> Rounds<T> {
+    trace!(tr, "Kickout max {} rounds; RP: {:?}", maxrnds, rp);
+    let mut res = Rounds::new();
+    let mut pst = t.clone();
+    let mut ist = rp.victim(t, torig);
+    let mut seen: HashMap<T, usize> = HashMap::new();
+    for ri in 0..maxrnds {
+        trace!(tr, "\n---------------------------");
+        if let Some(&pos) = seen.get(&ist) {
+            trace!(tr, "Round {}; found init state previously in round {}\n{:?}", ri, pos, res.rounds[pos].init);
+            res.cycle = Some((ri, pos));
+            break;
+        } else {
+            trace!(tr, "Round {}; init state:\n{:?}", ri, ist);
+            trace!(tr, "Pathfinding...");
+            let srch = match kickout(&ist, rp, algo) {
+                Some(s) => s,
+                None => {
+                    trace!(tr, "No eviction found");
+                    res.failed = true;
+                    break;
+                }
+            };
+            let path = &srch.path;
+            trace!(tr, "Found eviction in {} accesses", path.len());
+            for (i, (acc, st)) in path.iter().enumerate() {
+                trace!(tr, "\n{}: {:?}\n{:?}", i+1, acc, st);
+            }
+
+            trace!(tr, "\nTrying self-sync\n");
+            let pvec: Vec<_> = path.iter().map(|(acc, _st)| access_entry(acc)).collect();
+            let fst = applyseq(&pst, rp, &pvec, tr);
+            let synced = fst == path[path.len()-1].1;
+            if synced {
+                trace!(tr, "\nEnd states MATCH!")
+            } else {
+                trace!(tr, "\nEnd states DESYNCED!");
+            }
+
+            pst = path[path.len()-1].1.clone();
+            seen.insert(ist.clone(), ri);
+            res.rounds.push(Round{init: ist, pre: Vec::new(), search: srch, synced, synced_l1: None});
+            ist = rp.victim(&pst, torig);
+        }
+    }
+    res
+}
+
+pub fn kickdbl<T: CacheState, R: CacheRP<State=T>>(t: &T, rp: &R, maxrnds: usize, torig: Origin, algo: Algo, tr: &mut Trace) -> Rounds<T> {
+    trace!(tr, "Spliced kickout max {} rounds; RP: {:?}", maxrnds, rp);
+    let mut res = Rounds::new();
+    let mut pst = t.clone();
+    let mut ist = rp.victim(t, torig);
+    let mut nst = rp.update_shallow(t, Entry::T, torig).0;
+    let mut seen: HashMap<T, usize> = HashMap::new();
+    for ri in 0..maxrnds {
+        trace!(tr, "\n---------------------------");
+        if let Some(&pos) = seen.get(&ist) {
+            trace!(tr, "Round {}; found init state previously in round {}\n{:?}", ri, pos, res.rounds[pos].init);
+            res.cycle = Some((ri, pos));
+            break;
+        } else {
+            trace!(tr, "Round {}; ist:\n{:?}\npst:\n{:?}\nnst:\n{:?}", ri, ist, pst, nst);
+            let iist = ist.clone();
+            let mut pre = Vec::new();
+
+            for _si in 0..4 {
+                let l1v = rp.evictim1(&pst);
+                trace!(tr, "\nL1 victim is {:?}", l1v);
+                if let Entry::P(addr, col) = l1v {
+                    trace!(tr, "Have controlled victim {:?} {:?}", addr, col);
+
+                    // Add relevant pathfinding here
+                    let iup = rp.update_def(&ist, l1v);
+                    let pup = rp.update_def(&pst, l1v);
+                    let nup = rp.update_def(&nst, l1v);
+                    trace!(tr, "Hit ist w/ vict:\n{:?}", iup);
+                    trace!(tr, "Hit pst w/ vict:\n{:?}", pup);
+                    trace!(tr, "Hit nst w/ vict:\n{:?}", nup);
+                    ist = iup.0;
+                    pst = pup.0;
+                    nst = nup.0;
+                    pre.push((l1v, Default::default()));
+
+                } else {
+                    trace!(tr, "Uncontrollable victim");
+                    break;
+                }
+            }
+
+            trace!(tr, "\n=-=-=-=-=-=-=-=\nPhase L2; init state:\n{:?}", ist);
+            trace!(tr, "Pathfinding...");
+            let srch = match kickout(&ist, rp, algo) {
+                Some(s) => s,
+                None => {
+                    trace!(tr, "No eviction found");
+                    res.failed = true;
+                    break;
+                }
+            };
+            let path = &srch.path;
+            trace!(tr, "Found eviction in {} accesses", path.len());
+            for (i, (acc, st)) in path.iter().enumerate() {
+                trace!(tr, "\n{}: {:?}\n{:?}", i+1, acc, st);
+            }
+
+            let pvec: Vec<_> = path.iter().map(|(acc, _st)| access_entry(acc)).collect();
+
+            trace!(tr, "\nTrying self-sync w/ pst\n");
+            let fst = applyseq(&pst, rp, &pvec, tr);
+            let synced = fst == path[path.len()-1].1;
+            if synced {
+                trace!(tr, "\nEnd states MATCH!")
+            } else {
+                trace!(tr, "\nEnd states DESYNCED!");
+                trace!(tr, "{:?}\n{:?}", path[path.len()-1].1, fst);
+            }
+
+            trace!(tr, "\nTrying self-sync w/ l1 noise\n");
+            let gst = applyseq(&nst, rp, &pvec, tr);
+            let synced_l1 = gst == path[path.len()-1].1;
+            if synced_l1 {
+                trace!(tr, "\nEnd states MATCH!")
+            } else {
+                trace!(tr, "\nEnd states DESYNCED!");
+                trace!(tr, "{:?}\n{:?}", path[path.len()-1].1, fst);
+            }
+
+            pst = path[path.len()-1].1.clone();
+            seen.insert(iist.clone(), ri);
+            res.rounds.push(Round{init: iist, pre, search: srch, synced, synced_l1: Some(synced_l1)});
+            ist = rp.victim(&pst, torig);
+            nst = rp.update_shallow(&pst, Entry::T, torig).0;
+        }
+    }
+    res
+}
@@ -11,6 +11,24 @@ pub enum Entry {
     P(PAddr, PColor)
 }
 
+impl Entry {
+    /// Single-byte encoding used by the packed states: X = 0, T = 1, P(a, c) = 2 + (a << 1 | c)
+    pub const fn pack(self) -> u8 {
+        match self {
+            Entry::X => 0,
+            Entry::T => 1,
+            Entry::P(a, c) => 2 + (a << 1 | c as u8)
+        }
+    }
+    pub const fn unpack(b: u8) -> Self {
+        match b {
+            0 => Entry::X,
+            1 => Entry::T,
+            _ => Entry::P((b - 2) >> 1, (b - 2) & 1 != 0)
+        }
+    }
+}
+
 pub trait CacheState: Eq + Hash + Clone + std::fmt::Debug {
     type EntryRank;
     type EntryIter: Iterator<Item = Entry>;
@@ -20,101 +38,307 @@ pub trait CacheState: Eq + Hash + Clone + std::fmt::Debug {
         self.rank(val).is_some()
     }
     fn entries(&self) -> Self::EntryIter;
+    /// Bitmask of attacker addresses present in the state
+    fn paddr_mask(&self) -> u128 {
+        self.entries().fold(0, |m, x| match x {
+            Entry::P(a, _) => m | 1 << a,
+            _ => m
+        })
+    }
     fn next_free_paddr(&self) -> PAddr {
-        let iset: Vec<PAddr> = self.entries().filter_map(|x| match x {
-            Entry::P(a, _) => Some(a),
-            _ => None
-        }).collect();
-        for i in 0..=(iset.len() as PAddr) {
-            if !iset.iter().any(|&x| x == i) {
-                return i
+        let fp = (!self.paddr_mask()).trailing_zeros();
+        assert!(fp < 127, "Out of attacker addresses in next_free_paddr");
+        fp as PAddr
+    }
+    /// Rename every attacker address `a` to `map[a]`, keeping colors
+    fn relabel(&self, map: &AddrMap) -> Self;
+    /// Canonical representative of the state up to renaming of attacker addresses:
+    /// addresses are renumbered in order of first occurrence in `entries()`.
+    /// Policies only compare entries for equality, so isomorphic states behave identically.
+    fn canon(&self) -> Self {
+        let mut map = [0; ADDRS];
+        let mut seen = 0u128;
+        let mut next = 0;
+        for x in self.entries() {
+            if let Entry::P(a, _) = x {
+                if seen & 1 << a == 0 {
+                    seen |= 1 << a;
+                    map[a as usize] = next;
+                    next += 1;
+                }
             }
         }
-        panic!("Logic error in next_free_paddr algorithm");
+        self.relabel(&map)
+    }
+}
+
+/// Number of distinct attacker addresses a state can hold
+pub const ADDRS: usize = 128;
+pub type AddrMap = [PAddr; ADDRS];
+
+
+/// Maximum associativity of a packed state component; one byte lane per way
+pub const LANES: usize = 16;
+
+/// Iterator over the entries of a packed state
+#[derive(Copy, Clone)]
+pub struct PackedIter {
+    w: u128,
+    n: u8
+}
+
+impl Iterator for PackedIter {
+    type Item = Entry;
+
+    fn next(&mut self) -> Option<Entry> {
+        if self.n == 0 {
+            return None;
+        }
+        let e = Entry::unpack(self.w as u8);
+        self.w >>= 8;
+        self.n -= 1;
+        Some(e)
+    }
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        (self.n as usize, Some(self.n as usize))
+    }
+}
+
+/// Index of the first of the `n` lanes of `w` holding byte `b`
+fn lane_position(w: u128, n: u8, b: u8) -> Option<usize> {
+    #[cfg(target_arch = "x86_64")]
+    let m = unsafe { simd::eqmask(w, b) };
+    #[cfg(not(target_arch = "x86_64"))]
+    let m = {
+        const LANE_LO: u128 = u128::MAX / 0xff;
+        const LANE_HI: u128 = LANE_LO << 7;
+        // Only the lowest flagged lane is exact, which is all we need
+        let x = w ^ (LANE_LO * b as u128);
+        let z = x.wrapping_sub(LANE_LO) & !x & LANE_HI;
+        (0..LANES).fold(0u32, |a, i| a | ((z >> (8 * i + 7)) as u32 & 1) << i)
+    };
+    let i = (m | 1 << n).trailing_zeros() as usize;
+    if i < n as usize { Some(i) } else { None }
+}
+
+/// Byte shuffle of the lanes of `w`: lane `j` of the result is lane `idx[j]` of `w`,
+/// or zero if `idx[j]` has its top bit set (`pshufb` semantics)
+pub fn lane_shuffle(w: u128, idx: &[u8; LANES]) -> u128 {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("ssse3") {
+            return unsafe { simd::shuffle(w, idx) };
+        }
+    }
+    idx.iter().enumerate().fold(0, |a, (j, &x)| {
+        if x & 0x80 != 0 { a } else { a | ((w >> (8 * (x & 0xf))) & 0xff) << (8 * j) }
+    })
+}
+
+#[cfg(target_arch = "x86_64")]
+mod simd {
+    use std::arch::x86_64::*;
+
+    /// Bitmask of the lanes of `w` equal to `b`; SSE2 is baseline on x86_64
+    #[inline]
+    pub unsafe fn eqmask(w: u128, b: u8) -> u32 {
+        let v: __m128i = std::mem::transmute(w);
+        _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(b as i8))) as u32
     }
+
+    #[target_feature(enable = "ssse3")]
+    pub unsafe fn shuffle(w: u128, idx: &[u8; 16]) -> u128 {
+        let v: __m128i = std::mem::transmute(w);
+        let m = _mm_loadu_si128(idx.as_ptr() as *const __m128i);
+        std::mem::transmute(_mm_shuffle_epi8(v, m))
+    }
+}
+
+/// Apply an address renaming to the first `n` lanes of `w`
+fn lane_relabel(w: u128, n: u8, map: &AddrMap) -> u128 {
+    (0..n as usize).fold(0, |a, i| {
+        let b = (w >> (8 * i)) as u8;
+        let nb = if b < 2 { b } else { 2 + (map[((b - 2) >> 1) as usize] << 1 | (b - 2) & 1) };
+        a | (nb as u128) << (8 * i)
+    })
 }
 
+fn lane_array(w: u128) -> [Entry; LANES] {
+    let mut out = [Entry::X; LANES];
+    for (i, x) in out.iter_mut().enumerate() {
+        *x = Entry::unpack((w >> (8 * i)) as u8);
+    }
+    out
+}
 
-#[derive(PartialEq, Eq, Hash, Clone, Debug)]
-pub struct PVec(pub Vec<Entry>);
+
+/// Permutation vector: up to `LANES` entries packed one per byte, MRU first
+#[derive(PartialEq, Eq, Copy, Clone)]
+pub struct PVec {
+    w: u128,
+    n: u8
+}
 
 impl PVec {
     pub fn new(sz: usize) -> Self {
-        Self(vec![Entry::X; sz])
+        assert!(sz <= LANES);
+        Self{w: 0, n: sz as u8}
+    }
+    pub fn len(&self) -> usize {
+        self.n as usize
+    }
+    pub fn get(&self, i: usize) -> Entry {
+        debug_assert!(i < self.len());
+        Entry::unpack((self.w >> (8 * i)) as u8)
+    }
+    pub fn set(&mut self, i: usize, val: Entry) {
+        debug_assert!(i < self.len());
+        self.w = self.w & !(0xff << (8 * i)) | (val.pack() as u128) << (8 * i);
+    }
+    pub fn raw(&self) -> u128 {
+        self.w
+    }
+    pub fn from_raw(w: u128, sz: usize) -> Self {
+        Self{w, n: sz as u8}
     }
 }
 
-impl<'a> CacheState for &'a PVec {
-    type EntryRank = usize;
-    type EntryIter = std::iter::Copied<std::slice::Iter<'a, Entry>>;
-
-    fn rank(&self, val: Entry) -> Option<Self::EntryRank> {
-        self.0.iter().position(|&x| x == val)
+impl Hash for PVec {
+    fn hash<H: std::hash::Hasher>(&self, state: &mut H) {
+        state.write_u128(self.w);
     }
-    fn entries(&self) -> Self::EntryIter {
-        self.0.iter().copied()
+}
+
+impl std::fmt::Debug for PVec {
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        f.debug_tuple("PVec").field(&&lane_array(self.w)[..self.len()]).finish()
     }
 }
+
 impl CacheState for PVec {
     type EntryRank = usize;
-    type EntryIter = std::vec::IntoIter<Entry>;
+    type EntryIter = PackedIter;
 
     fn rank(&self, val: Entry) -> Option<Self::EntryRank> {
-        (&self).rank(val)
+        lane_position(self.w, self.n, val.pack())
     }
     fn entries(&self) -> Self::EntryIter {
-        self.0.to_vec().into_iter()
+        PackedIter{w: self.w, n: self.n}
+    }
+    fn relabel(&self, map: &AddrMap) -> Self {
+        Self{w: lane_relabel(self.w, self.n, map), n: self.n}
     }
 }
 
 
-#[derive(PartialEq, Eq, Hash, Clone, Debug)]
-pub struct QVec{
-    pub age: Vec<u8>,
-    pub ent: Vec<Entry>
+/// Quad-age LRU state: up to `LANES` entries packed one per byte, with 2-bit ages
+#[derive(PartialEq, Eq, Copy, Clone)]
+pub struct QVec {
+    ent: u128,
+    age: u32,
+    n: u8
 }
 
 impl QVec {
     pub fn new(sz: usize) -> Self {
-        Self{age: vec![3; sz], ent: vec![Entry::X; sz]}
+        assert!(sz <= LANES);
+        Self{ent: 0, age: u32::MAX >> (32 - 2 * sz), n: sz as u8}
+    }
+    pub fn len(&self) -> usize {
+        self.n as usize
+    }
+    pub fn get(&self, i: usize) -> Entry {
+        debug_assert!(i < self.len());
+        Entry::unpack((self.ent >> (8 * i)) as u8)
+    }
+    pub fn set(&mut self, i: usize, val: Entry) {
+        debug_assert!(i < self.len());
+        self.ent = self.ent & !(0xff << (8 * i)) | (val.pack() as u128) << (8 * i);
+    }
+    pub fn age(&self, i: usize) -> u8 {
+        (self.age >> (2 * i)) as u8 & 3
+    }
+    /// Ages unpacked into an array, for in-place updates
+    pub fn ages(&self) -> [u8; LANES] {
+        let mut out = [0; LANES];
+        for (i, x) in out.iter_mut().enumerate().take(self.len()) {
+            *x = self.age(i);
+        }
+        out
+    }
+    pub fn set_ages(&mut self, av: &[u8; LANES]) {
+        self.age = av.iter().take(self.len()).enumerate().fold(0, |a, (i, &x)| {
+            debug_assert!(x <= 3);
+            a | (x as u32) << (2 * i)
+        });
     }
     pub fn evictim(&self) -> Option<usize> {
-        self.age.iter().position(|&x| x == 3)
+        (0..self.len()).find(|&i| self.age(i) == 3)
     }
 }
 
-impl<'a> CacheState for &'a QVec {
-    type EntryRank = (u8, usize);
-    type EntryIter = std::iter::Copied<std::slice::Iter<'a, Entry>>;
-
-    fn rank(&self, val: Entry) -> Option<Self::EntryRank> {
-        match self.ent.iter().position(|&x| x == val) {
-            Some(i) => Some((self.age[i], i)),
-            _ => None
-        }
+impl Hash for QVec {
+    fn hash<H: std::hash::Hasher>(&self, state: &mut H) {
+        state.write_u128(self.ent ^ (self.age as u128) << 96);
     }
-    fn entries(&self) -> Self::EntryIter {
-        self.ent.iter().copied()
+}
+
+impl std::fmt::Debug for QVec {
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        f.debug_struct("QVec")
+            .field("age", &&self.ages()[..self.len()])
+            .field("ent", &&lane_array(self.ent)[..self.len()])
+            .finish()
     }
 }
+
 impl CacheState for QVec {
     type EntryRank = (u8, usize);
-    type EntryIter = std::vec::IntoIter<Entry>;
+    type EntryIter = PackedIter;
 
     fn rank(&self, val: Entry) -> Option<Self::EntryRank> {
-        (&self).rank(val)
+        lane_position(self.ent, self.n, val.pack()).map(|i| (self.age(i), i))
     }
     fn entries(&self) -> Self::EntryIter {
-        self.ent.to_vec().into_iter()
+        PackedIter{w: self.ent, n: self.n}
+    }
+    fn relabel(&self, map: &AddrMap) -> Self {
+        Self{ent: lane_relabel(self.ent, self.n, map), ..*self}
+    }
+}
+
+
+/// Deduplicating adaptor over entry iterators, tracking seen entries in a fixed bitset
+pub struct UniqueEntries<I> {
+    it: I,
+    seen: [u128; 2]
+}
+
+impl<I: Iterator<Item = Entry>> Iterator for UniqueEntries<I> {
+    type Item = Entry;
+
+    fn next(&mut self) -> Option<Entry> {
+        for x in &mut self.it {
+            let b = x.pack();
+            let (word, bit) = ((b >> 7) as usize, 1u128 << (b & 0x7f));
+            if self.seen[word] & bit == 0 {
+                self.seen[word] |= bit;
+                return Some(x);
+            }
+        }
+        None
     }
 }
 
+pub fn unique_entries<I: Iterator<Item = Entry>>(it: I) -> UniqueEntries<I> {
+    UniqueEntries{it, seen: [0; 2]}
+}
+
 
 pub mod hier {
     use crate::state::*;
-    use itertools::Itertools;
 
-    #[derive(PartialEq, Eq, Hash, Clone, Debug)]
+    #[derive(PartialEq, Eq, Hash, Copy, Clone, Debug)]
     pub struct H2UState<L1T: CacheState, L2T: CacheState>
     {
         pub l1: L1T,
@@ -125,7 +349,7 @@ pub mod hier {
     where L1T: CacheState, L2T: CacheState
     {
         type EntryRank = (Option<L1T::EntryRank>, Option<L2T::EntryRank>);
-        type EntryIter = itertools::Unique<std::iter::Chain<L1T::EntryIter, L2T::EntryIter>>;
+        type EntryIter = UniqueEntries<std::iter::Chain<L1T::EntryIter, L2T::EntryIter>>;
 
         fn rank(&self, val: Entry) -> Option<Self::EntryRank> {
             match (self.l1.rank(val), self.l2.rank(val)) {
@@ -134,12 +358,18 @@ pub mod hier {
             }
         }
         fn entries(&self) -> Self::EntryIter {
-            self.l1.entries().chain(self.l2.entries()).unique()
+            unique_entries(self.l1.entries().chain(self.l2.entries()))
+        }
+        fn paddr_mask(&self) -> u128 {
+            self.l1.paddr_mask() | self.l2.paddr_mask()
+        }
+        fn relabel(&self, map: &AddrMap) -> Self {
+            Self{l1: self.l1.relabel(map), l2: self.l2.relabel(map)}
         }
     }
 
 
-    #[derive(PartialEq, Eq, Hash, Clone, Debug)]
+    #[derive(PartialEq, Eq, Hash, Copy, Clone, Debug)]
     pub struct H3UState<L1T: CacheState, L2T: CacheState, L3T: CacheState>
     {
         pub l1: L1T,
@@ -151,7 +381,7 @@ pub mod hier {
     where L1T: CacheState, L2T: CacheState, L3T: CacheState
     {
         type EntryRank = (Option<L1T::EntryRank>, Option<L2T::EntryRank>, Option<L3T::EntryRank>);
-        type EntryIter = itertools::Unique<std::iter::Chain<std::iter::Chain<L1T::EntryIter, L2T::EntryIter>, L3T::EntryIter>>;
+        type EntryIter = UniqueEntries<std::iter::Chain<std::iter::Chain<L1T::EntryIter, L2T::EntryIter>, L3T::EntryIter>>;
 
         fn rank(&self, val: Entry) -> Option<Self::EntryRank> {
             match (self.l1.rank(val), self.l2.rank(val), self.l3.rank(val)) {
@@ -160,12 +390,18 @@ pub mod hier {
             }
         }
         fn entries(&self) -> Self::EntryIter {
-            self.l1.entries().chain(self.l2.entries()).chain(self.l3.entries()).unique()
+            unique_entries(self.l1.entries().chain(self.l2.entries()).chain(self.l3.entries()))
+        }
+        fn paddr_mask(&self) -> u128 {
+            self.l1.paddr_mask() | self.l2.paddr_mask() | self.l3.paddr_mask()
+        }
+        fn relabel(&self, map: &AddrMap) -> Self {
+            Self{l1: self.l1.relabel(map), l2: self.l2.relabel(map), l3: self.l3.relabel(map)}
         }
     }
 
 
-    #[derive(PartialEq, Eq, Hash, Clone, Debug)]
+    #[derive(PartialEq, Eq, Hash, Copy, Clone, Debug)]
     pub struct H2SState<L1IT: CacheState, L1DT: CacheState, L2T: CacheState> {
         pub l1i: L1IT,
         pub l1d: L1DT,
@@ -176,7 +412,7 @@ pub mod hier {
     where L1IT: CacheState, L1DT: CacheState, L2T: CacheState
     {
         type EntryRank = (Option<L1IT::EntryRank>, Option<L1DT::EntryRank>, Option<L2T::EntryRank>);
-        type EntryIter = itertools::Unique<std::iter::Chain<std::iter::Chain<L1IT::EntryIter, L1DT::EntryIter>, L2T::EntryIter>>;
+        type EntryIter = UniqueEntries<std::iter::Chain<std::iter::Chain<L1IT::EntryIter, L1DT::EntryIter>, L2T::EntryIter>>;
 
         fn rank(&self, val: Entry) -> Option<Self::EntryRank> {
             match (self.l1i.rank(val), self.l1d.rank(val), self.l2.rank(val)) {
@@ -185,7 +421,115 @@ pub mod hier {
             }
         }
         fn entries(&self) -> Self::EntryIter {
-            (&self).l1i.entries().chain(self.l1d.entries()).chain(self.l2.entries()).unique()
+            unique_entries(self.l1i.entries().chain(self.l1d.entries()).chain(self.l2.entries()))
+        }
+        fn paddr_mask(&self) -> u128 {
+            self.l1i.paddr_mask() | self.l1d.paddr_mask() | self.l2.paddr_mask()
+        }
+        fn relabel(&self, map: &AddrMap) -> Self {
+            Self{l1i: self.l1i.relabel(map), l1d: self.l1d.relabel(map), l2: self.l2.relabel(map)}
+        }
+    }
+}
+
+
+/// Several sets of a lower cache level sharing one set of the level above.
+/// Addresses are partitioned into per-set blocks of `MS_BLOCK`; the first address
+/// of each block is the target of that set, the rest belong to the attacker.
+pub mod multi {
+    use crate::state::*;
+
+    pub const MS_MAXSETS: usize = 4;
+    pub const MS_BLOCK: usize = (ADDRS - 1) / MS_MAXSETS;
+
+    pub const fn ms_set(a: PAddr) -> usize {
+        a as usize / MS_BLOCK
+    }
+    pub const fn ms_target(set: usize) -> Entry {
+        Entry::P((set * MS_BLOCK) as PAddr, false)
+    }
+    pub const fn ms_is_target(a: PAddr) -> bool {
+        a as usize % MS_BLOCK == 0
+    }
+
+    #[derive(PartialEq, Eq, Hash, Copy, Clone, Debug)]
+    pub struct MSState<L1T: CacheState, L2T: CacheState + Copy> {
+        pub l1: L1T,
+        pub l2: [L2T; MS_MAXSETS],
+        pub nsets: u8
+    }
+
+    impl<L1T, L2T> MSState<L1T, L2T>
+    where L1T: CacheState, L2T: CacheState + Copy
+    {
+        pub fn new(l1: L1T, l2: L2T, nsets: usize) -> Self {
+            assert!(nsets >= 1 && nsets <= MS_MAXSETS);
+            Self{l1, l2: [l2; MS_MAXSETS], nsets: nsets as u8}
+        }
+        pub fn sets(&self) -> &[L2T] {
+            &self.l2[..self.nsets as usize]
+        }
+        /// First attacker address of `set` not present in the state
+        pub fn free_paddr(&self, set: usize) -> PAddr {
+            let base = set * MS_BLOCK;
+            let blk = (self.paddr_mask() >> base) | 1;
+            let fp = (!blk).trailing_zeros() as usize;
+            assert!(fp < MS_BLOCK, "Out of attacker addresses for set {}", set);
+            (base + fp) as PAddr
+        }
+    }
+
+    impl<L1T, L2T> CacheState for MSState<L1T, L2T>
+    where L1T: CacheState, L2T: CacheState + Copy
+    {
+        type EntryRank = (Option<L1T::EntryRank>, Option<L2T::EntryRank>);
+        type EntryIter = UniqueEntries<std::iter::Chain<L1T::EntryIter,
+            std::iter::Flatten<std::iter::Take<std::array::IntoIter<L2T::EntryIter, MS_MAXSETS>>>>>;
+
+        fn rank(&self, val: Entry) -> Option<Self::EntryRank> {
+            let l2r = match val {
+                Entry::P(a, _) if ms_set(a) < self.nsets as usize => self.l2[ms_set(a)].rank(val),
+                _ => None
+            };
+            match (self.l1.rank(val), l2r) {
+                (None, None) => None,
+                (a, b) => Some((a, b))
+            }
+        }
+        fn entries(&self) -> Self::EntryIter {
+            let l2 = IntoIterator::into_iter(self.l2.map(|s| s.entries())).take(self.nsets as usize);
+            unique_entries(self.l1.entries().chain(l2.flatten()))
+        }
+        fn paddr_mask(&self) -> u128 {
+            self.sets().iter().fold(self.l1.paddr_mask(), |m, s| m | s.paddr_mask())
+        }
+        fn relabel(&self, map: &AddrMap) -> Self {
+            let mut l2 = self.l2;
+            for s in l2.iter_mut().take(self.nsets as usize) {
+                *s = s.relabel(map);
+            }
+            Self{l1: self.l1.relabel(map), l2, nsets: self.nsets}
+        }
+        /// Attacker addresses are renumbered within their own set's block; targets stay fixed
+        fn canon(&self) -> Self {
+            let mut map = [0; ADDRS];
+            let mut seen = 0u128;
+            let mut next = [1; MS_MAXSETS];
+            for x in self.entries() {
+                if let Entry::P(a, _) = x {
+                    if seen & 1 << a == 0 {
+                        seen |= 1 << a;
+                        let set = ms_set(a);
+                        map[a as usize] = if ms_is_target(a) {
+                            a
+                        } else {
+                            next[set] += 1;
+                            (set * MS_BLOCK + next[set] - 1) as PAddr
+                        };
+                    }
+                }
+            }
+            self.relabel(&map)
         }
     }
 }
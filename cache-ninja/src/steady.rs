@@ -0,0 +1,359 @@
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::fmt::Write;
+
+use crate::state::CacheState;
+use crate::policy::{CacheRP, Origin};
+use crate::search::{Round, Rounds, Search, Trace, access_entry, applyseq};
+
+
+/// Limits on the round-transition graph explored by `steady`
+#[derive(Copy, Clone, Debug)]
+pub struct Limits {
+    /// Also take eviction paths up to this many accesses longer than the shortest one
+    pub slack: usize,
+    /// Max. number of round states to expand
+    pub nodes: usize,
+    /// Weigh rounds by the policy's access costs (predicted cycles with -L) instead of accesses
+    pub weighted: bool
+}
+
+impl Default for Limits {
+    fn default() -> Self {
+        Self{slack: 0, nodes: 64, weighted: false}
+    }
+}
+
+
+/// One eviction round from a graph node: the canonical states visited, ending in the evicted state,
+/// and its weight (accesses, or their summed costs if weighted)
+struct Edge<T> {
+    to: usize,
+    path: Vec<T>,
+    w: usize
+}
+
+/// Round-transition graph: nodes are canonical states right after the target access,
+/// edges are eviction paths leading (via the next target access) to the next such state
+struct Graph<T> {
+    nodes: Vec<T>,
+    index: HashMap<T, usize>,
+    edges: Vec<Vec<Edge<T>>>,
+    /// States expanded by the eviction search of every node; None if the node was not expanded
+    expanded: Vec<Option<usize>>,
+    complete: bool
+}
+
+impl<T: CacheState> Graph<T> {
+    fn node(&mut self, st: T) -> usize {
+        if let Some(&i) = self.index.get(&st) {
+            return i;
+        }
+        self.nodes.push(st.clone());
+        self.edges.push(Vec::new());
+        self.expanded.push(None);
+        self.index.insert(st, self.nodes.len() - 1);
+        self.nodes.len() - 1
+    }
+}
+
+
+/// All canonical evicted states reachable from `t` in at most `slack` accesses more than the
+/// shortest eviction, without passing through an earlier eviction, with the path to each.
+/// Stops generating states once `budget` are stored; returns the paths found up to then and
+/// the number of states expanded and stored.
+/// Only the visited set and the frontier hold states; a path is kept as the successor taken at
+/// every step and replayed at the end, which also sums its access costs.
+fn round_paths<T: CacheState, R: CacheRP<State=T>>(t: &T, rp: &R, slack: usize, budget: usize) -> (Vec<(Vec<T>, usize)>, usize, usize) {
+    let start = t.canon();
+    // (parent, position among the parent's successors) of every stored state
+    let mut parent = vec![(usize::MAX, 0)];
+    let mut seen: HashSet<T> = HashSet::new();
+    seen.insert(start.clone());
+    let mut ends = Vec::new();
+    let mut frontier = vec![(start.clone(), 0)];
+    let mut expanded = 0;
+    let mut depth = 0;
+    let mut dmin = None;
+    while !frontier.is_empty() && dmin.map_or(true, |d| depth < d + slack) {
+        depth += 1;
+        let mut next = Vec::new();
+        for (st, i) in frontier {
+            if seen.len() >= budget {
+                break;
+            }
+            expanded += 1;
+            for (k, s) in rp.successors(&st).into_iter().enumerate() {
+                let s = s.canon();
+                if seen.contains(&s) {
+                    continue;
+                }
+                seen.insert(s.clone());
+                parent.push((i, k));
+                if rp.evicted(&s) {
+                    ends.push(parent.len() - 1);
+                    dmin.get_or_insert(depth);
+                } else {
+                    next.push((s, parent.len() - 1));
+                }
+            }
+        }
+        frontier = next;
+    }
+    let stored = seen.len();
+    drop(seen);
+    let paths = ends.into_iter().map(|mut i| {
+        let mut ks = Vec::new();
+        while parent[i].0 != usize::MAX {
+            ks.push(parent[i].1);
+            i = parent[i].0;
+        }
+        let mut st = start.clone();
+        let mut cost = 0;
+        let path = ks.iter().rev().map(|&k| {
+            let (mut sts, accs) = rp.outedges(&st);
+            cost += rp.access_cost(&accs[k]);
+            st = sts.swap_remove(k).canon();
+            st.clone()
+        }).collect();
+        (path, cost)
+    }).collect();
+    (paths, expanded, stored)
+}
+
+fn explore<T: CacheState, R: CacheRP<State=T>>(t: &T, rp: &R, torig: Origin, lim: Limits) -> Graph<T> {
+    let mut g = Graph{nodes: Vec::new(), index: HashMap::new(), edges: Vec::new(), expanded: Vec::new(), complete: true};
+    // Follow the greedy chain of shortest rounds first, so that the node budget always covers
+    // at least the cycle a repeated kickout would find, then widen breadth-first
+    let mut queue = VecDeque::new();
+    queue.push_back(g.node(rp.victim(t, torig).canon()));
+    // One state budget for the whole graph, so that a hopeless job gives up after one node
+    let mut nexp = 0;
+    let mut budget = crate::MAXSTATES;
+    while let Some(i) = queue.pop_front() {
+        if g.expanded[i].is_some() {
+            continue;
+        }
+        if nexp == lim.nodes || budget == 0 {
+            g.complete = false;
+            break;
+        }
+        let (paths, expanded, stored) = round_paths(&g.nodes[i].clone(), rp, lim.slack, budget);
+        budget -= stored.min(budget);
+        if budget == 0 {
+            g.complete = false;
+        }
+        let mut out: Vec<Edge<T>> = Vec::new();
+        for (path, cost) in paths {
+            let to = g.node(rp.victim(path.last().unwrap(), torig).canon());
+            let w = if lim.weighted { cost } else { path.len() };
+            match out.iter_mut().find(|e| e.to == to) {
+                Some(e) if (e.w, e.path.len()) <= (w, path.len()) => (),
+                Some(e) => *e = Edge{to, path, w},
+                None => out.push(Edge{to, path, w})
+            }
+        }
+        let greedy = out.iter().min_by_key(|e| (e.w, e.path.len())).map(|e| e.to);
+        queue.extend(out.iter().map(|e| e.to).filter(|&to| Some(to) != greedy));
+        if let Some(to) = greedy {
+            queue.push_front(to);
+        }
+        g.edges[i] = out;
+        g.expanded[i] = Some(expanded);
+        nexp += 1;
+    }
+    g
+}
+
+
+/// Karp's minimum mean cycle over the explored part of `g`, by edge weight per round.
+/// Returns the nodes of the cycle in order; the mean is exact, ties go to the cycle with fewer rounds.
+fn min_mean_cycle<T>(g: &Graph<T>) -> Option<Vec<usize>> {
+    const INF: usize = usize::MAX;
+    // Work on the expanded nodes only, renumbered densely
+    let ids: Vec<usize> = (0..g.nodes.len()).filter(|&i| g.expanded[i].is_some()).collect();
+    let mut loc = vec![usize::MAX; g.nodes.len()];
+    ids.iter().enumerate().for_each(|(j, &i)| loc[i] = j);
+    let n = ids.len();
+    let edges: Vec<Vec<(usize, usize)>> = ids.iter().map(|&i| {
+        g.edges[i].iter().filter(|e| loc[e.to] != usize::MAX).map(|e| (loc[e.to], e.w)).collect()
+    }).collect();
+    // d[k][v]: least weight of a k-round walk ending in v (from any node)
+    let mut d = vec![vec![INF; n]; n + 1];
+    let mut from = vec![vec![usize::MAX; n]; n + 1];
+    d[0].iter_mut().for_each(|x| *x = 0);
+    for k in 1..=n {
+        for u in 0..n {
+            if d[k-1][u] == INF {
+                continue;
+            }
+            for &(v, len) in &edges[u] {
+                let w = d[k-1][u] + len;
+                if w < d[k][v] {
+                    d[k][v] = w;
+                    from[k][v] = u;
+                }
+            }
+        }
+    }
+
+    // Mean of the critical walk ending in v: max over k of (d[n][v] - d[k][v]) / (n - k)
+    let mut best: Option<(usize, usize, usize)> = None;
+    for v in 0..n {
+        if d[n][v] == INF {
+            continue;
+        }
+        let mut vmax: Option<(usize, usize)> = None;
+        for k in 0..n {
+            if d[k][v] == INF {
+                continue;
+            }
+            let (num, den) = (d[n][v] - d[k][v], n - k);
+            if vmax.map_or(true, |(a, b)| num * b > a * den) {
+                vmax = Some((num, den));
+            }
+        }
+        if let Some((num, den)) = vmax {
+            if best.map_or(true, |(a, b, _)| num * b < a * den) {
+                best = Some((num, den, v));
+            }
+        }
+    }
+    let v = best?.2;
+
+    // The n-round walk into v repeats a node; split it into simple cycles and keep the cheapest
+    let mut walk = vec![v];
+    for k in (1..=n).rev() {
+        walk.push(from[k][*walk.last().unwrap()]);
+    }
+    walk.reverse();
+    let weight = |u: usize, v: usize| edges[u].iter().find(|e| e.0 == v).unwrap().1;
+    let mut stack: Vec<usize> = Vec::new();
+    let mut cyc: Option<(usize, Vec<usize>)> = None;
+    for &u in &walk {
+        if let Some(p) = stack.iter().position(|&x| x == u) {
+            let c = stack.split_off(p);
+            let w: usize = (0..c.len()).map(|i| weight(c[i], *c.get(i + 1).unwrap_or(&u))).sum();
+            if cyc.as_ref().map_or(true, |(bw, bc)| w * bc.len() < bw * c.len()
+                                   || (w * bc.len() == bw * c.len() && c.len() < bc.len())) {
+                cyc = Some((w, c));
+            }
+        }
+        stack.push(u);
+    }
+    cyc.map(|c| c.1.iter().map(|&j| ids[j]).collect())
+}
+
+/// Least weight from node 0 to any node of `cyc`, as (nodes on the way, entry node)
+fn leadin<T>(g: &Graph<T>, cyc: &[usize]) -> (Vec<usize>, usize) {
+    let n = g.nodes.len();
+    let mut dist = vec![usize::MAX; n];
+    let mut prev = vec![usize::MAX; n];
+    let mut queue = VecDeque::new();
+    dist[0] = 0;
+    queue.push_back(0);
+    // Round weights are small integers, so a label-correcting queue settles quickly
+    while let Some(u) = queue.pop_front() {
+        if cyc.contains(&u) {
+            continue;
+        }
+        for e in &g.edges[u] {
+            let w = dist[u] + e.w;
+            if w < dist[e.to] {
+                dist[e.to] = w;
+                prev[e.to] = u;
+                queue.push_back(e.to);
+            }
+        }
+    }
+    let entry = *cyc.iter().min_by_key(|&&c| (dist[c], c)).unwrap();
+    let mut nodes = vec![entry];
+    while prev[*nodes.last().unwrap()] != usize::MAX {
+        nodes.push(prev[*nodes.last().unwrap()]);
+    }
+    nodes.reverse();
+    (nodes, entry)
+}
+
+
+/// Steady-state repeated eviction: instead of following one greedy search per round, build the
+/// graph of round-to-round transitions over canonical states, take the cycle with the fewest
+/// accesses (or least cost, if weighted) per eviction (Karp) and the cheapest lead-in into it,
+/// then replay both on `t`.
+/// The result is optimal whenever the whole reachable graph fits in `lim.nodes`.
+pub fn steady<T: CacheState, R: CacheRP<State=T>>(t: &T, rp: &R, maxrnds: usize, torig: Origin, lim: Limits, tr: &mut Trace) -> Rounds<T> {
+    trace!(tr, "Steady-state search, slack {}, max {} nodes; RP: {:?}", lim.slack, lim.nodes, rp);
+    let mut res = Rounds::new();
+    let g = explore(t, rp, torig, lim);
+    let nedges: usize = g.edges.iter().map(|e| e.len()).sum();
+    trace!(tr, "Round graph: {} nodes ({} expanded{}), {} edges, {} states expanded",
+           g.nodes.len(), g.expanded.iter().flatten().count(), if g.complete { "" } else { ", truncated" },
+           nedges, g.expanded.iter().flatten().sum::<usize>());
+
+    let cyc = match min_mean_cycle(&g) {
+        Some(c) => c,
+        None => {
+            trace!(tr, "No eviction cycle found");
+            res.failed = true;
+            return res;
+        }
+    };
+    let (lead, entry) = leadin(&g, &cyc);
+    let p = cyc.iter().position(|&c| c == entry).unwrap();
+    let cyc: Vec<usize> = cyc[p..].iter().chain(&cyc[..p]).copied().collect();
+    let clen: usize = (0..cyc.len()).map(|i| {
+        g.edges[cyc[i]].iter().find(|e| e.to == cyc[(i + 1) % cyc.len()]).unwrap().w
+    }).sum();
+    trace!(tr, "Min. mean cycle: {} rounds, weight {} ({:.3} per eviction); lead-in {} rounds",
+           cyc.len(), clen, clen as f64 / cyc.len() as f64, lead.len() - 1);
+
+    // Replay on the concrete state until the concrete round state repeats; canonical cycles
+    // may need several passes when addresses come back relabelled
+    let walk = lead.iter().copied().chain(cyc.iter().copied().cycle().skip(1));
+    let mut seen: HashMap<T, usize> = HashMap::new();
+    let mut pst = t.clone();
+    let mut ist = rp.victim(t, torig);
+    let mut walk = walk.peekable();
+    for ri in 0..maxrnds {
+        trace!(tr, "\n---------------------------");
+        if let Some(&pos) = seen.get(&ist) {
+            trace!(tr, "Round {}; found init state previously in round {}\n{:?}", ri, pos, res.rounds[pos].init);
+            res.cycle = Some((ri, pos));
+            break;
+        }
+        let u = walk.next().unwrap();
+        let v = *walk.peek().unwrap();
+        trace!(tr, "Round {}; init state:\n{:?}", ri, ist);
+        let edge = g.edges[u].iter().find(|e| e.to == v).unwrap();
+
+        let mut st = ist.clone();
+        let mut path = Vec::new();
+        for cst in &edge.path {
+            let (sts, accs) = rp.outedges(&st);
+            let i = sts.iter().position(|x| x.canon() == *cst).unwrap();
+            st = sts[i].clone();
+            path.push((accs[i], st.clone()));
+        }
+        trace!(tr, "Eviction in {} accesses", path.len());
+        for (i, (acc, st)) in path.iter().enumerate() {
+            trace!(tr, "\n{}: {:?}\n{:?}", i+1, acc, st);
+        }
+
+        trace!(tr, "\nTrying self-sync\n");
+        let pvec: Vec<_> = path.iter().map(|(acc, _st)| access_entry(acc)).collect();
+        let fst = applyseq(&pst, rp, &pvec, tr);
+        let synced = fst == st;
+        if synced {
+            trace!(tr, "\nEnd states MATCH!")
+        } else {
+            trace!(tr, "\nEnd states DESYNCED!");
+        }
+
+        let cost = path.iter().map(|(acc, _)| rp.access_cost(acc)).sum();
+        let srch = Search{path, cost, expanded: g.expanded[u].unwrap(), phased: false};
+        pst = st;
+        seen.insert(ist.clone(), ri);
+        res.rounds.push(Round{init: ist, pre: Vec::new(), search: srch, synced, synced_l1: None});
+        ist = rp.victim(&pst, torig);
+    }
+    res
+}
@@ -0,0 +1,340 @@
+use std::cmp::Reverse;
+use std::collections::{BinaryHeap, HashMap, HashSet, VecDeque};
+use std::collections::hash_map::DefaultHasher;
+use std::fmt::Write;
+use std::hash::{Hash, Hasher};
+
+use crate::state::{CacheState, Entry, PAddr, PColor, ADDRS};
+use crate::policy::{CacheRP, Origin, PVRP};
+use crate::preset::{self, Preset, PresetFn};
+use crate::search;
+use crate::batch::Json;
+
+
+#[derive(PartialEq, Eq, Copy, Clone, Debug)]
+pub enum SyncAlgo {
+    /// Breadth-first over beliefs; finds a shortest synchronizing sequence
+    Bfs,
+    /// Best-first on belief size; fast, but not necessarily shortest
+    Greedy
+}
+
+pub struct Config {
+    pub preset: String,
+    pub level: Option<usize>,
+    pub algo: SyncAlgo,
+    pub maxbelief: usize,
+    pub maxnodes: usize
+}
+
+pub const USAGE: &str = "\
+usage: cache-ninja sync [OPTIONS]
+  -p, --preset NAME   preset to synchronize (default: TLB::KABYLAKE)
+  -l, --level N       1 synchronizes the L1 data policy alone (default: the whole hierarchy)
+  -a, --algo ALGO     bfs (shortest sequence, bounded by the greedy one) or greedy (shrink the
+                      belief fastest) (default: bfs)
+  -B, --belief N      max. number of possible initial states (default: 1000000)
+  -G, --nodes N       max. number of beliefs to expand per search (default: 100000)
+Computes a sequence of attacker accesses that drives every possible initial state of the set,
+holding any mix of foreign entries and the target, into one known state; prints it as JSON,
+with 'optimal' set if no shorter sequence exists.";
+
+impl Config {
+    pub fn parse(args: impl Iterator<Item = String>) -> Result<Self, String> {
+        let mut cfg = Config {
+            preset: "TLB::KABYLAKE".to_string(),
+            level: None,
+            algo: SyncAlgo::Bfs,
+            maxbelief: 1_000_000,
+            maxnodes: 100_000
+        };
+        let args: Vec<String> = args.collect();
+        let mut it = args.iter();
+        while let Some(a) = it.next() {
+            let mut val = || it.next().ok_or_else(|| format!("missing value for '{}'", a));
+            match a.as_str() {
+                "-p" | "--preset" => {
+                    let v = val()?;
+                    cfg.preset = preset::NAMES.iter().find(|n| n.eq_ignore_ascii_case(v))
+                        .ok_or_else(|| format!("unknown preset: '{}'", v))?.to_string();
+                }
+                "-l" | "--level" => cfg.level = Some(val()?.parse().map_err(|e| format!("--level: {}", e))?),
+                "-a" | "--algo" => cfg.algo = match val()?.as_str() {
+                    "bfs" => SyncAlgo::Bfs,
+                    "greedy" => SyncAlgo::Greedy,
+                    v => return Err(format!("unknown algorithm: '{}'", v))
+                },
+                "-B" | "--belief" => cfg.maxbelief = val()?.parse().map_err(|e| format!("--belief: {}", e))?,
+                "-G" | "--nodes" => cfg.maxnodes = val()?.parse().map_err(|e| format!("--nodes: {}", e))?,
+                "-h" | "--help" => return Err(String::new()),
+                _ => return Err(format!("unknown argument: '{}'", a))
+            }
+        }
+        Ok(cfg)
+    }
+}
+
+
+/// Set of states the cache may be in, with attacker addresses renumbered densely in order of
+/// first access (only addresses still present in some state are kept) and the states sorted,
+/// so that equivalent beliefs compare equal
+#[derive(PartialEq, Eq, Hash, Clone)]
+struct Belief<T> {
+    states: Vec<T>,
+    cols: Vec<PColor>
+}
+
+fn state_key<T: Hash>(st: &T) -> u64 {
+    let mut h = DefaultHasher::new();
+    st.hash(&mut h);
+    h.finish()
+}
+
+impl<T: CacheState> Belief<T> {
+    fn new(states: HashSet<T>, cols: Vec<PColor>) -> Self {
+        let live = states.iter().fold(0u128, |m, s| m | s.paddr_mask());
+        let mut map = [0; ADDRS];
+        let mut next = 0;
+        let mut ncols = Vec::new();
+        for (a, &c) in cols.iter().enumerate() {
+            if live & 1 << a != 0 {
+                map[a] = next;
+                next += 1;
+                ncols.push(c);
+            }
+        }
+        let mut states: Vec<T> = states.iter().map(|s| s.relabel(&map)).collect();
+        states.sort_by_cached_key(state_key);
+        Self{states, cols: ncols}
+    }
+
+    /// Access attacker address `a` (`cols.len()` for a fresh page) in every state
+    fn step<R: CacheRP<State=T>>(&self, rp: &R, a: usize, col: PColor, orig: Origin) -> Self {
+        let ent = Entry::P(a as PAddr, col);
+        let states = self.states.iter().map(|s| rp.update(s, ent, orig).0).collect();
+        let mut cols = self.cols.clone();
+        if a == cols.len() {
+            cols.push(col);
+        }
+        Self::new(states, cols)
+    }
+}
+
+/// Every state reachable from `st0` through foreign insertions and target accesses
+fn initial<T: CacheState, R: CacheRP<State=T>>(rp: &R, st0: &T, max: usize) -> Result<HashSet<T>, String> {
+    let origins = [Origin{isnfetch: false}, Origin{isnfetch: true}];
+    let mut seen = HashSet::new();
+    let mut queue = VecDeque::new();
+    seen.insert(st0.clone());
+    queue.push_back(st0.clone());
+    while let Some(st) = queue.pop_front() {
+        let noise = (0..rp.ncomp()).map(|c| rp.noise(&st, c));
+        let targ = origins.iter().map(|&o| rp.victim(&st, o));
+        for s in noise.chain(targ) {
+            if !seen.contains(&s) {
+                if seen.len() == max {
+                    return Err(format!("more than {} possible initial states", max));
+                }
+                seen.insert(s.clone());
+                queue.push_back(s);
+            }
+        }
+    }
+    Ok(seen)
+}
+
+
+pub struct Sync<T> {
+    pub seq: Vec<(Entry, Origin)>,
+    pub state: T,
+    pub belief: usize,
+    pub expanded: usize,
+    /// Whether `seq` is known to be a shortest synchronizing sequence
+    pub optimal: bool
+}
+
+/// Access to attacker address `a` (the next fresh page if `a` is the number of live pages)
+type Act = (usize, PColor, Origin);
+
+enum Outcome {
+    Found(Vec<Act>),
+    /// No synchronizing sequence within the depth bound
+    Exhausted,
+    /// Node limit reached
+    Limit
+}
+
+fn search_beliefs<T: CacheState, R: CacheRP<State=T>>(rp: &R, root: Belief<T>, kinds: &[(PColor, Origin)],
+                                                      algo: SyncAlgo, maxnodes: usize, maxdepth: usize,
+                                                      expanded: &mut usize) -> Outcome {
+    let mut nodes: Vec<(Belief<T>, usize, usize, Act)> = Vec::new();
+    let mut index: HashMap<Belief<T>, usize> = HashMap::new();
+    let mut fifo = VecDeque::new();
+    let mut heap = BinaryHeap::new();
+    index.insert(root.clone(), 0);
+    heap.push(Reverse((root.states.len(), 0usize, 0usize)));
+    fifo.push_back(0);
+    nodes.push((root, usize::MAX, 0, (0, false, Default::default())));
+    let mut goal = None;
+    let start = *expanded;
+    'search: loop {
+        let i = match algo {
+            SyncAlgo::Bfs => fifo.pop_front(),
+            SyncAlgo::Greedy => heap.pop().map(|Reverse((_, _, i))| i)
+        };
+        let i = match i {
+            Some(i) => i,
+            None => break
+        };
+        if nodes[i].0.states.len() == 1 {
+            goal = Some(i);
+            break;
+        }
+        let depth = nodes[i].2;
+        if depth >= maxdepth {
+            continue;
+        }
+        if *expanded - start == maxnodes {
+            return Outcome::Limit;
+        }
+        *expanded += 1;
+        let nlive = nodes[i].0.cols.len();
+        for a in 0..=nlive {
+            for &(c, o) in kinds {
+                if a < nlive && nodes[i].0.cols[a] != c {
+                    continue;
+                }
+                let nb = nodes[i].0.step(rp, a, c, o);
+                if index.contains_key(&nb) {
+                    continue;
+                }
+                let j = nodes.len();
+                index.insert(nb.clone(), j);
+                let done = nb.states.len() == 1;
+                heap.push(Reverse((nb.states.len(), depth + 1, j)));
+                fifo.push_back(j);
+                nodes.push((nb, i, depth + 1, (a, c, o)));
+                if done && algo == SyncAlgo::Bfs {
+                    goal = Some(j);
+                    break 'search;
+                }
+            }
+        }
+    }
+    let mut j = match goal {
+        Some(j) => j,
+        None => return Outcome::Exhausted
+    };
+    let mut acts = Vec::new();
+    while nodes[j].1 != usize::MAX {
+        acts.push(nodes[j].3);
+        j = nodes[j].1;
+    }
+    acts.reverse();
+    Outcome::Found(acts)
+}
+
+/// Shortest (or, with `SyncAlgo::Greedy`, a short) synchronizing sequence for `rp`.
+/// A greedy search runs first; its length bounds the breadth-first search, which then either
+/// finds something shorter or proves the greedy sequence optimal.
+pub fn synchronize<T: CacheState, R: CacheRP<State=T>>(rp: &R, st0: &T, cfg: &Config) -> Result<Sync<T>, String> {
+    let init = initial(rp, st0, cfg.maxbelief)?;
+    let nbelief = init.len();
+
+    // Color/origin combinations the policy accesses attacker pages with
+    let mut kinds: Vec<(PColor, Origin)> = Vec::new();
+    for st in &init {
+        for acc in rp.outedges(st).1 {
+            if let (Entry::P(_, c), o) = search::access_entry(&acc) {
+                if !kinds.contains(&(c, o)) {
+                    kinds.push((c, o));
+                }
+            }
+        }
+    }
+
+    let root = Belief::new(init.clone(), Vec::new());
+    let mut expanded = 0;
+    let greedy = match search_beliefs(rp, root.clone(), &kinds, SyncAlgo::Greedy, cfg.maxnodes, usize::MAX, &mut expanded) {
+        Outcome::Found(acts) => Some(acts),
+        Outcome::Exhausted => return Err("no synchronizing sequence exists".to_string()),
+        Outcome::Limit => None
+    };
+    let (acts, optimal) = match (cfg.algo, greedy) {
+        (SyncAlgo::Greedy, Some(acts)) => (acts, false),
+        (_, greedy) => {
+            let bound = greedy.as_ref().map_or(usize::MAX, |g| g.len().saturating_sub(1));
+            match (search_beliefs(rp, root, &kinds, SyncAlgo::Bfs, cfg.maxnodes, bound, &mut expanded), greedy) {
+                (Outcome::Found(acts), _) => (acts, true),
+                (Outcome::Exhausted, Some(g)) => (g, true),
+                (Outcome::Limit, Some(g)) => (g, false),
+                (Outcome::Exhausted, None) => return Err("no synchronizing sequence exists".to_string()),
+                (Outcome::Limit, None) => return Err(format!("no synchronizing sequence within {} expanded beliefs",
+                                                              cfg.maxnodes))
+            }
+        }
+    };
+
+    // Replay the actions with concrete addresses: a fresh page reuses the lowest address
+    // that no longer occurs in any possible state
+    let mut states: Vec<T> = init.into_iter().collect();
+    let mut live: Vec<PAddr> = Vec::new();
+    let mut seq = Vec::new();
+    for (a, c, o) in acts {
+        let addr = if a < live.len() {
+            live[a]
+        } else {
+            let used = states.iter().fold(0u128, |m, s| m | s.paddr_mask());
+            (!used).trailing_zeros() as PAddr
+        };
+        if a == live.len() {
+            live.push(addr);
+        }
+        let ent = Entry::P(addr, c);
+        states = states.iter().map(|s| rp.update(s, ent, o).0).collect();
+        let used = states.iter().fold(0u128, |m, s| m | s.paddr_mask());
+        live.retain(|&x| used & 1 << x != 0);
+        seq.push((ent, o));
+    }
+    let state = states[0].clone();
+    assert!(states.iter().all(|s| *s == state));
+    Ok(Sync{seq, state, belief: nbelief, expanded, optimal})
+}
+
+
+struct Synchronize<'a>(&'a Config);
+
+impl<'a> Synchronize<'a> {
+    fn run<T: CacheState, R: CacheRP<State=T>>(&self, rp: &R, st: &T) -> Result<String, String> {
+        let res = synchronize(rp, st, self.0)?;
+        let mut out = String::new();
+        write!(out, "\"belief\":{},\"expanded\":{},\"len\":{},\"optimal\":{},\"seq\":",
+               res.belief, res.expanded, res.seq.len(), res.optimal).unwrap();
+        res.seq.json(&mut out);
+        write!(out, ",\"state\":\"{:?}\"", res.state).unwrap();
+        Ok(out)
+    }
+}
+
+impl<'a> PresetFn for Synchronize<'a> {
+    type Output = Result<String, String>;
+
+    fn call<P: Preset>(&self, pres: P) -> Self::Output {
+        let cfg = self.0;
+        match cfg.level {
+            None => self.run(&pres.rp(), &pres.newstate()),
+            Some(l) if l == pres.levels() => self.run(&pres.rp(), &pres.newstate()),
+            Some(1) => {
+                let rp: PVRP = pres.l1().unwrap();
+                self.run(&rp, &rp.newpv())
+            }
+            Some(l) => Err(format!("preset {} has no standalone model of level {}", cfg.preset, l))
+        }
+    }
+}
+
+pub fn run(cfg: &Config) -> Result<String, String> {
+    let res = preset::by_name(&cfg.preset, &Synchronize(cfg)).unwrap()?;
+    Ok(format!("{{\"preset\":\"{}\",\"algo\":\"{}\",{}}}\n", cfg.preset,
+               if cfg.algo == SyncAlgo::Bfs { "bfs" } else { "greedy" }, res))
+}
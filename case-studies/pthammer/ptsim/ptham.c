@@ -5,6 +5,9 @@
 #include "xbs.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
 #include <inttypes.h>
 #include <assert.h>
 #include <time.h>
@@ -93,9 +96,10 @@ int32_t tload(void **addr)
 #define MAP_HUGE_2MB    (21 << MAP_HUGE_SHIFT)
 #define MAP_HUGE_1GB    (30 << MAP_HUGE_SHIFT)
 
+/* Sparse: only the few pages per set that chains and eviction runs touch get faulted in */
 static void *setup_tlbevbuf(void)
 {
-	void *ret = mmap(NULL, EVBSZ, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+	void *ret = mmap(NULL, EVBSZ, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
 	if (ret == MAP_FAILED) {
 		perror("TLBEVB fail!");
 		exit(1);
@@ -118,14 +122,35 @@ static void *setup_cacheevbuf(void)
 
 typedef void *(nexthit_f)(void *, uintptr_t, uintptr_t);
 
+#if 0 // Haswell
+
+/* Next page after cur in L1 dTLB set l1t and sTLB set l2t (l1t must be l2t & 0xf), at the same
+ * page offset */
 static void *tlb_nexthit(void *cur, uintptr_t l1t, uintptr_t l2t)
 {
-	uintptr_t p = (uintptr_t)cur;
-	do {
-		p += PAGESZ;
-	} while (TDL1(p) != l1t || TSL2(p) != l2t);
-	return (void *)p;
+	uintptr_t n = TLLINE((uintptr_t)cur) + 1;
+	assert(l1t == (l2t & 0xf));
+	n += (l2t - n) & 0x7f;
+	return (void *)(n << 12 | ((uintptr_t)cur & (PAGESZ - 1)));
 }
+
+#else // Kabylake
+
+/* Next page after cur in L1 dTLB set l1t and sTLB set l2t, at the same page offset. Splitting
+ * the page number as hi << 7 | lo, TSL2 is lo ^ (hi & 0x7f) and TDL1 is lo & 0xf, so both match
+ * iff hi & 0xf == (l1t ^ l2t) & 0xf and lo == (l2t ^ hi) & 0x7f: one page in every 2048. */
+static void *tlb_nexthit(void *cur, uintptr_t l1t, uintptr_t l2t)
+{
+	uintptr_t n = TLLINE((uintptr_t)cur) + 1;
+	uintptr_t hi = n >> 7;
+	hi += ((l1t ^ l2t) - hi) & 0xf;
+	if ((hi << 7 | ((l2t ^ hi) & 0x7f)) < n)
+		hi += 16;
+	n = hi << 7 | ((l2t ^ hi) & 0x7f);
+	return (void *)(n << 12 | ((uintptr_t)cur & (PAGESZ - 1)));
+}
+
+#endif
 //static void *nexthitl1(void *cur, uintptr_t l1t, uintptr_t l2t)
 //{
 	//uintptr_t p = (uintptr_t)cur;
@@ -194,7 +219,7 @@ static void *cache_nexthit(void *cur, uintptr_t l1t, uintptr_t l2t, uintptr_t l3
 	} while (1);
 	return (void *)p;
 }
-static void *cache_nexthita(void *cur, uintptr_t l1t, uintptr_t l2t, uintptr_t l3t)
+static void *cache_scanhit(void *cur, uintptr_t l1t, uintptr_t l2t, uintptr_t l3t)
 {
 	uintptr_t p = (uintptr_t)cur;
 	do {
@@ -215,6 +240,57 @@ static void *cache_nexthita(void *cur, uintptr_t l1t, uintptr_t l2t, uintptr_t l
 	return (void *)p;
 }
 
+/* Index of the cache eviction buffer: for every CL3 set (which pins down the CL1 and CL2 sets
+ * too), the offsets of the first CIDX_W lines of the buffer in it, in address order */
+#define CIDX_SETS (1 << 13)
+#define CIDX_W (2 * CACHE_W3)
+
+static char *cidx_buf = NULL;
+static size_t cidx_sz = 0;
+static uint32_t cidx[CIDX_SETS][CIDX_W];
+static unsigned cidx_n[CIDX_SETS];
+
+/* l3slice is linear in the address bits, so the slice of a line is that of its page XOR that of
+ * its offset in the page: one l3slice per page does. Checked once, against CL3 on the lines of
+ * the first page. Stops once every set is full. */
+static void cache_index(char *buf, size_t sz)
+{
+	unsigned lsl[PAGESZ >> 6];
+	size_t full = 0;
+	for (unsigned l = 0; l < PAGESZ >> 6; l++)
+		lsl[l] = l3slice((uintptr_t)l << 6);
+	const uintptr_t pa0 = cev2p((uintptr_t)buf);
+	const unsigned psl0 = l3slice(pa0);
+	for (unsigned l = 0; l < PAGESZ >> 6; l++)
+		assert((((CHLINE(pa0) + l) & 0x3ff) | (psl0 ^ lsl[l]) << 10) == CL3(pa0 + (l << 6)));
+	for (size_t off = 0; off < sz && full < CIDX_SETS; off += PAGESZ) {
+		uintptr_t pa = cev2p((uintptr_t)buf + off);
+		unsigned psl = l3slice(pa);
+		for (unsigned l = 0; l < PAGESZ >> 6; l++) {
+			uintptr_t s = ((CHLINE(pa) + l) & 0x3ff) | (psl ^ lsl[l]) << 10;
+			if (cidx_n[s] == CIDX_W)
+				continue;
+			cidx[s][cidx_n[s]++] = off + (l << 6);
+			full += cidx_n[s] == CIDX_W;
+		}
+	}
+	cidx_buf = buf;
+	cidx_sz = sz;
+}
+
+/* Next line after cur in the given cache sets, from the index while it lasts */
+static void *cache_nexthita(void *cur, uintptr_t l1t, uintptr_t l2t, uintptr_t l3t)
+{
+	char *p = cur;
+	if (cidx_buf && p >= cidx_buf && p < cidx_buf + cidx_sz) {
+		for (unsigned i = 0; i < cidx_n[l3t]; i++) {
+			if (cidx_buf + cidx[l3t][i] > p)
+				return cidx_buf + cidx[l3t][i];
+		}
+	}
+	return cache_scanhit(cur, l1t, l2t, l3t);
+}
+
 static inline void cache_evrun(void *base, uintptr_t targ)
 {
 	size_t cnt = 0;
@@ -241,6 +317,18 @@ static inline void cache_evrun(void *base, uintptr_t targ)
 
 /* TLB Prep */
 
+#define LINESZ (64)
+/* A cache line of a chain page; hops only use its first word */
+typedef void *tlb_line[LINESZ / sizeof(void *)];
+
+/* Cache line first of the page holding pg. Pages in one dTLB set agree on VA bits 12-15, so the
+ * L1D and L2 set of a hop only depends on its line within the page: chain builders give every
+ * hop (page i, slot k) a line of its own, so that cache-set conflicts stay out of the timings. */
+static inline tlb_line *tlb_lines(void *pg, unsigned first)
+{
+	return (tlb_line *)((uintptr_t)pg & -(uintptr_t)PAGESZ) + first;
+}
+
 #define TLB_PREPSZ (12)
 
 static void **tlb_prepnaive(void *base, uintptr_t targ)
@@ -251,7 +339,7 @@ static void **tlb_prepnaive(void *base, uintptr_t targ)
 	void *p = base;
 	void **ev[TLB_PREPSZ];
 	for (int i = 0; i < TLB_PREPSZ; i++) {
-		ev[i] = (void **)tlb_nexthit(p, l1t, l2t);
+		ev[i] = (void **)tlb_lines(tlb_nexthit(p, l1t, l2t), i);
 		p = ev[i];
 	}
 	for (int i = 0; i < TLB_PREPSZ - 1; i++) {
@@ -269,74 +357,74 @@ static void **tlb_prepninja(void *base, uintptr_t targ)
 	uintptr_t l1t = TDL1(targ);
 	uintptr_t l2t = TSL2(targ);
 	void *p = base;
-	void **ev[8];
+	tlb_line *ev[8];
 	for (int i = 0; i < 8; i++) {
 		p = tlb_nexthit(p, l1t, l2t);
-		ev[i] = (void **)p;
+		ev[i] = tlb_lines(p, 4 * i);
 	}
-	ev[0][0] = &ev[1][0];
-	ev[0][1] = &ev[6][0];
-	ev[0][2] = &ev[1][2];
-	ev[0][3] = &ev[6][2];
+	ev[0][0][0] = &ev[1][0];
+	ev[0][1][0] = &ev[6][0];
+	ev[0][2][0] = &ev[1][2];
+	ev[0][3][0] = &ev[6][2];
 
-	ev[1][0] = &ev[2][0];
-	ev[1][1] = &ev[4][2];
-	ev[1][2] = &ev[2][2];
+	ev[1][0][0] = &ev[2][0];
+	ev[1][1][0] = &ev[4][2];
+	ev[1][2][0] = &ev[2][2];
 
-	ev[2][0] = &ev[3][0];
-	ev[2][1] = &ev[4][1];
-	ev[2][2] = &ev[3][2];
+	ev[2][0][0] = &ev[3][0];
+	ev[2][1][0] = &ev[4][1];
+	ev[2][2][0] = &ev[3][2];
 
-	ev[3][0] = &ev[4][0];
-	ev[3][1] = &ev[7][1];
-	ev[3][2] = &ev[5][2];
+	ev[3][0][0] = &ev[4][0];
+	ev[3][1][0] = &ev[7][1];
+	ev[3][2][0] = &ev[5][2];
 
-	ev[4][0] = &ev[5][0];
-	ev[4][1] = &ev[5][1];
-	ev[4][2] = &ev[3][1];
+	ev[4][0][0] = &ev[5][0];
+	ev[4][1][0] = &ev[5][1];
+	ev[4][2][0] = &ev[3][1];
 
-	ev[5][0] = &ev[0][1];
-	ev[5][1] = &ev[7][0];
-	ev[5][2] = &ev[0][3];
+	ev[5][0][0] = &ev[0][1];
+	ev[5][1][0] = &ev[7][0];
+	ev[5][2][0] = &ev[0][3];
 
-	ev[6][0] = &ev[2][1];
-	ev[6][1] = &ev[1][1];
-	ev[6][2] = &ev[2][1];
+	ev[6][0][0] = &ev[2][1];
+	ev[6][1][0] = &ev[1][1];
+	ev[6][2][0] = &ev[2][1];
 
-	ev[7][0] = &ev[6][1];
-	ev[7][1] = &ev[0][2];
+	ev[7][0][0] = &ev[6][1];
+	ev[7][1][0] = &ev[0][2];
 
 
-	//ev[0][0] = &ev[1][0];
-	//ev[0][1] = &ev[6][0];
-	//ev[0][2] = &ev[1][2];
+	//ev[0][0][0] = &ev[1][0];
+	//ev[0][1][0] = &ev[6][0];
+	//ev[0][2][0] = &ev[1][2];
 
-	//ev[1][0] = &ev[2][0];
-	//ev[1][1] = &ev[4][2];
-	//ev[1][2] = &ev[2][2];
+	//ev[1][0][0] = &ev[2][0];
+	//ev[1][1][0] = &ev[4][2];
+	//ev[1][2][0] = &ev[2][2];
 
-	//ev[2][0] = &ev[3][0];
-	//ev[2][1] = &ev[4][1];
-	//ev[2][2] = &ev[3][2];
+	//ev[2][0][0] = &ev[3][0];
+	//ev[2][1][0] = &ev[4][1];
+	//ev[2][2][0] = &ev[3][2];
 
-	//ev[3][0] = &ev[4][0];
-	//ev[3][1] = &ev[7][1];
-	//ev[3][2] = &ev[5][0]; // <-- looplink here
+	//ev[3][0][0] = &ev[4][0];
+	//ev[3][1][0] = &ev[7][1];
+	//ev[3][2][0] = &ev[5][0]; // <-- looplink here
 
-	//ev[4][0] = &ev[5][0];
-	//ev[4][1] = &ev[5][1];
-	//ev[4][2] = &ev[3][1];
+	//ev[4][0][0] = &ev[5][0];
+	//ev[4][1][0] = &ev[5][1];
+	//ev[4][2][0] = &ev[3][1];
 
-	//ev[5][0] = &ev[0][1];
-	//ev[5][1] = &ev[7][0];
+	//ev[5][0][0] = &ev[0][1];
+	//ev[5][1][0] = &ev[7][0];
 
-	//ev[6][0] = &ev[2][1];
-	//ev[6][1] = &ev[1][1];
+	//ev[6][0][0] = &ev[2][1];
+	//ev[6][1][0] = &ev[1][1];
 
-	//ev[7][0] = &ev[6][1];
-	//ev[7][1] = &ev[0][2];
+	//ev[7][0][0] = &ev[6][1];
+	//ev[7][1][0] = &ev[0][2];
 
-	return ev[0];
+	return ev[0][0];
 }
 
 #elif 0 // Haswell A* ninja
@@ -346,61 +434,61 @@ static void **tlb_prepninja(void *base, uintptr_t targ)
 	uintptr_t l1t = TDL1(targ);
 	uintptr_t l2t = TSL2(targ);
 	void *p = base;
-	void **ev[7];
+	tlb_line *ev[7];
 	for (int i = 0; i < 7; i++) {
 		p = tlb_nexthit(p, l1t, l2t);
-		ev[i] = (void **)p;
+		ev[i] = tlb_lines(p, 9 * i);
 	}
-	ev[0][0] = &ev[1][0];
-	ev[0][1] = &ev[2][0];
-	ev[0][2] = &ev[3][0];
-	ev[0][3] = &ev[1][2];
-	ev[0][4] = &ev[3][2];
-	ev[0][5] = &ev[5][2];
-	ev[0][6] = &ev[1][7];
-	ev[0][7] = &ev[6][4];
-
-	ev[1][0] = &ev[0][1];
-	ev[1][1] = &ev[4][0];
-	ev[1][2] = &ev[6][0];
-	ev[1][3] = &ev[6][1];
-	ev[1][4] = &ev[0][4];
-	ev[1][5] = &ev[0][5];
-	ev[1][6] = &ev[2][3];
-	ev[1][7] = &ev[2][4];
-	ev[1][8] = &ev[4][4];
-
-	ev[2][0] = &ev[0][2];
-	ev[2][1] = &ev[0][3];
-	ev[2][2] = &ev[1][4];
-	ev[2][3] = &ev[5][3];
-	ev[2][4] = &ev[3][3];
-	ev[2][5] = &ev[1][2]; // <-- looplink here
-
-	ev[3][0] = &ev[1][1];
-	ev[3][1] = &ev[4][2];
-	ev[3][2] = &ev[6][2];
-	ev[3][3] = &ev[0][7];
-	ev[3][4] = &ev[2][5];
-
-	ev[4][0] = &ev[5][0];
-	ev[4][1] = &ev[1][3];
-	ev[4][2] = &ev[2][2];
-	ev[4][3] = &ev[1][6];
-	ev[4][4] = &ev[3][4];
-
-	ev[5][0] = &ev[2][1];
-	ev[5][1] = &ev[4][1];
-	ev[5][2] = &ev[6][3];
-	ev[5][3] = &ev[0][6];
-
-	ev[6][0] = &ev[5][1];
-	ev[6][1] = &ev[3][1];
-	ev[6][2] = &ev[1][5];
-	ev[6][3] = &ev[4][3];
-	ev[6][4] = &ev[1][8];
-
-	return ev[0];
+	ev[0][0][0] = &ev[1][0];
+	ev[0][1][0] = &ev[2][0];
+	ev[0][2][0] = &ev[3][0];
+	ev[0][3][0] = &ev[1][2];
+	ev[0][4][0] = &ev[3][2];
+	ev[0][5][0] = &ev[5][2];
+	ev[0][6][0] = &ev[1][7];
+	ev[0][7][0] = &ev[6][4];
+
+	ev[1][0][0] = &ev[0][1];
+	ev[1][1][0] = &ev[4][0];
+	ev[1][2][0] = &ev[6][0];
+	ev[1][3][0] = &ev[6][1];
+	ev[1][4][0] = &ev[0][4];
+	ev[1][5][0] = &ev[0][5];
+	ev[1][6][0] = &ev[2][3];
+	ev[1][7][0] = &ev[2][4];
+	ev[1][8][0] = &ev[4][4];
+
+	ev[2][0][0] = &ev[0][2];
+	ev[2][1][0] = &ev[0][3];
+	ev[2][2][0] = &ev[1][4];
+	ev[2][3][0] = &ev[5][3];
+	ev[2][4][0] = &ev[3][3];
+	ev[2][5][0] = &ev[1][2]; // <-- looplink here
+
+	ev[3][0][0] = &ev[1][1];
+	ev[3][1][0] = &ev[4][2];
+	ev[3][2][0] = &ev[6][2];
+	ev[3][3][0] = &ev[0][7];
+	ev[3][4][0] = &ev[2][5];
+
+	ev[4][0][0] = &ev[5][0];
+	ev[4][1][0] = &ev[1][3];
+	ev[4][2][0] = &ev[2][2];
+	ev[4][3][0] = &ev[1][6];
+	ev[4][4][0] = &ev[3][4];
+
+	ev[5][0][0] = &ev[2][1];
+	ev[5][1][0] = &ev[4][1];
+	ev[5][2][0] = &ev[6][3];
+	ev[5][3][0] = &ev[0][6];
+
+	ev[6][0][0] = &ev[5][1];
+	ev[6][1][0] = &ev[3][1];
+	ev[6][2][0] = &ev[1][5];
+	ev[6][3][0] = &ev[4][3];
+	ev[6][4][0] = &ev[1][8];
+
+	return ev[0][0];
 }
 
 #else // Kabylake
@@ -410,54 +498,54 @@ static void **tlb_prepninja(void *base, uintptr_t targ)
 	uintptr_t l1t = TDL1(targ);
 	uintptr_t l2t = TSL2(targ);
 	void *p = base;
-	void **ev[9];
+	tlb_line *ev[9];
 	for (int i = 0; i < 9; i++) {
 		p = tlb_nexthit(p, l1t, l2t);
-		ev[i] = (void **)p;
+		ev[i] = tlb_lines(p, 6 * i);
 	}
-	ev[0][0] = &ev[1][0];
-	ev[0][1] = &ev[2][1];
-	ev[0][2] = &ev[2][2];
-	ev[0][3] = &ev[8][0];
-	ev[0][4] = &ev[2][4];
-	ev[0][5] = &ev[4][2];
-
-	ev[1][0] = &ev[2][0];
-	ev[1][1] = &ev[6][0];
-	ev[1][2] = &ev[0][3];
-	ev[1][3] = &ev[5][1];
-	ev[1][4] = &ev[0][5];
-	ev[1][5] = &ev[6][0]; // <-- looplink here
-
-	ev[2][0] = &ev[3][0];
-	ev[2][1] = &ev[1][1];
-	ev[2][2] = &ev[7][0];
-	ev[2][3] = &ev[1][3];
-	ev[2][4] = &ev[3][2];
-	ev[2][5] = &ev[1][5];
-
-	ev[3][0] = &ev[4][0];
-	ev[3][1] = &ev[0][2];
-	ev[3][2] = &ev[8][1];
-
-	ev[4][0] = &ev[5][0];
-	ev[4][1] = &ev[1][2];
-	ev[4][2] = &ev[5][2];
-
-	ev[5][0] = &ev[0][1];
-	ev[5][1] = &ev[7][1];
-	ev[5][2] = &ev[2][1]; // was [2][5]
-
-	ev[6][0] = &ev[3][1];
-	ev[6][1] = &ev[2][3];
-
-	ev[7][0] = &ev[4][1];
-	ev[7][1] = &ev[0][4];
-
-	ev[8][0] = &ev[6][1];
-	ev[8][1] = &ev[1][4];
-
-	return ev[0];
+	ev[0][0][0] = &ev[1][0];
+	ev[0][1][0] = &ev[2][1];
+	ev[0][2][0] = &ev[2][2];
+	ev[0][3][0] = &ev[8][0];
+	ev[0][4][0] = &ev[2][4];
+	ev[0][5][0] = &ev[4][2];
+
+	ev[1][0][0] = &ev[2][0];
+	ev[1][1][0] = &ev[6][0];
+	ev[1][2][0] = &ev[0][3];
+	ev[1][3][0] = &ev[5][1];
+	ev[1][4][0] = &ev[0][5];
+	ev[1][5][0] = &ev[6][0]; // <-- looplink here
+
+	ev[2][0][0] = &ev[3][0];
+	ev[2][1][0] = &ev[1][1];
+	ev[2][2][0] = &ev[7][0];
+	ev[2][3][0] = &ev[1][3];
+	ev[2][4][0] = &ev[3][2];
+	ev[2][5][0] = &ev[1][5];
+
+	ev[3][0][0] = &ev[4][0];
+	ev[3][1][0] = &ev[0][2];
+	ev[3][2][0] = &ev[8][1];
+
+	ev[4][0][0] = &ev[5][0];
+	ev[4][1][0] = &ev[1][2];
+	ev[4][2][0] = &ev[5][2];
+
+	ev[5][0][0] = &ev[0][1];
+	ev[5][1][0] = &ev[7][1];
+	ev[5][2][0] = &ev[2][1]; // was [2][5]
+
+	ev[6][0][0] = &ev[3][1];
+	ev[6][1][0] = &ev[2][3];
+
+	ev[7][0][0] = &ev[4][1];
+	ev[7][1][0] = &ev[0][4];
+
+	ev[8][0][0] = &ev[6][1];
+	ev[8][1][0] = &ev[1][4];
+
+	return ev[0][0];
 }
 
 #endif
@@ -624,25 +712,6 @@ static inline void hamham(void *a1, void *a2)
 //#define CLFLUSH(a) asm volatile ("lfence\nmfence\nclflushopt (%0)" :: "r" (a))
 #define CLFLUSH(a) asm volatile ("lfence\nsfence\nmfence\nclflush (%0)\nlfence\nsfence\nmfence" :: "r" (a))
 
-static struct htiming hamtime(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming fhamtime(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		CLFLUSH(a1);
-		CLFLUSH(a2);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-
 #define PMDCNT (32L)
 #define BASESZ (PMDCNT << (12 + 9 + 1))
 #define NXPMD (512 * 0x1000)
@@ -654,149 +723,7 @@ static struct mmuctl ctx;
 static unsigned long pmds[PMDCNT];
 static uintptr_t tpa[2];
 
-static struct htiming evhamtime(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		cache_evrun(cebuf, tpa[0]);
-		cache_evrun(cebuf, tpa[1]);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-
-static struct htiming itham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		tlb_evrun(tebuf, (uintptr_t)a1, TLB_PREPSZ, tlb_nexthit);
-		tlb_evrun(tebuf, (uintptr_t)a2, TLB_PREPSZ, tlb_nexthit);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming iiham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		mmuctl_invlpg(&ctx, a1);
-		mmuctl_invlpg(&ctx, a2);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming iftham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		CLFLUSH(a1);
-		CLFLUSH(a2);
-		tlb_evrun(tebuf, (uintptr_t)a1, TLB_PREPSZ, tlb_nexthit);
-		tlb_evrun(tebuf, (uintptr_t)a2, TLB_PREPSZ, tlb_nexthit);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming itfham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		tlb_evrun(tebuf, (uintptr_t)a1, TLB_PREPSZ, tlb_nexthit);
-		tlb_evrun(tebuf, (uintptr_t)a2, TLB_PREPSZ, tlb_nexthit);
-		CLFLUSH(a1);
-		CLFLUSH(a2);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming ifiham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		CLFLUSH(a1);
-		CLFLUSH(a2);
-		mmuctl_invlpg(&ctx, a1);
-		mmuctl_invlpg(&ctx, a2);
-		//CLFLUSH(a1);
-		//CLFLUSH(a2);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming icham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		cache_evrun(cebuf, pmds[pmdidx(a1)]);
-		cache_evrun(cebuf, pmds[pmdidx(a2)]);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming ifcham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		CLFLUSH(a1);
-		CLFLUSH(a2);
-		cache_evrun(cebuf, pmds[pmdidx(a1)]);
-		cache_evrun(cebuf, pmds[pmdidx(a2)]);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming itcham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		tlb_evrun(tebuf, (uintptr_t)a1, TLB_PREPSZ, tlb_nexthit);
-		tlb_evrun(tebuf, (uintptr_t)a2, TLB_PREPSZ, tlb_nexthit);
-		cache_evrun(cebuf, pmds[pmdidx(a1)]);
-		cache_evrun(cebuf, pmds[pmdidx(a2)]);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming iicham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		mmuctl_invlpg(&ctx, a1);
-		mmuctl_invlpg(&ctx, a2);
-		cache_evrun(cebuf, pmds[pmdidx(a1)]);
-		cache_evrun(cebuf, pmds[pmdidx(a2)]);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming iftcham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		CLFLUSH(a1);
-		CLFLUSH(a2);
-		tlb_evrun(tebuf, (uintptr_t)a1, TLB_PREPSZ, tlb_nexthit);
-		tlb_evrun(tebuf, (uintptr_t)a2, TLB_PREPSZ, tlb_nexthit);
-		cache_evrun(cebuf, pmds[pmdidx(a1)]);
-		cache_evrun(cebuf, pmds[pmdidx(a2)]);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-static struct htiming ictham(void *a1, void *a2)
-{
-	uint32_t acc = 0;
-	for (int i = 0; i < REPS; i++) {
-		cache_evrun(cebuf, pmds[pmdidx(a1)]);
-		cache_evrun(cebuf, pmds[pmdidx(a2)]);
-		tlb_evrun(tebuf, (uintptr_t)a1, TLB_PREPSZ, tlb_nexthit);
-		tlb_evrun(tebuf, (uintptr_t)a2, TLB_PREPSZ, tlb_nexthit);
-		acc += htime(a1, a2);
-	}
-	return (struct htiming){acc/REPS, 0};
-}
-
-/* PC hamfuncs */
+/* Naive pointer chains */
 
 static void **t1head = NULL;
 static void **t2head = NULL;
@@ -808,139 +735,30 @@ static void **c2head = NULL;
 
 #define rdtscp(v) asm volatile ("lfence\nmfence\nrdtscp\nshl $32,%%rdx\nor %%rdx,%%rax" : "=a" (v) :: "rdx", "rcx")
 
-static struct htiming pc_itham(void *a1, void *a2)
-{
-	uint64_t t0, t;
-	uint32_t acc = 0;
-	//clock_gettime(CLOCK_REALTIME, &it_t0);
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		t1head = qchase(t1head, TLB_PREPSZ);
-		t2head = qchase(t2head, TLB_PREPSZ);
-		acc += htime(a1, a2);
-	}
-	rdtscp(t);
-	//clock_gettime(CLOCK_REALTIME, &it_t);
-	return (struct htiming){acc/REPS, (t - t0)/REPS};
-}
-static struct htiming pc_icham(void *a1, void *a2)
-{
-	uint64_t t0, t;
-	uint32_t acc = 0;
-	//clock_gettime(CLOCK_REALTIME, &ic_t0);
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		c1head = qchase(c1head, CACHE_PREPSZ);
-		c2head = qchase(c2head, CACHE_PREPSZ);
-		acc += htime(a1, a2);
-	}
-	rdtscp(t);
-	//clock_gettime(CLOCK_REALTIME, &ic_t);
-	return (struct htiming){acc/REPS, (t - t0)/REPS};
-}
-static struct htiming pc_itcham(void *a1, void *a2)
-{
-	uint64_t t0, t;
-	uint32_t acc = 0;
-	//clock_gettime(CLOCK_REALTIME, &itc_t0);
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		t1head = qchase(t1head, TLB_PREPSZ);
-		t2head = qchase(t2head, TLB_PREPSZ);
-		c1head = qchase(c1head, CACHE_PREPSZ);
-		c2head = qchase(c2head, CACHE_PREPSZ);
-		acc += htime(a1, a2);
-	}
-	rdtscp(t);
-	//clock_gettime(CLOCK_REALTIME, &itc_t);
-	return (struct htiming){acc/REPS, (t - t0)/REPS};
-}
-static struct htiming pc_ictham(void *a1, void *a2)
-{
-	uint64_t t0, t;
-	uint32_t acc = 0;
-	//clock_gettime(CLOCK_REALTIME, &ict_t0);
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		c1head = qchase(c1head, CACHE_PREPSZ);
-		c2head = qchase(c2head, CACHE_PREPSZ);
-		t1head = qchase(t1head, TLB_PREPSZ);
-		t2head = qchase(t2head, TLB_PREPSZ);
-		acc += htime(a1, a2);
-	}
-	rdtscp(t);
-	//clock_gettime(CLOCK_REALTIME, &ict_t);
-	return (struct htiming){acc/REPS, (t - t0)/REPS};
-}
-/*--TOTALS--*/
-static struct htiming pct_itham(void *a1, void *a2)
-{
-	uint64_t t0, t;
-	//clock_gettime(CLOCK_REALTIME, &it_t0);
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		t1head = qchase(t1head, TLB_PREPSZ);
-		t2head = qchase(t2head, TLB_PREPSZ);
-		hamham(a1, a2);
-	}
-	rdtscp(t);
-	//clock_gettime(CLOCK_REALTIME, &it_t);
-	return (struct htiming){0, (t - t0)/REPS};
-}
-static struct htiming pct_icham(void *a1, void *a2)
-{
-	uint64_t t0, t;
-	//clock_gettime(CLOCK_REALTIME, &ic_t0);
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		c1head = qchase(c1head, CACHE_PREPSZ);
-		c2head = qchase(c2head, CACHE_PREPSZ);
-		hamham(a1, a2);
-	}
-	rdtscp(t);
-	//clock_gettime(CLOCK_REALTIME, &ic_t);
-	return (struct htiming){0, (t - t0)/REPS};
-}
-static struct htiming pct_itcham(void *a1, void *a2)
-{
-	uint64_t t0, t;
-	//clock_gettime(CLOCK_REALTIME, &itc_t0);
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		t1head = qchase(t1head, TLB_PREPSZ);
-		t2head = qchase(t2head, TLB_PREPSZ);
-		c1head = qchase(c1head, CACHE_PREPSZ);
-		c2head = qchase(c2head, CACHE_PREPSZ);
-		hamham(a1, a2);
-	}
-	rdtscp(t);
-	//clock_gettime(CLOCK_REALTIME, &itc_t);
-	return (struct htiming){0, (t - t0)/REPS};
-}
-static struct htiming pct_ictham(void *a1, void *a2)
-{
-	uint64_t t0, t;
-	//clock_gettime(CLOCK_REALTIME, &ict_t0);
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		c1head = qchase(c1head, CACHE_PREPSZ);
-		c2head = qchase(c2head, CACHE_PREPSZ);
-		t1head = qchase(t1head, TLB_PREPSZ);
-		t2head = qchase(t2head, TLB_PREPSZ);
-		hamham(a1, a2);
-	}
-	rdtscp(t);
-	//clock_gettime(CLOCK_REALTIME, &ict_t);
-	return (struct htiming){0, (t - t0)/REPS};
-}
-
-/* Ninja PC hamfuncs */
+/* Ninja chains */
 
 static void *tjbuf = NULL;
 
 static void **t1njhead = NULL;
 static void **t2njhead = NULL;
-#define NINJA_THRESH (1024)
+/* Re-sync on the schedule cache-ninja (gen -R) planned for the Kaby Lake chain, instead of on
+ * every call */
+#define BELIEF_RESYNC (0)
+
+#if (BELIEF_RESYNC)
+/* The chain's NINJA_INIT and NINJA_STEP, and its schedule */
+#include "ninja_resync.h"
+#ifdef NINJA_RS_NNODES
+#error "ninja_resync.h holds a re-sync table, which needs every round timed; ptham follows only the fixed schedules gen -R emits when there is none"
+#endif
+/* Rounds chased between full re-syncs; a period of 0 means the chain forgets foreign insertions
+ * by itself, so only the first call re-syncs */
+#define NINJA_THRESH (NINJA_RS_PERIOD ? (size_t)NINJA_RS_PERIOD : SIZE_MAX)
+#define NINJA_PREP (NINJA_RS_PREP)
+#define NINJA_START (NINJA_RS_LEADIN + NINJA_RS_SKIP * NINJA_STEP)
+#else
+/* Rounds chased between full re-syncs; REPS re-syncs on every call, as for the data in results/ */
+#define NINJA_THRESH (REPS)
 
 // A* ninja
 //#define NINJA_INIT (9)
@@ -953,120 +771,218 @@ static void **t2njhead = NULL;
 #define NINJA_INIT (18)
 #define NINJA_STEP (4)
 
-#define NINJA_BOILERPLATE \
-static void **c1 = NULL; \
-static void **c2 = NULL; \
-size_t cnt = NINJA_THRESH; \
-if (cnt >= NINJA_THRESH) { \
-	cnt = 0; \
-	tlb_evrun(tebuf, (uintptr_t)a1, TLB_PREPSZ, tlb_nexthit); \
-	tlb_evrun(tebuf, (uintptr_t)a2, TLB_PREPSZ, tlb_nexthit); \
-	c1 = qchase(t1njhead, NINJA_INIT); \
-	c2 = qchase(t2njhead, NINJA_INIT); \
+#define NINJA_PREP (TLB_PREPSZ)
+#define NINJA_START (NINJA_INIT)
+#endif
+
+/* Hammer strategies
+ *
+ * A hamfunc hammers the two targets for REPS rounds and is put together from four parts: a TLB
+ * evictor, a cache evictor, the order these two run in before each round, and a timing mode. An
+ * evictor <name> of either kind is a pair of inline functions, tev_<name>_sync or cev_<name>_sync
+ * run once per call and tev_<name> or cev_<name> run before every round. HAMGEN pastes one
+ * choice of each into a hamfunc of its own, so the hammer loop is left without any dispatch. */
+
+/* Per-hamfunc state, for the evictors that keep any */
+struct hstate {
+	void **c1;
+	void **c2;
+	size_t cnt;
+};
+
+#define HSTATE_INIT {NULL, NULL, NINJA_THRESH}
+
+/* TLB evictors */
+
+/* none: leave the translations alone */
+static inline void tev_none_sync(struct hstate *s, void *a1, void *a2) {}
+static inline void tev_none(struct hstate *s, void *a1, void *a2, int i) {}
+
+/* evrun: access a fresh naive eviction set of each target */
+static inline void tev_evrun_sync(struct hstate *s, void *a1, void *a2) {}
+static inline void tev_evrun(struct hstate *s, void *a1, void *a2, int i)
+{
+	tlb_evrun(tebuf, (uintptr_t)a1, TLB_PREPSZ, tlb_nexthit);
+	tlb_evrun(tebuf, (uintptr_t)a2, TLB_PREPSZ, tlb_nexthit);
 }
 
-static struct htiming ntpc_itham(void *a1, void *a2)
+/* invlpg: have mmuctl drop the translations */
+static inline void tev_invlpg_sync(struct hstate *s, void *a1, void *a2) {}
+static inline void tev_invlpg(struct hstate *s, void *a1, void *a2, int i)
 {
-	NINJA_BOILERPLATE
-
-	uint64_t t0, t;
-	uint32_t acc = 0;
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		c1 = qchase(c1, NINJA_STEP);
-		c2 = qchase(c2, NINJA_STEP);
-		acc += htime(a1, a2);
-	}
-	rdtscp(t);
-	cnt += REPS;
-	return (struct htiming){acc/REPS, (t - t0)/REPS};
+	mmuctl_invlpg(&ctx, a1);
+	mmuctl_invlpg(&ctx, a2);
 }
-static struct htiming ntpct_itham(void *a1, void *a2)
+
+/* chain: chase the naive pointer chains round */
+static inline void tev_chain_sync(struct hstate *s, void *a1, void *a2) {}
+static inline void tev_chain(struct hstate *s, void *a1, void *a2, int i)
 {
-	NINJA_BOILERPLATE
-
-	uint64_t t0, t;
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		c1 = qchase(c1, NINJA_STEP);
-		c2 = qchase(c2, NINJA_STEP);
-		hamham(a1, a2);
-	}
-	rdtscp(t);
-	cnt += REPS;
-	return (struct htiming){0, (t - t0)/REPS};
+	t1head = qchase(t1head, TLB_PREPSZ);
+	t2head = qchase(t2head, TLB_PREPSZ);
 }
-static struct htiming ntpc_itcham(void *a1, void *a2)
+
+/* ninja: step along the ninja chains, re-syncing them every NINJA_THRESH rounds */
+static inline void tev_ninja_sync(struct hstate *s, void *a1, void *a2)
 {
-	NINJA_BOILERPLATE
-
-	uint64_t t0, t;
-	uint32_t acc = 0;
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		c1 = qchase(c1, NINJA_STEP);
-		c2 = qchase(c2, NINJA_STEP);
-		c1head = qchase(c1head, CACHE_PREPSZ);
-		c2head = qchase(c2head, CACHE_PREPSZ);
-		acc += htime(a1, a2);
+	if (s->cnt >= NINJA_THRESH) {
+		s->cnt = 0;
+		tlb_evrun(tebuf, (uintptr_t)a1, NINJA_PREP, tlb_nexthit);
+		tlb_evrun(tebuf, (uintptr_t)a2, NINJA_PREP, tlb_nexthit);
+		s->c1 = qchase(t1njhead, NINJA_START);
+		s->c2 = qchase(t2njhead, NINJA_START);
 	}
-	rdtscp(t);
-	cnt += REPS;
-	return (struct htiming){acc/REPS, (t - t0)/REPS};
+	s->cnt += REPS;
 }
-static struct htiming ntpct_itcham(void *a1, void *a2)
+static inline void tev_ninja(struct hstate *s, void *a1, void *a2, int i)
 {
-	NINJA_BOILERPLATE
-
-	uint64_t t0, t;
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		c1 = qchase(c1, NINJA_STEP);
-		c2 = qchase(c2, NINJA_STEP);
-		c1head = qchase(c1head, CACHE_PREPSZ);
-		c2head = qchase(c2head, CACHE_PREPSZ);
-		hamham(a1, a2);
-	}
-	rdtscp(t);
-	cnt += REPS;
-	return (struct htiming){0, (t - t0)/REPS};
+	s->c1 = qchase(s->c1, NINJA_STEP);
+	s->c2 = qchase(s->c2, NINJA_STEP);
 }
-static struct htiming ntpc_ictham(void *a1, void *a2)
+
+/* Cache evictors */
+
+/* none: leave the caches alone */
+static inline void cev_none_sync(struct hstate *s, void *a1, void *a2) {}
+static inline void cev_none(struct hstate *s, void *a1, void *a2, int i) {}
+
+/* flush: clflush the targets themselves */
+static inline void cev_flush_sync(struct hstate *s, void *a1, void *a2) {}
+static inline void cev_flush(struct hstate *s, void *a1, void *a2, int i)
 {
-	NINJA_BOILERPLATE
-
-	uint64_t t0, t;
-	uint32_t acc = 0;
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		c1head = qchase(c1head, CACHE_PREPSZ);
-		c2head = qchase(c2head, CACHE_PREPSZ);
-		c1 = qchase(c1, NINJA_STEP);
-		c2 = qchase(c2, NINJA_STEP);
-		acc += htime(a1, a2);
-	}
-	rdtscp(t);
-	cnt += REPS;
-	return (struct htiming){acc/REPS, (t - t0)/REPS};
+	CLFLUSH(a1);
+	CLFLUSH(a2);
 }
-static struct htiming ntpct_ictham(void *a1, void *a2)
+
+/* data: access a fresh eviction set of each target; the reference for flush */
+static inline void cev_data_sync(struct hstate *s, void *a1, void *a2) {}
+static inline void cev_data(struct hstate *s, void *a1, void *a2, int i)
 {
-	NINJA_BOILERPLATE
-
-	uint64_t t0, t;
-	rdtscp(t0);
-	for (int i = 0; i < REPS; i++) {
-		c1head = qchase(c1head, CACHE_PREPSZ);
-		c2head = qchase(c2head, CACHE_PREPSZ);
-		c1 = qchase(c1, NINJA_STEP);
-		c2 = qchase(c2, NINJA_STEP);
-		hamham(a1, a2);
-	}
-	rdtscp(t);
-	cnt += REPS;
-	return (struct htiming){0, (t - t0)/REPS};
+	cache_evrun(cebuf, tpa[0]);
+	cache_evrun(cebuf, tpa[1]);
+}
+
+/* pte: access a fresh eviction set of the PTE of each target */
+static inline void cev_pte_sync(struct hstate *s, void *a1, void *a2) {}
+static inline void cev_pte(struct hstate *s, void *a1, void *a2, int i)
+{
+	cache_evrun(cebuf, pmds[pmdidx(a1)]);
+	cache_evrun(cebuf, pmds[pmdidx(a2)]);
 }
 
+/* fpte: flush, then pte */
+static inline void cev_fpte_sync(struct hstate *s, void *a1, void *a2) {}
+static inline void cev_fpte(struct hstate *s, void *a1, void *a2, int i)
+{
+	cev_flush(s, a1, a2, i);
+	cev_pte(s, a1, a2, i);
+}
+
+/* chain: chase the pointer chains of the PTE eviction sets round */
+static inline void cev_chain_sync(struct hstate *s, void *a1, void *a2) {}
+static inline void cev_chain(struct hstate *s, void *a1, void *a2, int i)
+{
+	c1head = qchase(c1head, CACHE_PREPSZ);
+	c2head = qchase(c2head, CACHE_PREPSZ);
+}
+
+/* Orders */
+#define HAM_ORDER_tc(tev, cev) tev; cev
+#define HAM_ORDER_ct(tev, cev) cev; tev
+
+/* Timing modes: ham times each round's accesses to the targets, pc also times the whole call
+ * (evictions included) and pct only the whole call, leaving the rounds untimed */
+#define HAM_EACH_ham (1)
+#define HAM_TOTAL_ham (0)
+#define HAM_EACH_pc (1)
+#define HAM_TOTAL_pc (1)
+#define HAM_EACH_pct (0)
+#define HAM_TOTAL_pct (1)
+
+/* Everything above, for HAM_CROSS to pick from; a new part only needs its name added here */
+#define HAM_TIMINGS(X, ...) X(__VA_ARGS__, ham) X(__VA_ARGS__, pc) X(__VA_ARGS__, pct)
+#define HAM_ORDERS(X, ...) X(__VA_ARGS__, tc) X(__VA_ARGS__, ct)
+#define HAM_TLBEVS(X, ...) X(__VA_ARGS__, none) X(__VA_ARGS__, evrun) X(__VA_ARGS__, invlpg) \
+                           X(__VA_ARGS__, chain) X(__VA_ARGS__, ninja)
+#define HAM_CACHEEVS(X, ...) X(__VA_ARGS__, none) X(__VA_ARGS__, flush) X(__VA_ARGS__, data) \
+                             X(__VA_ARGS__, pte) X(__VA_ARGS__, fpte) X(__VA_ARGS__, chain)
+
+/* G(m, o, t, c) for every timing mode, order, TLB evictor and cache evictor */
+#define HAM_CROSS1(G, m) HAM_ORDERS(HAM_CROSS2, G, m)
+#define HAM_CROSS2(G, m, o) HAM_TLBEVS(HAM_CROSS3, G, m, o)
+#define HAM_CROSS3(G, m, o, t) HAM_CACHEEVS(HAM_CROSS4, G, m, o, t)
+#define HAM_CROSS4(G, m, o, t, c) G(m, o, t, c)
+#define HAM_CROSS(G) HAM_TIMINGS(HAM_CROSS1, G)
+
+#define HAMF(m, o, t, c) ham_##m##_##o##_##t##_##c
+
+#define HAMGEN(m, o, t, c) \
+static struct htiming HAMF(m, o, t, c)(void *a1, void *a2) \
+{ \
+	static struct hstate s = HSTATE_INIT; \
+	uint64_t t0 = 0, t1 = 0; \
+	uint32_t acc = 0; \
+	HAM_ORDER_##o(tev_##t##_sync(&s, a1, a2), cev_##c##_sync(&s, a1, a2)); \
+	if (HAM_TOTAL_##m) \
+		rdtscp(t0); \
+	for (int i = 0; i < REPS; i++) { \
+		HAM_ORDER_##o(tev_##t(&s, a1, a2, i), cev_##c(&s, a1, a2, i)); \
+		if (HAM_EACH_##m) \
+			acc += htime(a1, a2); \
+		else \
+			hamham(a1, a2); \
+	} \
+	if (HAM_TOTAL_##m) \
+		rdtscp(t1); \
+	return (struct htiming){acc/REPS, (t1 - t0)/REPS}; \
+}
+
+HAM_CROSS(HAMGEN)
+
+struct hamstrat {
+	const char *name;
+	hamtime_f *f;
+	const char *ord;
+	const char *tev;
+	const char *cev;
+};
+
+#define HAMENT(m, o, t, c) {#m "_" #o "_" #t "_" #c, HAMF(m, o, t, c), #o, #t, #c},
+static const struct hamstrat hamstrats[] = {
+	HAM_CROSS(HAMENT)
+};
+#define NHAMSTRATS (sizeof(hamstrats) / sizeof(hamstrats[0]))
+
+/* The hamfuncs so far, by name */
+#define hamtime      HAMF(ham, tc, none, none)
+#define fhamtime     HAMF(ham, tc, none, flush)
+#define evhamtime    HAMF(ham, tc, none, data)
+#define itham        HAMF(ham, tc, evrun, none)
+#define iiham        HAMF(ham, tc, invlpg, none)
+#define iftham       HAMF(ham, ct, evrun, flush)
+#define itfham       HAMF(ham, tc, evrun, flush)
+#define ifiham       HAMF(ham, ct, invlpg, flush)
+#define icham        HAMF(ham, tc, none, pte)
+#define ifcham       HAMF(ham, tc, none, fpte)
+#define itcham       HAMF(ham, tc, evrun, pte)
+#define iicham       HAMF(ham, tc, invlpg, pte)
+#define itfcham      HAMF(ham, tc, evrun, fpte)
+#define ictham       HAMF(ham, ct, evrun, pte)
+#define pc_itham     HAMF(pc, tc, chain, none)
+#define pc_icham     HAMF(pc, tc, none, chain)
+#define pc_itcham    HAMF(pc, tc, chain, chain)
+#define pc_ictham    HAMF(pc, ct, chain, chain)
+#define pct_itham    HAMF(pct, tc, chain, none)
+#define pct_icham    HAMF(pct, tc, none, chain)
+#define pct_itcham   HAMF(pct, tc, chain, chain)
+#define pct_ictham   HAMF(pct, ct, chain, chain)
+#define ntpc_itham   HAMF(pc, tc, ninja, none)
+#define ntpct_itham  HAMF(pct, tc, ninja, none)
+#define ntpc_itcham  HAMF(pc, tc, ninja, chain)
+#define ntpct_itcham HAMF(pct, tc, ninja, chain)
+#define ntpc_ictham  HAMF(pc, ct, ninja, chain)
+#define ntpct_ictham HAMF(pct, ct, ninja, chain)
+
 /* Utils & showtime! */
 
 #define PRREP (8192)
@@ -1086,6 +1002,42 @@ static void prham(void *p1, void *p2, hamtime_f hf)
 	fputc('\n', stderr);
 }
 
+/* Whether the glob pattern selects h. A CT order with one evictor set to none is the same
+ * hamfunc as its TC twin, so it is only selected when named in full. */
+static int prmatch(const struct hamstrat *h, const char *pat)
+{
+	int twin = !strcmp(h->ord, "ct") && (!strcmp(h->tev, "none") || !strcmp(h->cev, "none"));
+	return !fnmatch(pat, h->name, 0) && (!twin || !strcmp(pat, h->name));
+}
+
+/* Returns the first pattern that selects no hamfunc, or NULL */
+static const char *prunmatched(int npat, char *pat[])
+{
+	for (int j = 0; j < npat; j++) {
+		size_t i = 0;
+		while (i < NHAMSTRATS && !prmatch(&hamstrats[i], pat[j]))
+			i++;
+		if (i == NHAMSTRATS)
+			return pat[j];
+	}
+	return NULL;
+}
+
+/* prham every hamfunc selected by one of the glob patterns */
+static void prsel(int npat, char *pat[], void *p1, void *p2)
+{
+	for (size_t i = 0; i < NHAMSTRATS; i++) {
+		const struct hamstrat *h = &hamstrats[i];
+		for (int j = 0; j < npat; j++) {
+			if (!prmatch(h, pat[j]))
+				continue;
+			fprintf(stderr, "%s timing run\n", h->name);
+			prham(p1, p2, h->f);
+			break;
+		}
+	}
+}
+
 static inline long usecdiff(struct timespec *t0, struct timespec *t)
 {
 	long usec = (t->tv_nsec - t0->tv_nsec) / 1000;
@@ -1103,6 +1055,173 @@ static inline long cyclediff(uint64_t t0, uint64_t t)
 #define ARVAL1 (0)
 #define ARVAL2 (3)
 
+/* DRAM bank conflicts
+ *
+ * A hammer pair wants PTEs in different rows of the same bank. Time the page walks of every
+ * candidate pair with both translations and PTE lines evicted (iicham): the median of a pair
+ * whose PTEs conflict in the row buffer lands in a slower cluster, split off at the Otsu cut. */
+
+#define BK_ROUNDS (4)     /* medians per pair, one per column of bkmap.txt */
+#define BK_SAMPLES (16)   /* iicham calls per round */
+#define BK_MINGAP (16)    /* cycles between the cluster means for there to be a slow one at all */
+#define BK_TRIES (8)      /* target buffers to try */
+#define BK_LOBIT (12)     /* bank functions are looked for among masks of one or two PA bits */
+#define BK_HIBIT (40)
+
+#define BK_NPAIRS (PMDCNT * (PMDCNT - 1) / 2)
+
+struct bkpair {
+	unsigned i, j;
+	uint32_t t;               /* median of the round medians, which the clusters are made of */
+	uint32_t r[BK_ROUNDS];
+};
+
+static int u32cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int bkcmp(const void *a, const void *b)
+{
+	return u32cmp(&((const struct bkpair *)a)->t, &((const struct bkpair *)b)->t);
+}
+
+static void bktime(struct bkpair *p, void *a1, void *a2)
+{
+	uint32_t r[BK_SAMPLES], m[BK_ROUNDS];
+	for (int q = 0; q < BK_ROUNDS; q++) {
+		for (int k = 0; k < BK_SAMPLES; k++)
+			r[k] = iicham(a1, a2).ham;
+		qsort(r, BK_SAMPLES, sizeof(r[0]), u32cmp);
+		p->r[q] = m[q] = r[BK_SAMPLES / 2];
+	}
+	qsort(m, BK_ROUNDS, sizeof(m[0]), u32cmp);
+	p->t = (m[(BK_ROUNDS - 1) / 2] + m[BK_ROUNDS / 2]) / 2;
+}
+
+/* Index of the first slow pair in bp[0..n-1] (sorted) at the Otsu cut, and the cluster means */
+static size_t bkotsu(const struct bkpair *bp, size_t n, double *mu0, double *mu1)
+{
+	double tot = 0, acc = 0, best = -1;
+	size_t cut = n;
+	for (size_t k = 0; k < n; k++)
+		tot += bp[k].t;
+	*mu0 = tot / n;
+	*mu1 = 0;
+	for (size_t k = 1; k < n; k++) {
+		acc += bp[k-1].t;
+		if (bp[k].t == bp[k-1].t)
+			continue;
+		double m0 = acc / k, m1 = (tot - acc) / (n - k);
+		double bv = (double)k * (n - k) * (m1 - m0) * (m1 - m0);
+		if (bv > best) {
+			best = bv;
+			cut = k;
+			*mu0 = m0;
+			*mu1 = m1;
+		}
+	}
+	return cut;
+}
+
+/* Masks that agree on the PTE pages of every conflicting pair and tell apart some other pair
+ * (DRAMA style): candidates for the bank functions, as far as these PTE pages can tell */
+static void bkfuncs(const struct bkpair *bp, size_t cut)
+{
+	fputs("Bank function candidates:", stderr);
+	for (int b0 = BK_LOBIT; b0 < BK_HIBIT; b0++) {
+		for (int b1 = b0; b1 < BK_HIBIT; b1++) {
+			uint64_t m = 1UL << b0 | 1UL << b1;
+			int ok = 1, splits = 0;
+			for (size_t k = 0; k < BK_NPAIRS && ok; k++) {
+				int d = xbs64((pmds[bp[k].i] ^ pmds[bp[k].j]) & m);
+				if (k >= cut)
+					ok = !d;
+				else
+					splits |= d;
+			}
+			if (!ok || !splits)
+				continue;
+			if (b0 == b1)
+				fprintf(stderr, " %d", b0);
+			else
+				fprintf(stderr, " %d^%d", b0, b1);
+		}
+	}
+	fputc('\n', stderr);
+}
+
+/* Pick the conflicting pair of targets closest to the slow cluster's mean, so that a single
+ * outlier does not decide it; the conflicting pairs also go to stdout in the format of bkmap.txt
+ * (their round medians). Returns -1 if there is no slow cluster to speak of. */
+static int bkselect(size_t *t1, size_t *t2)
+{
+	static struct bkpair bp[BK_NPAIRS];
+	size_t n = 0;
+	double mu0, mu1, best;
+	size_t pick;
+
+	for (unsigned i = 0; i < PMDCNT; i++) {
+		for (unsigned j = i + 1; j < PMDCNT; j++) {
+			bp[n].i = i;
+			bp[n].j = j;
+			bktime(&bp[n], base + i * NXPMD + ARVAL1 * PAGESZ, base + j * NXPMD + ARVAL2 * PAGESZ);
+			n++;
+		}
+	}
+	qsort(bp, n, sizeof(bp[0]), bkcmp);
+	size_t cut = bkotsu(bp, n, &mu0, &mu1);
+	fprintf(stderr, "Bank conflicts: %zu of %zu pairs, %.1f vs %.1f cycles\n", n - cut, n, mu1, mu0);
+	if (cut == n || mu1 - mu0 < BK_MINGAP)
+		return -1;
+
+	for (size_t k = cut; k < n; k++) {
+		unsigned long a = pmds[bp[k].i] & 0x3ff000, b = pmds[bp[k].j] & 0x3ff000;
+		printf("%lx:%lx:", a < b ? a : b, a < b ? b : a);
+		for (int q = 0; q < BK_ROUNDS; q++)
+			printf(" %u", bp[k].r[q]);
+		putchar('\n');
+	}
+	fflush(stdout);
+	bkfuncs(bp, cut);
+
+	pick = cut;
+	best = -1;
+	for (size_t k = cut; k < n; k++) {
+		double d = bp[k].t > mu1 ? bp[k].t - mu1 : mu1 - bp[k].t;
+		if (best < 0 || d < best) {
+			best = d;
+			pick = k;
+		}
+	}
+	*t1 = bp[pick].i;
+	*t2 = bp[pick].j;
+	return 0;
+}
+
+/* Map a target buffer and find the page tables of its PMDCNT 2MiB regions. Earlier buffers are
+ * left mapped, so that their page tables are not simply handed out again. */
+static int setup_targets(pid_t pid)
+{
+	struct mmuctl_ptwalk ptw;
+
+	if ((base = mmap(NULL, BASESZ, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0)) == MAP_FAILED) {
+		perror("Error mapping target buf");
+		return 1;
+	}
+	base = (char *)((((uintptr_t)base >> (12 + 9)) + 1) << (12 + 9));
+
+	for (size_t i = 0; i < PMDCNT; i++) {
+		if (mmuctl_resolve(&ctx, &ptw, base + i * NXPMD, pid)) {
+			perror("Error resolving addr");
+			return 1;
+		}
+		pmds[i] = ptw.pmd & PFNBITS;
+	}
+	return 0;
+}
+
 
 int main(int argc, char *argv[])
 {
@@ -1114,6 +1233,12 @@ int main(int argc, char *argv[])
 	char *t1p, *t2p;
 	uintptr_t ca1, ca2;
 
+	const char *bad = prunmatched(argc - 1, argv + 1);
+	if (bad) {
+		fprintf(stderr, "No hamfunc matches %s\n", bad);
+		return 4;
+	}
+
 	fprintf(stderr, "PID: %u\n", pid);
 	fprintf(stderr, "REPS: %u; TLB ESZ: %u; CACHE ESZ: %u\n", REPS, TLB_PREPSZ, CACHE_PREPSZ);
 
@@ -1139,28 +1264,20 @@ int main(int argc, char *argv[])
 	        //ptw.pgd, ptw.p4d, ptw.pud, ptw.pmd, ptw.pte);
 	//mmuctl_read(&ctx, &cevpa, 8, ptw.pgd & PFNBITS
 	cevpa = ptw.pud & PFNBITS;
+	cache_index(cebuf, 1*_G);
 	//fprintf(stderr, "CEVPA: %lx\n", cevpa);
 
-	if ((base = mmap(NULL, BASESZ, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0)) == MAP_FAILED) {
-		perror("Error mapping target buf");
-		return 1;
-	}
-	base = (char *)((((uintptr_t)base >> (12 + 9)) + 1) << (12 + 9));
-
-	for (size_t i = 0; i < PMDCNT; i++) {
-		if (mmuctl_resolve(&ctx, &ptw, base + i * NXPMD, pid)) {
-			perror("Error resolving addr");
-			return 1;
+	for (int try = 0; ; try++) {
+		if (try == BK_TRIES) {
+			fputs("No bank conflicts among the targets, giving up\n", stderr);
+			return 3;
 		}
-		pmds[i] = ptw.pmd & PFNBITS;
-		printf("%lx\n", pmds[i] & 0x3ff000);
-	}
-
-	fflush(stdout);
-	while (scanf("%zu %zu", &t1, &t2) != 2) {
-		perror("Bad input");
+		if (setup_targets(pid))
+			return 1;
+		if (!bkselect(&t1, &t2))
+			break;
+		fputs("No bank conflicts among the targets, remapping...\n", stderr);
 	}
-	(void)getchar();
 	t1p = base + t1 * NXPMD + ARVAL1 * PAGESZ;
 	t2p = base + t2 * NXPMD + ARVAL2 * PAGESZ;
 	ca1 = pteaddr(t1p, pmds[t1]);
@@ -1246,6 +1363,12 @@ int main(int argc, char *argv[])
 	size_t it = 10;
 
 	do {
+	if (argc > 1) {
+		fputc('\n', stderr);
+		prsel(argc - 1, argv + 1, t1p, t2p);
+		continue;
+	}
+
 	//fputc('\n', stderr);
 	//fputs("Naive(T) timing run\n", stderr);
 	//prham(t1p, t2p, itham);
@@ -1289,8 +1412,8 @@ int main(int argc, char *argv[])
 	//fprintf(stderr, "%ld cycles/rep\n", cyclediff(itc_tsc0, itc_tsc));
 	//fputs("Naive(I+C) timing run\n", stderr);
 	//prham(t1p, t2p, iicham);
-	//fputs("Naive(F+T+C) timing run\n", stderr);
-	//prham(t1p, t2p, iftcham);
+	//fputs("Naive(T+F+C) timing run\n", stderr);
+	//prham(t1p, t2p, itfcham);
 
 	//fputc('\n', stderr);
 	//fputs("Naive(C+T) timing run\n", stderr);
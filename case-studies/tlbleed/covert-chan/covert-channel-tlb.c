@@ -1,6 +1,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -14,9 +15,13 @@
 
 #include "profile.h"
 #include "common.h"
+#include "fec.h"
+#include "../thresh.h"
 
 
 // THRESHOLD TWEAKS
+// (starting values only: the receiver calibrates them at startup and tracks drift, unless given
+// a fixed threshold on the command line)
 
 #define TIMETHRESH_NAIVE (500)
 #define TIMETHRESH_NINJA (108)
@@ -77,15 +82,38 @@ static const int use_setsize = 12; // !! uarch dependency: tlb set size, set at
 /* These are TLB set number used for specific communication purposes. */
 #define SET_SYNC_R_READY_DATA  0 /* receiver is ready to receive: set by receiver, probed by transmitter */
 #define SET_SYNC_T_READY_DATA  1 /* data is available in tlb sets: set by transmitter, probed by receiver */
-#define SET_DATA  2              /* tlb set number where data bits start */
-#define WORDLEN 32               /* number of bits transmitted in parallel */
+#define SET_DATA  2              /* start of the fixed layout; data bits now go to the sets in chset[] */
+#define WORDLEN 32               /* default number of bits transmitted in parallel */
+#define WORDLEN_MAX 64           /* words are uint64_t */
 #define SET_SYNC_R_READY_REQ  (SET_DATA+WORDLEN)
 #define SET_SYNC_T_READY_REQ  (SET_DATA+WORDLEN+1)
 #define SET_REQ               (SET_DATA+WORDLEN+2)
 #define SET_SAFE              (SET_DATA+WORDLEN+3)
 #define REQLEN                (24)
 
-#define REDUNDANCY     16
+/* FEC framing (USE_FEC): a block is FEC_DEPTH Reed-Solomon (FEC_N, FEC_K) codewords of bytes,
+ * one byte lane of the data sets each, sent as FEC_N words. Bits read too close to the threshold
+ * (within 1/FEC_SOFT of the gap between the class means) mark their byte as an erasure. */
+#define FEC_N      32
+#define FEC_K      24
+#define FEC_DEPTH  (wordlen/8)
+#define FEC_DEPTH_MAX (WORDLEN_MAX/8)
+#define FEC_SOFT   4
+#define FEC_BLOCKS 4000
+
+/* Length of a run, in frames (blocks with USE_FEC), and words per frame */
+#ifdef USE_FEC
+#define FRAMES      FEC_BLOCKS
+#define FRAME_WORDS FEC_N
+#else
+#define FRAMES      100000
+#define FRAME_WORDS 1
+#endif
+
+/* Data channels, picked by alloc_sets(): bit k of a word goes to tlb set chset[k] */
+static int chset[HARDWARESETS];
+static int nchan;
+static int wordlen = WORDLEN;
 
 
 /* this is an area in virtual address space where everything happens. we allocate memory
@@ -114,17 +142,23 @@ static inline uintptr_t TSL2(uintptr_t va)
 
 #define WAYBIT (16)
 
+/* L1 dTLB set of the pages of each (sTLB) set; any of the 16 goes with any sTLB set, as long as
+ * the page number's bits 7-10 make up the difference (see calc_pageno) */
+static uint8_t chdl1[HARDWARESETS];
+
 //static int set_offset = -1;
 //#define calc_pageno(set, i) (i * (1ULL << 16) + (((set)+set_offset) % HARDWARESETS))
-#define calc_pageno(set, i) (i * (1ULL << WAYBIT) + set)
+// page i of tlb set 'set': TSL2 = lo ^ (hi & 0x7f) = set and TDL1 = lo & 0xf = chdl1[set], with
+// lo the low 7 bits of the page number. with chdl1[set] == set & 0xf this is i << WAYBIT | set.
+#define calc_pageno(set, i) ((uint64_t)(i) << WAYBIT | (uint64_t)(((set) ^ chdl1[set]) & 0xf) << 7 \
+                             | ((set) & 0x70) | chdl1[set])
 
-void allocate_buffer(int *fdarray, volatile char *firstpage_d)
+// map the pages of one tlb set, as calc_pageno() has them now
+static void map_set(int *fdarray, volatile char *firstpage_d, int set)
 {
-	volatile char *target_d, *target_i;
+	volatile char *target_d;
 
-    int set, i;
-    for(set = 0; set < SETLIMIT; set++) {
-        for(i = 0; i < SETSIZE_MAX; i++) {
+        for(int i = 0; i < SETSIZE_MAX; i++) {
             unsigned long long p = calc_pageno(set, i);
             target_d = (void *) (firstpage_d+p*PAGE);
     		char *ret;
@@ -137,6 +171,14 @@ void allocate_buffer(int *fdarray, volatile char *firstpage_d)
     		}
     		if(ret != (volatile char *) target_d) { fprintf(stderr, "Wrong mapping\n"); exit(1); }
 	    }
+}
+
+void allocate_buffer(int *fdarray, volatile char *firstpage_d)
+{
+    int set;
+    for(set = 0; set < SETLIMIT; set++) {
+        chdl1[set] = set & 0xf;
+        map_set(fdarray, firstpage_d, set);
     }
 }
 
@@ -293,12 +335,13 @@ asm volatile (
 }
 #endif
 
+static struct thresh ev_th = {DT_THRESH, {0, 0}, 0};
+
 static int _evset(uint64_t set)
 {
     uint32_t dt = _tevset(set);
     //printf("%u\n", dt);
-    if(dt <= DT_THRESH) return 0;
-    return 1; // tlb miss
+    return thresh_slow(&ev_th, dt); // 1: tlb miss
 }
 
 static void _touchset(uint64_t set)
@@ -313,7 +356,9 @@ asm volatile (
 
 #define TM_THRESH (50)
 
-static int _timeset(uint64_t set)
+static struct thresh tm_th = {TM_THRESH, {0, 0}, 0};
+
+static uint32_t _ttimeset(uint64_t set)
 {
     uint32_t tim;
 asm volatile (
@@ -327,7 +372,12 @@ asm volatile (
 "sub %%edi, %%eax\n"
     : "=a" (tim) : "c" (calc_probe(set, 0)) : "rdi", "rdx", "cc"
 );
-    return tim > TM_THRESH;
+    return tim;
+}
+
+static int _timeset(uint64_t set)
+{
+    return thresh_slow(&tm_th, _ttimeset(set));
 }
 
 
@@ -335,13 +385,20 @@ asm volatile (
 #define MTH (1)
 #define MEV_THRESH (180)
 
-static int _mevset(uint64_t set)
+static struct thresh mev_th = {MEV_THRESH, {0, 0}, 0};
+
+static uint32_t _tmevset(uint64_t set)
 {
-    uint64_t t = 0;
+    uint32_t t = 0;
     for (int i = 0; i < MEV; i++) {
         t += _tevset(set);
     }
-    return t > MEV_THRESH;
+    return t;
+}
+
+static int _mevset(uint64_t set)
+{
+    return thresh_slow(&mev_th, _tmevset(set));
 }
 
 static inline uint16_t nxr(uint16_t x)
@@ -353,6 +410,19 @@ static inline uint16_t nxr(uint16_t x)
 }
 #define DO_DELAY {rn = nxr(rn);rn = nxr(rn);rn = nxr(rn);rn = nxr(rn);}
 
+// DO_DELAY rounds between transmitting a word and reading it back (-d)
+static int delay;
+static volatile uint16_t delay_rn = 0xace1;
+
+static void do_delay(void)
+{
+    uint16_t rn = delay_rn;
+    for (int i = 0; i < delay; i++) {
+        DO_DELAY;
+    }
+    delay_rn = rn;
+}
+
 static void _mtouchset(uint64_t set)
 {
     uint16_t rn = 0xace1;
@@ -363,12 +433,20 @@ static void _mtouchset(uint64_t set)
 }
 
 
+/* getsample/getth: the raw timing behind getset and its threshold, for calibration */
 #if 0
 #define getset(x) _timeset(x)
+#define getsample(x) _ttimeset(x)
+#define getth tm_th
 #define putset(x) _evset(x)
+#define mputset(x) _evset(x)
 #else
 #define getset(x) _evset(x)
+#define getsample(x) _tevset(x)
+#define getth ev_th
 //#define getset(x) _mevset(x)
+//#define getsample(x) _tmevset(x)
+//#define getth mev_th
 //#define putset(x) _evset(x)
 #define putset(x) _touchset(x)
 //#define putset(x) _mtouchset(x)
@@ -398,76 +476,89 @@ void setup_buffer(void)
 
 #define WAYX(p) ((int)((uintptr_t)p >> (12+WAYBIT)) & 0xfff)
 
+#define LINESZ (64)
+#define LINEW (LINESZ / sizeof(void *))
+/* The lead-in pages of a ninja set use lines 2..2*NJ_SETSZ (calc_probe() offsets); the chain
+ * pages' slots follow, one line each: slot k of page i sits in line NJ_LINE(i) + k. All pages of
+ * a set agree on VA bits 12-15, so no two hops then share an L1D or L2 set. */
+static const unsigned char nj_line[9] = {0, 7, 13, 20, 24, 27, 30, 33, 36};
+#define NJ_LINE(i) (2*NJ_SETSZ + 2 + nj_line[i])
+
+// set up the TLB eviction set of one tlb set
+static void setup_set_ninja(int set)
+{
+    //printf("\nOn to set %3d\n", set);
+    void *(*ev[9])[LINEW];
+    for (int i = 0; i < 9; i++) {
+        ev[i] = (void *)((calc_probe(set, 1 + NJ_SETSZ + i) & ~(uint64_t)(PAGE - 1)) + NJ_LINE(i) * LINESZ);
+        //printf("%p %2d\n", ev[i], WAYX(ev[i]));
+    }
+    for(int i = 0; i < NJ_SETSZ; i++) {
+        uint64_t *probe = (uint64_t *) calc_probe(set, 1+i);
+        uint64_t next = i + 1 < NJ_SETSZ ? calc_probe(set, 1+i+1) : (uint64_t) &ev[0][0];
+        *probe = (uint64_t) next;
+        //printf("%p -> %p (%2d -> %2d)\n", probe, (void *)next, WAYX(probe), WAYX(next));
+    	}
+    ev[0][0][0] = &ev[1][0];
+    ev[0][1][0] = &ev[2][1];
+    ev[0][2][0] = &ev[2][2];
+    ev[0][3][0] = &ev[8][0];
+    ev[0][4][0] = &ev[2][4];
+    ev[0][5][0] = &ev[4][2];
+    ev[0][6][0] = &ev[2][6];
+
+    ev[1][0][0] = &ev[2][0];
+    ev[1][1][0] = &ev[6][0];
+    ev[1][2][0] = &ev[0][3];
+    ev[1][3][0] = &ev[5][1];
+    ev[1][4][0] = &ev[0][5];
+    ev[1][5][0] = &ev[6][2];
+
+    ev[2][0][0] = &ev[3][0];
+    ev[2][1][0] = &ev[1][1];
+    ev[2][2][0] = &ev[7][0];
+    ev[2][3][0] = &ev[1][3];
+    ev[2][4][0] = &ev[3][2];
+    ev[2][5][0] = &ev[1][5];
+    ev[2][6][0] = &ev[7][2];
+
+    ev[3][0][0] = &ev[4][0];
+    ev[3][1][0] = &ev[0][2];
+    ev[3][2][0] = &ev[8][1];
+    ev[3][3][0] = &ev[0][6];
+
+    ev[4][0][0] = &ev[5][0];
+    ev[4][1][0] = &ev[1][2];
+    ev[4][2][0] = &ev[5][2];
+
+    ev[5][0][0] = &ev[0][1];
+    ev[5][1][0] = &ev[7][1];
+    ev[5][2][0] = &ev[2][5];
+
+    ev[6][0][0] = &ev[3][1];
+    ev[6][1][0] = &ev[2][3];
+    ev[6][2][0] = &ev[3][3];
+
+    ev[7][0][0] = &ev[4][1];
+    ev[7][1][0] = &ev[0][4];
+    ev[7][2][0] = &ev[4][1];
+
+    ev[8][0][0] = &ev[6][1];
+    ev[8][1][0] = &ev[1][4];
+
+    //printf("Buffer setup for set %3d\n", set);
+    //void **p = (void **)calc_probe(set, 1);
+    //for (int i = 0; i < NJ_SETSZ + NJ_INIT + 4*6; i++) {
+        //printf("%p %2d -> %2d\n", p, WAYX(p)-13, WAYX(*p)-13);
+        //p = *p;
+    //}
+}
+
 // set up TLB eviction sets for all tlb sets. SETLIMIT is the number of hardware tlb sets.
 void setup_buffer_ninja(void)
 {
-	uint64_t set;
-    for(set = 0; set < SETLIMIT; set++) {
-        //printf("\nOn to set %3ld\n", set);
-        for(int i = 0; i < NJ_SETSZ; i++) {
-            uint64_t *probe = (uint64_t *) calc_probe(set, 1+i);
-            uint64_t next = calc_probe(set, 1+i+1);
-            *probe = (uint64_t) next;
-            //printf("%p -> %p (%2d -> %2d)\n", probe, (void *)next, WAYX(probe), WAYX(next));
-    	}
-        void **ev[9];
-        for (int i = 0; i < 9; i++) {
-            ev[i] = (void **)calc_probe(set, 1 + NJ_SETSZ + i);
-            //printf("%p %2d\n", ev[i], WAYX(ev[i]));
-        }
-        ev[0][0] = &ev[1][0];
-        ev[0][1] = &ev[2][1];
-        ev[0][2] = &ev[2][2];
-        ev[0][3] = &ev[8][0];
-        ev[0][4] = &ev[2][4];
-        ev[0][5] = &ev[4][2];
-        ev[0][6] = &ev[2][6];
-
-        ev[1][0] = &ev[2][0];
-        ev[1][1] = &ev[6][0];
-        ev[1][2] = &ev[0][3];
-        ev[1][3] = &ev[5][1];
-        ev[1][4] = &ev[0][5];
-        ev[1][5] = &ev[6][2];
-
-        ev[2][0] = &ev[3][0];
-        ev[2][1] = &ev[1][1];
-        ev[2][2] = &ev[7][0];
-        ev[2][3] = &ev[1][3];
-        ev[2][4] = &ev[3][2];
-        ev[2][5] = &ev[1][5];
-        ev[2][6] = &ev[7][2];
-
-        ev[3][0] = &ev[4][0];
-        ev[3][1] = &ev[0][2];
-        ev[3][2] = &ev[8][1];
-        ev[3][3] = &ev[0][6];
-
-        ev[4][0] = &ev[5][0];
-        ev[4][1] = &ev[1][2];
-        ev[4][2] = &ev[5][2];
-
-        ev[5][0] = &ev[0][1];
-        ev[5][1] = &ev[7][1];
-        ev[5][2] = &ev[2][5];
-
-        ev[6][0] = &ev[3][1];
-        ev[6][1] = &ev[2][3];
-        ev[6][2] = &ev[3][3];
-
-        ev[7][0] = &ev[4][1];
-        ev[7][1] = &ev[0][4];
-        ev[7][2] = &ev[4][1];
-
-        ev[8][0] = &ev[6][1];
-        ev[8][1] = &ev[1][4];
-
-        //printf("Buffer setup for set %3ld\n", set);
-        //void **p = (void **)calc_probe(set, 1);
-        //for (int i = 0; i < NJ_SETSZ + NJ_INIT + 4*6; i++) {
-            //printf("%p %2d -> %2d\n", p, WAYX(p)-13, WAYX(*p)-13);
-            //p = *p;
-        //}
+    for(int set = 0; set < SETLIMIT; set++) {
+        setup_set_ninja(set);
     }
 }
 
@@ -481,11 +572,91 @@ void ninja_sync(int lo, int hi)
     }
 }
 
+// ninja_sync() the first n data channels
+void chan_sync(int n)
+{
+    for (int k = 0; k < n; k++) {
+        ninja_sync(chset[k], chset[k] + 1);
+    }
+}
+
+
+
+
+#define CAL_BSZ (4)
+#define CAL_BNR (512)
+#define CAL_ROUNDS (20000)
+
+// calibrate getset() on the first n data channels: time every set, half of them just touched the
+// way the transmitter does (alternating between rounds), and set getth to the cut that separates
+// the touched (slow) from the untouched (fast) samples best. returns the error rate at that cut.
+double calibrate(int n)
+{
+    static uint32_t h[2][CAL_BNR];
+
+    memset(h, 0, sizeof(h));
+    chan_sync(n);
+    for(long rnd = 0; rnd < CAL_ROUNDS; rnd++) {
+    #ifdef USE_NINJA
+        if (!(rnd & NINJA_MASK)) {
+            chan_sync(n);
+        }
+    #endif
+        for(int k = 0; k < n; k++) {
+            if((k ^ rnd) & 1) mputset(chset[k]);
+        }
+        for(int k = 0; k < n; k++) {
+            uint32_t b = getsample(chset[k]) / CAL_BSZ;
+            h[(k ^ rnd) & 1][b < CAL_BNR ? b : CAL_BNR - 1]++;
+        }
+    }
+
+    double err;
+    uint32_t cut = (hist_cut(h[0], h[1], CAL_BNR, &err) + 1) * CAL_BSZ - 1;
+    uint32_t fast = hist_mean(h[0], CAL_BNR, CAL_BSZ), slow = hist_mean(h[1], CAL_BNR, CAL_BSZ);
+    thresh_init(&getth, cut, fast, slow);
+    printf("calibrated: fast mean %u, slow mean %u, threshold %u (%.2f%% misclassified)\n",
+            fast, slow, cut, 100 * err);
+    return err;
+}
+
+// transmit the bits of a 'wordlen'-size word as they are, one per data channel from data_chan
+// on (msb first)
+void putword(int data_chan, int wordlen, uint64_t sendword)
+{
+            for (int i = 0; i < MTH; i++) {
+                for(int setix = 0; setix < wordlen; setix++) {
+                       //if((sendword >> (wordlen-1-setix)) & 1) { getset(chset[data_chan+setix]); }
+                       if((sendword >> (wordlen-1-setix)) & 1) { putset(chset[data_chan+setix]); }
+                }
+            }
+}
+
+// read back a 'wordlen'-size word as putword() sent it, along with a mask of the bits whose
+// timing fell within 1/FEC_SOFT of the class mean gap from the threshold (none if uncalibrated)
+uint64_t getword_soft(int data_chan, int wordlen, uint64_t *marg)
+{
+        const uint32_t gap = (getth.mu[1] >> TH_EWMA) - (getth.mu[0] >> TH_EWMA);
+        const uint32_t soft = getth.mu[1] ? gap / FEC_SOFT : 0;
+        uint64_t word = 0;
 
+        *marg = 0;
+        for(int k = data_chan; k < data_chan+wordlen; k++) {
+            const uint32_t cut = getth.cut;
+            const uint32_t tim = getsample(chset[k]);
+            word <<= 1;
+            *marg <<= 1;
+            word |= thresh_slow(&getth, tim);
+            *marg |= (tim > cut ? tim - cut : cut - tim) < soft;
+        }
+        return word;
+}
 
+// the last word (crc included) writeword() sent and readword() read, to count raw bit errors
+static uint64_t lastsent, lastread;
 
 // receiver function: read a 'wordlen'-size word from tlb sets
-uint64_t readword(int r_ready_set, int t_ready_set, int data_set, int wordlen)
+uint64_t readword(int r_ready_set, int t_ready_set, int data_chan, int wordlen)
 {
         int set;
         long maxloops = 10000000;
@@ -511,10 +682,11 @@ uint64_t readword(int r_ready_set, int t_ready_set, int data_set, int wordlen)
 
         /* collect actual bits: transmit 'wordlen' bits in parallel (one bit per tlb set) */
         uint64_t word = 0;
-        for(set = data_set; set < data_set+wordlen; set++) {
+        for(set = data_chan; set < data_chan+wordlen; set++) {
             word <<= 1;
-            word |= getset(set);
+            word |= getset(chset[set]);
     	}
+        lastread = word;
 
         uint64_t b0, b1, b2, b3, crcval = 0;
         // seperate message into bytes, which also seperates the crc from the message.
@@ -543,10 +715,8 @@ uint64_t readword(int r_ready_set, int t_ready_set, int data_set, int wordlen)
 }
 
 // transmitter function: write a 'wordlen'-size word to tlb sets
-void writeword(int r_ready_set, int t_ready_set, int data_set, int wordlen, uint64_t sendword)
+void writeword(int r_ready_set, int t_ready_set, int data_chan, int wordlen, uint64_t sendword)
 {
-            int setix = 0;
-            int set;
             assert((sendword >> (wordlen-8)) == 0);
 
             // seperate data word into bytes, compute crc over bytes
@@ -577,108 +747,224 @@ void writeword(int r_ready_set, int t_ready_set, int data_set, int wordlen, uint
 
             //while(getset(r_ready_set) == 0) ; // wait for receiver to be ready: poll r_ready_set rising edge
             //while(getset(r_ready_set) == 1) ;
-            for (int i = 0; i < MTH; i++) {
-                setix = 0;
-                for(set = data_set; set < data_set+wordlen; set++) {
-                       //if((sendword >> (wordlen-1-setix)) & 1) { getset(set); }
-                       if((sendword >> (wordlen-1-setix)) & 1) { putset(set); }
-                       setix++;
-                }
-            }
+            lastsent = sendword;
+            putword(data_chan, wordlen, sendword);
             //getset(t_ready_set); // tell receiver that data is valid: assert t_ready_set
             //getset(t_ready_set);
             //mputset(t_ready_set);
 }
 
-int main(int argc, char *argv[])
+#define ALLOC_ROUNDS (4000)
+#define ALLOC_MAXERR (0.1)
+
+// mark the tlb set of the page holding p, and of the page after it, as taken by our own accesses
+static void alloc_skip(char *skip, const void *p)
 {
-    uint64_t safeset = SET_SAFE;
+    skip[TSL2((uintptr_t)p)] = 1;
+    skip[TSL2((uintptr_t)p + PAGE)] = 1;
+}
 
-    int clamps = 0, time;
+// pick the data channels (chset, nchan) among all tlb sets. candidates are the sets not taken by
+// SET_SAFE, njcur and the code, stack and data the probe loop itself touches (stack: an address
+// in main's frame). they are calibrated together and ranked by how often a probe misreads them,
+// touched or not; those that misread more than ALLOC_MAXERR of the time are dropped. each keeps
+// its sTLB set but moves to the least loaded dTLB set (chdl1), so that the sets probed in one
+// round contend for as few L1 dTLB ways as possible, and chset deals them out round-robin over
+// dTLB sets, best first, so that any prefix of it (a word) is spread as evenly.
+void alloc_sets(int *fdarray, const void *stack)
+{
+    char skip[HARDWARESETS] = {0};
+    static int err[HARDWARESETS];
+    int cand[HARDWARESETS], ncand = 0;
+
+    skip[SET_SAFE] = 1;
+    alloc_skip(skip, stack);
+    alloc_skip(skip, (void *)&putword);
+    alloc_skip(skip, (void *)&getword_soft);
+    alloc_skip(skip, (void *)&readword);
+    alloc_skip(skip, (void *)&writeword);
+    alloc_skip(skip, (void *)&ninja_sync);
+    alloc_skip(skip, (void *)&_evset);
+    alloc_skip(skip, (void *)&_touchset);
+    alloc_skip(skip, chset);
+    alloc_skip(skip, &ev_th);
+    alloc_skip(skip, (const void *)njcur);
+#ifdef USE_FEC
+    alloc_skip(skip, (void *)&rs_decode);
+    alloc_skip(skip, gf_exp);
+#endif
 
-    if(argc != 2) {
-        fprintf(stderr, "usage: %s <core>\n", argv[0]);
-        exit(1);
+    for(int set = 0; set < HARDWARESETS; set++) {
+        if(!skip[set]) chset[ncand++] = set;
     }
+    calibrate(ncand);
 
-    int mycpu = atoi(argv[1]);
-    pin_cpu(mycpu);
-
-	unsigned long long set;
-    int fd[SETLIMIT];
-    for(set = 0; set < SETLIMIT; set++) {
-        fd[set] = createfile(SHAREFILE, set);
-		assert(set < 512);
+    memset(err, 0, sizeof(err));
+    chan_sync(ncand);
+    for(long rnd = 0; rnd < ALLOC_ROUNDS; rnd++) {
+    #ifdef USE_NINJA
+        if (!(rnd & NINJA_MASK)) {
+            chan_sync(ncand);
+        }
+    #endif
+        for(int k = 0; k < ncand; k++) {
+            if((k ^ rnd) & 1) mputset(chset[k]);
+        }
+        for(int k = 0; k < ncand; k++) {
+            err[chset[k]] += getset(chset[k]) != ((k ^ rnd) & 1);
+        }
     }
 
-    allocate_buffer(fd, (volatile char *) VTARGET);
-    //setup_tbuf();
-    //setup_buffer();
-    setup_buffer_ninja();
-    njcur = (uint64_t *)mmap_safe(100);
-    ninja_sync(0, SETLIMIT);
+    // rank, best first (insertion sort: at most HARDWARESETS of them)
+    for(int k = 0; k < ncand; k++) {
+        int set = chset[k], j = k;
+        for(; j > 0 && err[cand[j-1]] > err[set]; j--) cand[j] = cand[j-1];
+        cand[j] = set;
+    }
+    while(ncand > 0 && err[cand[ncand-1]] > ALLOC_MAXERR * ALLOC_ROUNDS) ncand--;
+
+    // dTLB sets: keep a set's own where it is among the least loaded, to save remapping
+    int load[16] = {0}, bydl1[16][HARDWARESETS], nbydl1[16] = {0};
+    for(int k = 0; k < ncand; k++) {
+        int set = cand[k], d = set & 0xf;
+        for(int i = 0; i < 16; i++) {
+            if(load[i] < load[d]) d = i;
+        }
+        load[d]++;
+        bydl1[d][nbydl1[d]++] = set;
+        if(d != chdl1[set]) {
+            chdl1[set] = d;
+            map_set(fdarray, (volatile char *) VTARGET, set);
+            setup_set_ninja(set);
+        }
+    }
+    nchan = 0;
+    for(int r = 0; nchan < ncand; r++) {
+        for(int d = 0; d < 16; d++) {
+            if(r < nbydl1[d]) chset[nchan++] = bydl1[d][r];
+        }
+    }
+    printf("allocated %d data sets (of %d), misreads %.2f%% (best) to %.2f%% (worst)\n", nchan, HARDWARESETS,
+            nchan ? 100.0 * err[cand[0]] / ALLOC_ROUNDS : 0, nchan ? 100.0 * err[cand[nchan-1]] / ALLOC_ROUNDS : 0);
+}
 
-#define RESETMESSAGE "start receiver first.\nif processes are out of sync, and you want to be sure to resync them,\nkill them all and delete /tmp/.tlb*, then start receiver first, then sender.\nbut just restarting first receiver, then sender, should also work.\n"
+#ifdef USE_FEC
+#define FEC_DATA (FEC_K*FEC_DEPTH - 4)  /* payload bytes per block; block number and crc take 2 each */
 
-     time=1;
+// the payload of block blk, which the receiver knows out-of-band to count undetected errors
+static inline uint8_t fec_payload(long blk, int i)
+{
+    return nxr(blk * FEC_DATA + i + 1);
+}
 
-     printf("receiver: sanity check mode\nyou should see a 'power level indicator' (between 0 and 100).\n"
-             "that goes up when the sender prints 'set ON' and down when the sender prints 'set OFF'.\n"
-             "this tests basic bit-level communicating using tlb set latencies and no framing, crc, etc.\n"
-             "if that doesn't work, that should be debugged first.\n");
+// encode block blk into FEC_N words. word w carries symbol w of every codeword: codeword
+// (w + lane) % FEC_DEPTH in each byte lane, so a bad word costs every codeword one symbol.
+static void fec_frame(long blk, uint64_t *words)
+{
+    uint8_t data[FEC_K*FEC_DEPTH_MAX], cw[FEC_DEPTH_MAX][FEC_N];
+
+    data[0] = blk & 0xff;
+    data[1] = (blk >> 8) & 0xff;
+    for(int i = 0; i < FEC_DATA; i++) data[2 + i] = fec_payload(blk, i);
+    uint16_t crc = crc16(0xffff, data, FEC_DATA + 2);
+    data[FEC_DATA + 2] = crc & 0xff;
+    data[FEC_DATA + 3] = crc >> 8;
+
+    for(int d = 0; d < FEC_DEPTH; d++) {
+        memcpy(&cw[d][FEC_N - FEC_K], &data[d * FEC_K], FEC_K);
+        rs_encode(cw[d], FEC_N, FEC_N - FEC_K);
+    }
+    for(int w = 0; w < FEC_N; w++) {
+        words[w] = 0;
+        for(int l = 0; l < FEC_DEPTH; l++) words[w] |= (uint64_t)cw[(w + l) % FEC_DEPTH][w] << (8 * l);
+    }
+}
 
-     for(int saneset = 0; saneset < 1; saneset++) {
-         //ninja_sync(SET_DATA, SET_DATA+WORDLEN);
-         //assert(saneset >= 0);
-         //assert(saneset < HARDWARESETS);
-         printf("set ON\n");
-         for (int i = 0; i < 5000; i++) {
-             ninja_sync(SET_DATA, SET_DATA+WORDLEN);
-             int count = 0;
-             int n = 0;
-             for(n = 0; n < 100; n++) {
-                 for (int sset = SET_DATA; sset < SET_DATA+WORDLEN; sset += 2) {
-                     mputset(sset);
-                 }
-                 for (int sset = SET_DATA; sset < SET_DATA+WORDLEN; sset++) {
-                     count += getset(sset);
-                 }
-            }
-            count /= WORDLEN;
-             printf("\r%*s*%*s%4d\r",count, "", 100-count, "", count);
-             fflush(stdout);
-         }
-         printf("set OFF\n");
-         for (int i = 0; i < 5000; i++) {
-             ninja_sync(SET_DATA, SET_DATA+WORDLEN);
-             int count = 0;
-             int n = 0;
-             for(n = 0; n < 100; n++) {
-                 for (int sset = SET_DATA; sset < SET_DATA+WORDLEN; sset++) {
-                     count += getset(sset);
-                 }
-            }
-            count /= WORDLEN;
-             printf("\r%*s*%*s%4d\r",count, "", 100-count, "", count);
-             fflush(stdout);
-         }
-     }
-     //exit(0);
-     printf("\n");
-     printf("receiver: sanity check done; doing real covert channel test.\n");
+// decode FEC_N received words (marg: bits read close to the threshold) as block blk. returns
+// -1 if the block is lost (uncorrectable, bad crc or a different block number), otherwise the
+// number of payload bytes that are wrong all the same. adds to the symbol and erasure counts.
+static int fec_unframe(long blk, const uint64_t *words, const uint64_t *marg, long *corr, long *eras)
+{
+    uint8_t data[FEC_K*FEC_DEPTH_MAX], cw[FEC_DEPTH_MAX][FEC_N];
+    int era[FEC_DEPTH_MAX][FEC_N], nera[FEC_DEPTH_MAX] = {0};
+
+    for(int w = 0; w < FEC_N; w++) {
+        for(int l = 0; l < FEC_DEPTH; l++) {
+            const int d = (w + l) % FEC_DEPTH;
+            cw[d][w] = words[w] >> (8 * l);
+            if((marg[w] >> (8 * l)) & 0xff) era[d][nera[d]++] = w;
+        }
+    }
+    for(int d = 0; d < FEC_DEPTH; d++) {
+        // more erasures than parity: fall back to correcting errors only
+        if(nera[d] > FEC_N - FEC_K) nera[d] = 0;
+        int r = rs_decode(cw[d], FEC_N, FEC_N - FEC_K, era[d], nera[d]);
+        if(r < 0) return -1;
+        *corr += r;
+        *eras += nera[d];
+        memcpy(&data[d * FEC_K], &cw[d][FEC_N - FEC_K], FEC_K);
+    }
+    uint16_t crc = crc16(0xffff, data, FEC_DATA + 2);
+    if(data[FEC_DATA + 2] != (crc & 0xff) || data[FEC_DATA + 3] != crc >> 8) return -1;
+    if(data[0] != (blk & 0xff) || data[1] != ((blk >> 8) & 0xff)) return -1;
 
-     int receive_errors = 0;
+    int wrong = 0;
+    for(int i = 0; i < FEC_DATA; i++) wrong += data[2 + i] != fec_payload(blk, i);
+    return wrong;
+}
+#endif
 
+struct chstats {
+    long att;               // words put on the channel
+    int goodwords;          // frames (blocks with USE_FEC) received correctly
+    int receive_errors;     // undetected errors (bytes with USE_FEC)
+    long goodbytes;         // payload delivered correctly
+    long lost;              // frames (blocks with USE_FEC) that failed and were asked for again
+    long corr, eras;        // USE_FEC: corrected symbols, erasures
+    long biterrs;           // raw bits read wrong
+    double secs;
+};
+
+// run the channel on the first wordlen data channels until 'frames' frames (blocks with USE_FEC)
+// got through, or until maxatt words were sent if nonzero, and collect the counts in *st
+static void run_channel(int frames, long maxatt, struct chstats *st)
+{
+     int time = 1;
      struct timeval tv1, tv2;
+
+     memset(st, 0, sizeof(*st));
      gettimeofday(&tv1, NULL);
-     int goodwords=0;
      //for(;;) {
-     ninja_sync(SET_DATA, SET_DATA+WORDLEN);
-     for (long att = 0; time <= 100000; att++) {
+     chan_sync(wordlen);
+#ifdef USE_FEC
+     // time is the number of the block asked for, as it is the frame number below
+     uint64_t words[FEC_N], rwords[FEC_N], marg[FEC_N];
+     while (time <= frames && (!maxatt || st->att < maxatt)) {
+         fec_frame(time, words);
+         for (int w = 0; w < FEC_N; w++, st->att++) {
+    #ifdef USE_NINJA
+             if (!(st->att & NINJA_MASK)) {
+                 chan_sync(wordlen);
+             }
+    #endif
+             putword(0, wordlen, words[w]);
+             do_delay();
+             rwords[w] = getword_soft(0, wordlen, &marg[w]);
+             st->biterrs += __builtin_popcountll(words[w] ^ rwords[w]);
+         }
+         // a lost block is simply asked for again, like a frame with a bad crc below
+         int wrong = fec_unframe(time, rwords, marg, &st->corr, &st->eras);
+         if(wrong < 0) { st->lost++; continue; }
+         if(wrong) { fprintf(stderr, "block %d: %d bytes wrong\n", time, wrong); st->receive_errors += wrong; }
+         else { st->goodwords++; st->goodbytes += FEC_DATA; }
+         time++;
+     }
+#else
+     for (; time <= frames && (!maxatt || st->att < maxatt); st->att++) {
 
     #ifdef USE_NINJA
-         if (!(att & NINJA_MASK)) {
-             ninja_sync(SET_DATA, SET_DATA+WORDLEN);
+         if (!(st->att & NINJA_MASK)) {
+             chan_sync(wordlen);
          }
     #endif
 
@@ -695,17 +981,21 @@ int main(int argc, char *argv[])
             responseword |= ((requestword) & 0xffff) << 8;
             //printf("%6x: %8lx\n", time, requestword);
             // send response: repsonseword
-            //readword(SET_SYNC_R_READY_DATA, SET_SYNC_T_READY_DATA, SET_DATA, WORDLEN);
-            //readword(SET_SYNC_R_READY_DATA, SET_SYNC_T_READY_DATA, SET_DATA, WORDLEN);
-            //readword(SET_SYNC_R_READY_DATA, SET_SYNC_T_READY_DATA, SET_DATA, WORDLEN);
+            //readword(SET_SYNC_R_READY_DATA, SET_SYNC_T_READY_DATA, 0, wordlen);
+            //readword(SET_SYNC_R_READY_DATA, SET_SYNC_T_READY_DATA, 0, wordlen);
+            //readword(SET_SYNC_R_READY_DATA, SET_SYNC_T_READY_DATA, 0, wordlen);
 
-            writeword(SET_SYNC_R_READY_DATA, SET_SYNC_T_READY_DATA, SET_DATA, WORDLEN, responseword);
+            writeword(SET_SYNC_R_READY_DATA, SET_SYNC_T_READY_DATA, 0, wordlen, responseword);
             //time++;
         //}
+        do_delay();
 
         // read reply using readword() into word. return 0 if invalid data received or timeout.
         // if 0 is received, time does not tick and we simply ask for the same word again next time.
-        if((word = readword(SET_SYNC_R_READY_DATA, SET_SYNC_T_READY_DATA, SET_DATA, WORDLEN)) != 0) {
+        word = readword(SET_SYNC_R_READY_DATA, SET_SYNC_T_READY_DATA, 0, wordlen);
+        st->biterrs += __builtin_popcountll(lastsent ^ lastread);
+        if(word == 0) st->lost++;
+        else {
             uint64_t writetime = time;
             uint64_t frameno = (word >> 1) & 0x7f;
             uint64_t dataword = (word >> 8) & 0xffff;
@@ -722,26 +1012,208 @@ int main(int argc, char *argv[])
                     // the undetected error rate would be. receive_errors are undetected errors.
                     // timeouts or crc errors are not called receive errors because a framing protocol will detect them
                     // and not cause any problems.
-                    if(dataword != expect_dataword) { fprintf(stderr, "for time 0x%x, expecting dataword 0x%lx, saw 0x%lx, \n", time, expect_dataword, dataword); receive_errors++; }
-                    else goodwords++;
-            //} else {
+                    if(dataword != expect_dataword) { fprintf(stderr, "for time 0x%x, expecting dataword 0x%lx, saw 0x%lx, \n", time, expect_dataword, dataword); st->receive_errors++; }
+                    else { st->goodwords++; st->goodbytes += 3; }
+            } else {
+                st->lost++;
                 //printf("w%5x: %8lx\n", time, word);
             }
         }
 
     }
+#endif
 
     gettimeofday(&tv2, NULL);
 
     uint64_t usecs1 = tv1.tv_sec*1000000ULL + tv1.tv_usec;
     uint64_t usecs2 = tv2.tv_sec*1000000ULL + tv2.tv_usec;
 
-    double dtf = (double)usecs2/1000000.0-(double)usecs1/1000000.0;
+    st->secs = (double)usecs2/1000000.0-(double)usecs1/1000000.0;
+}
+
+#ifdef USE_FEC
+#define SWEEP_FRAMES (200)
+#else
+#define SWEEP_FRAMES (5000)
+#endif
+
+// run the channel at every word width the framing allows, up to the number of data channels,
+// and return the one with the highest goodput
+static int sweep_wordlen(void)
+{
+    int best = 0;
+    double bestkbit = -1;
+
+    printf("%8s %10s %10s %8s\n", "wordlen", "raw kbit", "kbit", "lost");
+#ifdef USE_FEC
+    for (int w = 8; w <= WORDLEN_MAX && w <= nchan; w += 8) {
+#else
+    for (int w = WORDLEN; w <= WORDLEN; w++) { // the crc8 frames only come in 32 bits
+#endif
+        struct chstats st;
+        wordlen = w;
+        // give up on widths that get almost nothing through
+        run_channel(SWEEP_FRAMES, 64L * SWEEP_FRAMES * FRAME_WORDS, &st);
+        double kbit = st.goodbytes * 8 / st.secs / 1000;
+        printf("%8d %10.1f %10.1f %8ld\n", w, st.att * w / st.secs / 1000, kbit, st.lost);
+        if (kbit > bestkbit) {
+            bestkbit = kbit;
+            best = w;
+        }
+    }
+    printf("best wordlen %d (%.1f kbit)\n", best, bestkbit);
+    return best;
+}
+
+// whether 'w'-bit words can be sent over the allocated data sets
+static int wordlen_ok(int w)
+{
+#ifdef USE_FEC
+    return w % 8 == 0 && w > 0 && w <= WORDLEN_MAX && w <= nchan;
+#else
+    return w == WORDLEN && w <= nchan;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t safeset = SET_SAFE;
+
+    int clamps = 0;
+    int thresh = 0, frames = FRAMES, sanity = 1;
+    int opt;
+
+    while((opt = getopt(argc, argv, "t:w:d:n:q")) != -1) {
+        switch(opt) {
+            case 't': thresh = atoi(optarg); break;
+            case 'w': wordlen = atoi(optarg); break;
+            case 'd': delay = atoi(optarg); break;
+            case 'n': frames = atoi(optarg); break;
+            case 'q': sanity = 0; break;
+            default: goto usage;
+        }
+    }
+    if(optind != argc - 1) {
+usage:
+        fprintf(stderr, "usage: %s [-t threshold] [-w wordlen] [-d delay] [-n frames] [-q] <core>\n"
+                "-t: fixed threshold (default 0: calibrate and track drift)\n"
+                "-w: bits per word (default %d; 0: sweep for the highest goodput)\n"
+                "-d: DO_DELAY rounds between sending a word and reading it back\n"
+                "-n: frames (blocks with FEC) to receive (default %d)\n"
+                "-q: skip the sanity check\n", argv[0], WORDLEN, FRAMES);
+        exit(1);
+    }
+
+    int mycpu = atoi(argv[optind]);
+    pin_cpu(mycpu);
+
+	unsigned long long set;
+    int fd[SETLIMIT];
+    for(set = 0; set < SETLIMIT; set++) {
+        fd[set] = createfile(SHAREFILE, set);
+		assert(set < 512);
+    }
+
+    allocate_buffer(fd, (volatile char *) VTARGET);
+    //setup_tbuf();
+    //setup_buffer();
+    setup_buffer_ninja();
+    njcur = (uint64_t *)mmap_safe(100);
+    ninja_sync(0, SETLIMIT);
+
+#define RESETMESSAGE "start receiver first.\nif processes are out of sync, and you want to be sure to resync them,\nkill them all and delete /tmp/.tlb*, then start receiver first, then sender.\nbut just restarting first receiver, then sender, should also work.\n"
+
+#ifdef USE_FEC
+     fec_init();
+#endif
+     alloc_sets(fd, &clamps);
+     if(nchan == 0) {
+         fprintf(stderr, "no usable data sets: too noisy, or thresholds off\n");
+         exit(1);
+     }
+
+     // check a given word length against the data sets before spending time calibrating them
+     if(wordlen && !wordlen_ok(wordlen)) {
+         fprintf(stderr, "cannot send %d-bit words over %d data sets\n", wordlen, nchan);
+         exit(1);
+     }
+
+     if(thresh) {
+         // fixed threshold: no calibration, no drift tracking
+         thresh_init(&getth, thresh, 0, 0);
+         printf("fixed threshold %u\n", getth.cut);
+     } else {
+         calibrate(wordlen ? wordlen : nchan);
+     }
+     if(wordlen == 0) {
+         wordlen = sweep_wordlen();
+     }
+     if(!wordlen_ok(wordlen)) {
+         fprintf(stderr, "cannot send %d-bit words over %d data sets\n", wordlen, nchan);
+         exit(1);
+     }
+
+     if(sanity)
+     printf("receiver: sanity check mode\nyou should see a 'power level indicator' (between 0 and 100).\n"
+             "that goes up when the sender prints 'set ON' and down when the sender prints 'set OFF'.\n"
+             "this tests basic bit-level communicating using tlb set latencies and no framing, crc, etc.\n"
+             "if that doesn't work, that should be debugged first.\n");
+
+     for(int saneset = 0; saneset < sanity; saneset++) {
+         //chan_sync(wordlen);
+         //assert(saneset >= 0);
+         //assert(saneset < HARDWARESETS);
+         printf("set ON\n");
+         for (int i = 0; i < 5000; i++) {
+             chan_sync(wordlen);
+             int count = 0;
+             int n = 0;
+             for(n = 0; n < 100; n++) {
+                 for (int k = 0; k < wordlen; k += 2) {
+                     mputset(chset[k]);
+                 }
+                 for (int k = 0; k < wordlen; k++) {
+                     count += getset(chset[k]);
+                 }
+            }
+            count /= wordlen;
+             printf("\r%*s*%*s%4d\r",count, "", 100-count, "", count);
+             fflush(stdout);
+         }
+         printf("set OFF\n");
+         for (int i = 0; i < 5000; i++) {
+             chan_sync(wordlen);
+             int count = 0;
+             int n = 0;
+             for(n = 0; n < 100; n++) {
+                 for (int k = 0; k < wordlen; k++) {
+                     count += getset(chset[k]);
+                 }
+            }
+            count /= wordlen;
+             printf("\r%*s*%*s%4d\r",count, "", 100-count, "", count);
+             fflush(stdout);
+         }
+     }
+     //exit(0);
+     printf("\n");
+     printf("receiver: sanity check done; doing real covert channel test.\n");
+
+     struct chstats st;
+     run_channel(frames, 0, &st);
+     double dtf = st.secs;
 
     printf("receiver detects that sender has exited.\n");
-    printf("elapsed: %lf bytespersecond: %lf kbit: %lf ", dtf, goodwords*3/dtf, ((goodwords*3/dtf*8))/1000);
-    printf("undetected errors %d correctly received frames %d\n", receive_errors, goodwords);
+    // kbit is the goodput (correct payload delivered), raw kbit what went over the sets
+    printf("elapsed: %lf bytespersecond: %lf kbit: %lf raw kbit: %lf ", dtf, st.goodbytes/dtf, ((st.goodbytes/dtf*8))/1000,
+            st.att*wordlen/dtf/1000);
+#ifdef USE_FEC
+    printf("undetected errors %d (bytes) correctly received blocks %d lost blocks %ld ", st.receive_errors, st.goodwords, st.lost);
+    printf("corrected symbols %ld erasures %ld\n", st.corr, st.eras);
+#else
+    printf("undetected errors %d correctly received frames %d lost frames %ld\n", st.receive_errors, st.goodwords, st.lost);
+#endif
+    printf("words sent %ld bit errors %ld (%lf)\n", st.att, st.biterrs, (double)st.biterrs / (st.att * wordlen));
 
     return 0;
 }
-
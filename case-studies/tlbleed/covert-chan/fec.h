@@ -0,0 +1,183 @@
+
+#ifndef _TLBCOVERTFEC_H
+#define _TLBCOVERTFEC_H 1
+
+#include <stdint.h>
+#include <string.h>
+
+// Reed-Solomon codes over GF(2^8) (primitive polynomial 0x11d, generator roots alpha^0..alpha^(nsym-1))
+// and a table-driven CRC-16 (CCITT polynomial 0x1021), for the covert channel's FEC framing.
+//
+// A codeword is c[0..n-1], c[j] being the coefficient of x^j: the nsym parity symbols come first,
+// at c[0..nsym-1], followed by the data symbols. Symbol j is located by alpha^j.
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint16_t crc16_table[256];
+
+static void fec_init(void)
+{
+    unsigned x = 1;
+    for(int i = 0; i < 255; i++) {
+        gf_exp[i] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if(x & 0x100) x ^= 0x11d;
+    }
+    // doubled, so that products need no modulo
+    for(int i = 255; i < 512; i++) gf_exp[i] = gf_exp[i - 255];
+
+    for(unsigned b = 0; b < 256; b++) {
+        uint16_t crc = b << 8;
+        for(int i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        crc16_table[b] = crc;
+    }
+}
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    if(a == 0 || b == 0) return 0;
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static inline uint8_t gf_div(uint8_t a, uint8_t b)
+{
+    if(a == 0) return 0;
+    return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+// evaluate p[0..deg] (p[i] the coefficient of x^i) at x
+static inline uint8_t gf_eval(const uint8_t *p, int deg, uint8_t x)
+{
+    uint8_t y = 0;
+    for(int i = deg; i >= 0; i--) y = gf_mul(y, x) ^ p[i];
+    return y;
+}
+
+static uint16_t crc16(uint16_t crc, const uint8_t *data, size_t len)
+{
+    while(len--) crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *data++];
+    return crc;
+}
+
+// systematic encoding: c[nsym..n-1] holds the data, fill in c[0..nsym-1] with the remainder of
+// data(x) * x^nsym by the generator polynomial
+static void rs_encode(uint8_t *c, int n, int nsym)
+{
+    uint8_t g[nsym + 1];
+
+    // g(x) = (x - a^0)(x - a^1)...(x - a^(nsym-1))
+    memset(g, 0, sizeof(g));
+    g[0] = 1;
+    for(int i = 0; i < nsym; i++) {
+        for(int j = i + 1; j > 0; j--) g[j] = g[j - 1] ^ gf_mul(g[j], gf_exp[i]);
+        g[0] = gf_mul(g[0], gf_exp[i]);
+    }
+
+    // LFSR division, highest data symbol first
+    memset(c, 0, nsym);
+    for(int i = n - 1; i >= nsym; i--) {
+        uint8_t fb = c[i] ^ c[nsym - 1];
+        for(int j = nsym - 1; j > 0; j--) c[j] = c[j - 1] ^ gf_mul(fb, g[j]);
+        c[0] = gf_mul(fb, g[0]);
+    }
+}
+
+// Correct c[0..n-1] in place, given the positions of nera known-unreliable symbols (erasures), as
+// long as 2 * errors + erasures <= nsym. Returns the number of symbols corrected, or -1 if c is
+// beyond repair (in which case it is left untouched).
+static int rs_decode(uint8_t *c, int n, int nsym, const int *era, int nera)
+{
+    uint8_t s[nsym], lam[nsym + 1], b[nsym + 1], psi[nsym + 1], om[nsym], t[nsym + 1];
+    int nz = 0;
+
+    if(nera > nsym) return -1;
+
+    for(int i = 0; i < nsym; i++) {
+        s[i] = gf_eval(c, n - 1, gf_exp[i]);
+        nz |= s[i];
+    }
+    if(!nz) return 0;
+
+    // erasure locator gamma(x) = prod (1 - X_e x), in psi
+    memset(psi, 0, sizeof(psi));
+    psi[0] = 1;
+    for(int e = 0; e < nera; e++) {
+        const uint8_t x = gf_exp[era[e]];
+        for(int j = e + 1; j > 0; j--) psi[j] ^= gf_mul(psi[j - 1], x);
+    }
+
+    // Forney syndromes: gamma(x) s(x) mod x^nsym; the terms from x^nera on only depend on the
+    // errors, so Berlekamp-Massey on them yields the error locator lambda(x)
+    for(int i = 0; i < nsym; i++) {
+        t[i] = 0;
+        for(int j = 0; j <= i && j <= nera; j++) t[i] ^= gf_mul(psi[j], s[i - j]);
+    }
+    memset(lam, 0, sizeof(lam));
+    memset(b, 0, sizeof(b));
+    lam[0] = b[0] = 1;
+    int l = 0, m = 1;
+    uint8_t bd = 1;
+    for(int k = 0; k < nsym - nera; k++) {
+        uint8_t d = t[nera + k];
+        for(int i = 1; i <= l; i++) d ^= gf_mul(lam[i], t[nera + k - i]);
+        if(d == 0) {
+            m++;
+            continue;
+        }
+        uint8_t old[nsym + 1];
+        memcpy(old, lam, sizeof(old));
+        const uint8_t f = gf_div(d, bd);
+        for(int i = 0; i + m <= nsym; i++) lam[i + m] ^= gf_mul(f, b[i]);
+        if(2 * l <= k) {
+            l = k + 1 - l;
+            memcpy(b, old, sizeof(b));
+            bd = d;
+            m = 1;
+        } else {
+            m++;
+        }
+    }
+    if(2 * l + nera > nsym) return -1;
+
+    // full locator psi(x) = lambda(x) gamma(x)
+    const int deg = l + nera;
+    memcpy(t, psi, sizeof(t));
+    memset(psi, 0, sizeof(psi));
+    for(int i = 0; i <= l; i++)
+        for(int j = 0; j <= nera; j++) psi[i + j] ^= gf_mul(lam[i], t[j]);
+
+    // evaluator omega(x) = s(x) psi(x) mod x^nsym
+    for(int i = 0; i < nsym; i++) {
+        om[i] = 0;
+        for(int j = 0; j <= i && j <= deg; j++) om[i] ^= gf_mul(psi[j], s[i - j]);
+    }
+
+    // Chien search for the roots X_j^-1, then Forney: e_j = X_j omega(X_j^-1) / psi'(X_j^-1)
+    int pos[nsym], npos = 0;
+    uint8_t mag[nsym];
+    for(int j = 0; j < n && npos <= deg; j++) {
+        const uint8_t xi = gf_exp[(255 - j) % 255];
+        if(gf_eval(psi, deg, xi)) continue;
+        uint8_t dp = 0;
+        for(int i = 1; i <= deg; i += 2) dp ^= gf_mul(psi[i], gf_exp[(gf_log[xi] * (i - 1)) % 255]);
+        if(npos == deg || dp == 0) return -1;
+        pos[npos] = j;
+        mag[npos++] = gf_mul(gf_exp[j], gf_div(gf_eval(om, nsym - 1, xi), dp));
+    }
+    if(npos != deg) return -1;
+
+    for(int i = 0; i < npos; i++) c[pos[i]] ^= mag[i];
+    for(int i = 0; i < nsym; i++) {
+        if(gf_eval(c, n - 1, gf_exp[i])) {
+            for(int k = 0; k < npos; k++) c[pos[k]] ^= mag[k];
+            return -1;
+        }
+    }
+    int fixed = 0;
+    for(int i = 0; i < npos; i++) fixed += mag[i] != 0;
+    return fixed;
+}
+
+#endif
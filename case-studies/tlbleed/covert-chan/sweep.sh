@@ -0,0 +1,90 @@
+#!/bin/bash
+
+# TWEAKABLES
+# Pair of co-resident logical cores: the channel runs on RECVCORE; for the "inuse" rows the
+# TLBleed sender (../madtlb -s) runs on SENDCORE as a noisy neighbour. Empty SENDCORE skips those.
+# Recommended to isolate them from the rest of the scheduler w/ cpusets
+RECVCORE=2
+SENDCORE=6
+
+# Every combination of these is one run
+VARIANTS="covert-naive covert-ninja covert-naive-fec covert-ninja-fec"
+THRESHOLDS="0"          # -t: 0 calibrates and tracks drift, others are fixed cycle counts
+WORDLENS="32"           # -w: the crc8 variants only take 32, the FEC ones multiples of 8 up to 64
+DELAYS="0 4 16"         # -d: DO_DELAY rounds between sending a word and reading it back
+
+FRAMES=20000            # -n: words to receive per run
+FEC_FRAMES=500          # -n: blocks (of 32 words) per run of the FEC variants
+TIMEOUT=60              # seconds until a run counts as a sync failure
+
+RESULTS=sweep.txt
+
+# END TWEAKABLES
+
+set -e
+
+make -s
+[ -z "$SENDCORE" ] || make -s -C .. madtlb
+
+# Pull the numbers out of a run's output; lost counts the frames (blocks) the receiver failed to
+# get and asked for again
+function parse {
+	awk -v wl="$1" '
+	/^elapsed:/ {
+		el = $2
+		for (i = 1; i < NF; i++) {
+			if ($i == "kbit:") { if ($(i - 1) == "raw") raw = $(i + 1); else kbit = $(i + 1) }
+			if ($i == "undetected") und = $(i + 2)
+			if ($i == "lost") lost = $(i + 2)
+		}
+	}
+	/^words sent/ { words = $3; berr = $6 }
+	END {
+		if (words == "" || lost == "") exit 1
+		printf "%10.1f %10.1f %10.6f %8d %8d %8.2f\n", kbit, raw, berr / (words * wl), lost, und, el
+	}'
+}
+
+function sweep {
+	for v in $VARIANTS; do
+		case $v in
+			*-fec) n=$FEC_FRAMES ;;
+			*) n=$FRAMES ;;
+		esac
+		for t in $THRESHOLDS; do
+			for w in $WORDLENS; do
+				case $v in
+					*-fec) ;;
+					*) [ "$w" = 32 ] || continue ;;
+				esac
+				for d in $DELAYS; do
+					rm -f /tmp/.tlb-covert-channel-*
+					printf "%-6s %-17s %6s %7s %6s " "$1" "$v" "$t" "$w" "$d" >> "$RESULTS"
+					status=0
+					out=$(timeout $TIMEOUT taskset -c $RECVCORE ./$v -q -t $t -w $w -d $d -n $n $RECVCORE 2>/dev/null) || status=$?
+					if [ $status = 124 ]; then
+						echo "timeout" >> "$RESULTS"
+					elif [ $status != 0 ] || ! echo "$out" | parse $w >> "$RESULTS"; then
+						echo "fail" >> "$RESULTS"
+					fi
+				done
+			done
+		done
+	done
+}
+
+printf "%-6s %-17s %6s %7s %6s %10s %10s %10s %8s %8s %8s\n" load variant thresh wordlen delay \
+	kbit "raw kbit" ber lost undet secs > "$RESULTS"
+
+echo "Sweeping clear channel..."
+sweep clear
+
+if [ -n "$SENDCORE" ]; then
+	echo "Sweeping in-use channel..."
+	taskset -c $SENDCORE ../madtlb -s 2>> /dev/null &
+	sendpid=$!
+	sweep inuse
+	kill $sendpid
+fi
+
+cat "$RESULTS"
@@ -4,17 +4,30 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <limits.h>
 
 #include <time.h>
 #include <unistd.h>
 #include <sys/mman.h>
 
 
+/* Defaults for the receiver suboptions (see USAGE) */
 #define USE_L2 (0)
 #define NINJA (0)
 
 #define L1_SHORT_NINJA (0)
 
+/* L2 set probes: re-sync on the schedule cache-ninja (gen -R) planned for the chain, instead of
+ * every NINJA_THRESH rounds */
+#define BELIEF_RESYNC (0)
+
+/* Chase through straight-line routines generated at startup instead of the ipchase loop */
+#define JIT_CHASE (0)
+
+static int l1_short = L1_SHORT_NINJA;
+static int use_resync = BELIEF_RESYNC;
+static int use_jit = JIT_CHASE;
+
 #define NMEAS (20)
 
 static inline long usecdiff(struct timespec *t0, struct timespec *t)
@@ -36,14 +49,17 @@ static inline long usecdiff(struct timespec *t0, struct timespec *t)
 #define TARGOFF (0x887L * PAGESZ)
 #define TARGET ((char *)TBUFBASE + TARGOFF)
 
+/* Both buffers are sparse: the chains only ever touch a few pages per set, which get faulted in
+ * when the chains are built (tbuf) or on the first eviction run (evbuf, read-only, so all of its
+ * pages share the zero page) */
 static void *setup_evbuf(void)
 {
-	return mmap(NULL, EVBSZ, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+	return mmap(NULL, EVBSZ, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
 }
 static void *setup_tbuf(void)
 {
 	assert((char *)TBUFBASE + EVBSZ > TARGET);
-	return mmap(TBUFBASE, EVBSZ, PROT_READ|PROT_WRITE, MAP_FIXED|MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+	return mmap(TBUFBASE, EVBSZ, PROT_READ|PROT_WRITE, MAP_FIXED|MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
 }
 
 #define TLLINE(x) ((x) >> 12)
@@ -56,21 +72,36 @@ static inline uintptr_t TSL2(uintptr_t va)
 	return (p ^ (p >> 7)) & 0x7f;
 }
 
+/* Next page after cur in L1 dTLB set l1t and sTLB set l2t, at the same page offset. Splitting
+ * the page number as hi << 7 | lo, TSL2 is lo ^ (hi & 0x7f) and TDL1 is lo & 0xf, so both match
+ * iff hi & 0xf == (l1t ^ l2t) & 0xf and lo == (l2t ^ hi) & 0x7f: one page in every 2048. */
 static void *tlb_nexthit(void *cur, uintptr_t l1t, uintptr_t l2t)
 {
-	uintptr_t p = (uintptr_t)cur;
-	do {
-		p += PAGESZ;
-	} while (TDL1(p) != l1t || TSL2(p) != l2t);
-	return (void *)p;
+	uintptr_t n = TLLINE((uintptr_t)cur) + 1;
+	uintptr_t hi = n >> 7;
+	hi += ((l1t ^ l2t) - hi) & 0xf;
+	if ((hi << 7 | ((l2t ^ hi) & 0x7f)) < n)
+		hi += 16;
+	n = hi << 7 | ((l2t ^ hi) & 0x7f);
+	return (void *)(n << 12 | ((uintptr_t)cur & (PAGESZ - 1)));
 }
 static void *tlb_nexthit_l1(void *cur, uintptr_t l1t)
 {
-	uintptr_t p = (uintptr_t)cur;
-	do {
-		p += PAGESZ;
-	} while (TDL1(p) != l1t);
-	return (void *)p;
+	uintptr_t n = TLLINE((uintptr_t)cur) + 1;
+	n += (l1t - n) & 0xf;
+	return (void *)(n << 12 | ((uintptr_t)cur & (PAGESZ - 1)));
+}
+
+#define LINESZ (64)
+/* A cache line of a chain page; hops only use its first word */
+typedef void *tlb_line[LINESZ / sizeof(void *)];
+
+/* Cache line first of the page holding pg. Pages in one dTLB set agree on VA bits 12-15, so the
+ * L1D and L2 set of a hop only depends on its line within the page: chain builders give every
+ * hop (page i, slot k) a line of its own, so that cache-set conflicts stay out of the timings. */
+static inline tlb_line *tlb_lines(void *pg, unsigned first)
+{
+	return (tlb_line *)((uintptr_t)pg & -(uintptr_t)PAGESZ) + first;
 }
 
 static inline void tlb_evrun(void *base, uintptr_t targ, size_t n)
@@ -96,7 +127,7 @@ static void **tlb_prep_l1(void *base, uintptr_t targ)
 	void *p = base;
 	void **ev[TLB_PREPSZ_L1];
 	for (int i = 0; i < TLB_PREPSZ_L1; i++) {
-		ev[i] = (void **)tlb_nexthit_l1(p, l1t);
+		ev[i] = (void **)tlb_lines(tlb_nexthit_l1(p, l1t), i);
 		p = ev[i];
 	}
 	for (int i = 0; i < TLB_PREPSZ_L1 - 1; i++) {
@@ -106,74 +137,80 @@ static void **tlb_prep_l1(void *base, uintptr_t targ)
 	return ev[0];
 }
 
-#if (L1_SHORT_NINJA)
 /*|-------------| <-- lead-in
  * 0 1 0 2 0 2 3 (2 3 1 | 3 1 0 | 1 0 2 | 0 2 3) */
 /* Implemented as (0 1 0 2 0 2 3 2 3 1 3 1) */
-#define NINJA_L1_INIT (7)
-#define NINJA_L1_STEP (3)
-static void **tlb_prepninja_l1(void *base, uintptr_t targ)
+#define NINJA_L1S_INIT (7)
+#define NINJA_L1S_STEP (3)
+static void **tlb_prepninja_l1_short(void *base, uintptr_t targ)
 {
 	uintptr_t l1t = TDL1(targ);
 	//fprintf(stderr, "%"PRIxPTR"\n", l1t);
 	void *p = base;
-	void **ev[4];
+	tlb_line *ev[4];
 	for (int i = 0; i < 4; i++) {
-		ev[i] = tlb_nexthit_l1(p, l1t);
+		ev[i] = tlb_lines(tlb_nexthit_l1(p, l1t), 4 * i);
 		p = ev[i];
 	}
-	ev[0][0] = &ev[1][0];
-	ev[0][1] = &ev[2][0];
-	ev[0][2] = &ev[2][1];
-
-	ev[1][0] = &ev[0][1];
-	ev[1][1] = &ev[3][2];
-	ev[1][2] = &ev[0][0];
-
-	ev[2][0] = &ev[0][2];
-	ev[2][1] = &ev[3][0];
-	ev[2][2] = &ev[3][1];
-
-	ev[3][0] = &ev[2][2];
-	ev[3][1] = &ev[1][1];
-	ev[3][2] = &ev[1][2];
-	return ev[0];
+	ev[0][0][0] = &ev[1][0];
+	ev[0][1][0] = &ev[2][0];
+	ev[0][2][0] = &ev[2][1];
+
+	ev[1][0][0] = &ev[0][1];
+	ev[1][1][0] = &ev[3][2];
+	ev[1][2][0] = &ev[0][0];
+
+	ev[2][0][0] = &ev[0][2];
+	ev[2][1][0] = &ev[3][0];
+	ev[2][2][0] = &ev[3][1];
+
+	ev[3][0][0] = &ev[2][2];
+	ev[3][1][0] = &ev[1][1];
+	ev[3][2][0] = &ev[1][2];
+	return ev[0][0];
 }
-#else
+
 /*|-------| <-- lead-in
  * 0 1 2 3 (2 3 0 | 3 0 1 | 0 1 2 | 1 2 3)
  * Impl as (0 | 1 2 3 2 3 0 3 0 1 0 1 2) */
-#define NINJA_L1_INIT (4)
-#define NINJA_L1_STEP (3)
-static void **tlb_prepninja_l1(void *base, uintptr_t targ)
+#define NINJA_L1L_INIT (4)
+#define NINJA_L1L_STEP (3)
+static void **tlb_prepninja_l1_long(void *base, uintptr_t targ)
 {
 	uintptr_t l1t = TDL1(targ);
 	//fprintf(stderr, "%"PRIxPTR"\n", l1t);
 	void *p = base;
-	void **ev[4];
+	tlb_line *ev[4];
 	for (int i = 0; i < 4; i++) {
-		ev[i] = tlb_nexthit_l1(p, l1t);
+		ev[i] = tlb_lines(tlb_nexthit_l1(p, l1t), 4 * i);
 		p = ev[i];
 	}
-	ev[0][0] = &ev[1][0];
-	ev[0][1] = &ev[3][2];
-	ev[0][2] = &ev[1][1];
-	ev[0][3] = &ev[1][2];
-
-	ev[1][0] = &ev[2][0];
-	ev[1][1] = &ev[0][3];
-	ev[1][2] = &ev[2][2];
-
-	ev[2][0] = &ev[3][0];
-	ev[2][1] = &ev[3][1];
-	ev[2][2] = &ev[1][0];
-
-	ev[3][0] = &ev[2][1];
-	ev[3][1] = &ev[0][1];
-	ev[3][2] = &ev[0][2];
-	return ev[0];
+	ev[0][0][0] = &ev[1][0];
+	ev[0][1][0] = &ev[3][2];
+	ev[0][2][0] = &ev[1][1];
+	ev[0][3][0] = &ev[1][2];
+
+	ev[1][0][0] = &ev[2][0];
+	ev[1][1][0] = &ev[0][3];
+	ev[1][2][0] = &ev[2][2];
+
+	ev[2][0][0] = &ev[3][0];
+	ev[2][1][0] = &ev[3][1];
+	ev[2][2][0] = &ev[1][0];
+
+	ev[3][0][0] = &ev[2][1];
+	ev[3][1][0] = &ev[0][1];
+	ev[3][2][0] = &ev[0][2];
+	return ev[0][0];
+}
+
+/* Either of the above, as picked with suboption 's' */
+#define NINJA_L1_INIT (l1_short ? NINJA_L1S_INIT : NINJA_L1L_INIT)
+#define NINJA_L1_STEP (l1_short ? NINJA_L1S_STEP : NINJA_L1L_STEP)
+static void **tlb_prepninja_l1(void *base, uintptr_t targ)
+{
+	return l1_short ? tlb_prepninja_l1_short(base, targ) : tlb_prepninja_l1_long(base, targ);
 }
-#endif
 
 static void **tlb_prepnaive(void *base, uintptr_t targ)
 {
@@ -183,7 +220,7 @@ static void **tlb_prepnaive(void *base, uintptr_t targ)
 	void *p = base;
 	void **ev[TLB_PREPSZ];
 	for (int i = 0; i < TLB_PREPSZ; i++) {
-		ev[i] = (void **)tlb_nexthit(p, l1t, l2t);
+		ev[i] = (void **)tlb_lines(tlb_nexthit(p, l1t, l2t), i);
 		p = ev[i];
 	}
 	for (int i = 0; i < TLB_PREPSZ - 1; i++) {
@@ -205,54 +242,54 @@ static void **tlb_prepninja(void *base, uintptr_t targ)
 	uintptr_t l2t = TSL2(targ);
 	//fprintf(stderr, "%" PRIxPTR " %" PRIxPTR "\n", l1t, l2t);
 	void *p = base;
-	void **ev[9];
+	tlb_line *ev[9];
 	for (int i = 0; i < 9; i++) {
 		p = tlb_nexthit(p, l1t, l2t);
-		ev[i] = (void **)p;
+		ev[i] = tlb_lines(p, 6 * i);
 	}
-	ev[0][0] = &ev[1][0];
-	ev[0][1] = &ev[2][1];
-	ev[0][2] = &ev[2][2];
-	ev[0][3] = &ev[8][0];
-	ev[0][4] = &ev[2][4];
-	ev[0][5] = &ev[4][2];
-
-	ev[1][0] = &ev[2][0];
-	ev[1][1] = &ev[6][0];
-	ev[1][2] = &ev[0][3];
-	ev[1][3] = &ev[5][1];
-	ev[1][4] = &ev[0][5];
-	ev[1][5] = &ev[6][0]; // <-- looplink here
-
-	ev[2][0] = &ev[3][0];
-	ev[2][1] = &ev[1][1];
-	ev[2][2] = &ev[7][0];
-	ev[2][3] = &ev[1][3];
-	ev[2][4] = &ev[3][2];
-	ev[2][5] = &ev[1][5];
-
-	ev[3][0] = &ev[4][0];
-	ev[3][1] = &ev[0][2];
-	ev[3][2] = &ev[8][1];
-
-	ev[4][0] = &ev[5][0];
-	ev[4][1] = &ev[1][2];
-	ev[4][2] = &ev[5][2];
-
-	ev[5][0] = &ev[0][1];
-	ev[5][1] = &ev[7][1];
-	ev[5][2] = &ev[2][1]; // was [2][5]
-
-	ev[6][0] = &ev[3][1];
-	ev[6][1] = &ev[2][3];
-
-	ev[7][0] = &ev[4][1];
-	ev[7][1] = &ev[0][4];
-
-	ev[8][0] = &ev[6][1];
-	ev[8][1] = &ev[1][4];
-
-	return ev[0];
+	ev[0][0][0] = &ev[1][0];
+	ev[0][1][0] = &ev[2][1];
+	ev[0][2][0] = &ev[2][2];
+	ev[0][3][0] = &ev[8][0];
+	ev[0][4][0] = &ev[2][4];
+	ev[0][5][0] = &ev[4][2];
+
+	ev[1][0][0] = &ev[2][0];
+	ev[1][1][0] = &ev[6][0];
+	ev[1][2][0] = &ev[0][3];
+	ev[1][3][0] = &ev[5][1];
+	ev[1][4][0] = &ev[0][5];
+	ev[1][5][0] = &ev[6][0]; // <-- looplink here
+
+	ev[2][0][0] = &ev[3][0];
+	ev[2][1][0] = &ev[1][1];
+	ev[2][2][0] = &ev[7][0];
+	ev[2][3][0] = &ev[1][3];
+	ev[2][4][0] = &ev[3][2];
+	ev[2][5][0] = &ev[1][5];
+
+	ev[3][0][0] = &ev[4][0];
+	ev[3][1][0] = &ev[0][2];
+	ev[3][2][0] = &ev[8][1];
+
+	ev[4][0][0] = &ev[5][0];
+	ev[4][1][0] = &ev[1][2];
+	ev[4][2][0] = &ev[5][2];
+
+	ev[5][0][0] = &ev[0][1];
+	ev[5][1][0] = &ev[7][1];
+	ev[5][2][0] = &ev[2][1]; // was [2][5]
+
+	ev[6][0][0] = &ev[3][1];
+	ev[6][1][0] = &ev[2][3];
+
+	ev[7][0][0] = &ev[4][1];
+	ev[7][1][0] = &ev[0][4];
+
+	ev[8][0][0] = &ev[6][1];
+	ev[8][1][0] = &ev[1][4];
+
+	return ev[0][0];
 }
 
 /*|-----------------------------------------| <-- lead-in
@@ -266,76 +303,77 @@ static void **tlb_prepninja_splice(void *base, uintptr_t targ)
 	uintptr_t l1t = TDL1(targ);
 	uintptr_t l2t = TSL2(targ);
 	//fprintf(stderr, "%" PRIxPTR " %" PRIxPTR "\n", l1t, l2t);
+	static const unsigned char line[9] = {0, 5, 15, 24, 33, 38, 42, 46, 50};
 	void *p = base;
-	void **ev[9];
+	tlb_line *ev[9];
 	for (int i = 0; i < 9; i++) {
 		p = tlb_nexthit(p, l1t, l2t);
-		ev[i] = (void **)p;
+		ev[i] = tlb_lines(p, line[i]);
 	}
-	ev[0][0] = &ev[1][0];
-	ev[0][1] = &ev[3][1];
-	ev[0][2] = &ev[3][2];
-	ev[0][3] = &ev[7][3];
-	ev[0][4] = &ev[8][2];
-
-	ev[1][0] = &ev[2][0];
-	ev[1][1] = &ev[3][0];
-	ev[1][2] = &ev[6][0];
-	ev[1][3] = &ev[3][3];
-	ev[1][4] = &ev[3][4];
-	ev[1][5] = &ev[5][1];
-	ev[1][6] = &ev[5][2];
-	ev[1][7] = &ev[3][7];
-	ev[1][8] = &ev[3][8];
-	ev[1][9] = &ev[6][3];
-
-	ev[2][0] = &ev[1][1];
-	ev[2][1] = &ev[1][2];
-	ev[2][2] = &ev[7][0];
-	ev[2][3] = &ev[7][1];
-	ev[2][4] = &ev[1][5];
-	ev[2][5] = &ev[1][6];
-	ev[2][6] = &ev[0][3];
-	ev[2][7] = &ev[0][4];
-	ev[2][8] = &ev[1][9];
-
-	ev[3][0] = &ev[4][0];
-	ev[3][1] = &ev[2][2];
-	ev[3][2] = &ev[2][3];
-	ev[3][3] = &ev[8][0];
-	ev[3][4] = &ev[8][1];
-	ev[3][5] = &ev[2][6];
-	ev[3][6] = &ev[2][7];
-	ev[3][7] = &ev[4][3];
-	ev[3][8] = &ev[4][4];
-
-	ev[4][0] = &ev[5][0];
-	ev[4][1] = &ev[1][3];
-	ev[4][2] = &ev[1][4];
-	ev[4][3] = &ev[8][3];
-	ev[4][4] = &ev[5][3];
-
-	ev[5][0] = &ev[2][1];
-	ev[5][1] = &ev[6][2];
-	ev[5][2] = &ev[7][2];
-	ev[5][3] = &ev[2][8];
-
-	ev[6][0] = &ev[0][1];
-	ev[6][1] = &ev[2][4];
-	ev[6][2] = &ev[2][5];
-	ev[6][3] = &ev[5][0]; // <- looplink here
-
-	ev[7][0] = &ev[0][2];
-	ev[7][1] = &ev[4][1];
-	ev[7][2] = &ev[3][5];
-	ev[7][3] = &ev[3][6];
-
-	ev[8][0] = &ev[4][2];
-	ev[8][1] = &ev[6][1];
-	ev[8][2] = &ev[1][7];
-	ev[8][3] = &ev[1][8];
-
-	return ev[0];
+	ev[0][0][0] = &ev[1][0];
+	ev[0][1][0] = &ev[3][1];
+	ev[0][2][0] = &ev[3][2];
+	ev[0][3][0] = &ev[7][3];
+	ev[0][4][0] = &ev[8][2];
+
+	ev[1][0][0] = &ev[2][0];
+	ev[1][1][0] = &ev[3][0];
+	ev[1][2][0] = &ev[6][0];
+	ev[1][3][0] = &ev[3][3];
+	ev[1][4][0] = &ev[3][4];
+	ev[1][5][0] = &ev[5][1];
+	ev[1][6][0] = &ev[5][2];
+	ev[1][7][0] = &ev[3][7];
+	ev[1][8][0] = &ev[3][8];
+	ev[1][9][0] = &ev[6][3];
+
+	ev[2][0][0] = &ev[1][1];
+	ev[2][1][0] = &ev[1][2];
+	ev[2][2][0] = &ev[7][0];
+	ev[2][3][0] = &ev[7][1];
+	ev[2][4][0] = &ev[1][5];
+	ev[2][5][0] = &ev[1][6];
+	ev[2][6][0] = &ev[0][3];
+	ev[2][7][0] = &ev[0][4];
+	ev[2][8][0] = &ev[1][9];
+
+	ev[3][0][0] = &ev[4][0];
+	ev[3][1][0] = &ev[2][2];
+	ev[3][2][0] = &ev[2][3];
+	ev[3][3][0] = &ev[8][0];
+	ev[3][4][0] = &ev[8][1];
+	ev[3][5][0] = &ev[2][6];
+	ev[3][6][0] = &ev[2][7];
+	ev[3][7][0] = &ev[4][3];
+	ev[3][8][0] = &ev[4][4];
+
+	ev[4][0][0] = &ev[5][0];
+	ev[4][1][0] = &ev[1][3];
+	ev[4][2][0] = &ev[1][4];
+	ev[4][3][0] = &ev[8][3];
+	ev[4][4][0] = &ev[5][3];
+
+	ev[5][0][0] = &ev[2][1];
+	ev[5][1][0] = &ev[6][2];
+	ev[5][2][0] = &ev[7][2];
+	ev[5][3][0] = &ev[2][8];
+
+	ev[6][0][0] = &ev[0][1];
+	ev[6][1][0] = &ev[2][4];
+	ev[6][2][0] = &ev[2][5];
+	ev[6][3][0] = &ev[5][0]; // <- looplink here
+
+	ev[7][0][0] = &ev[0][2];
+	ev[7][1][0] = &ev[4][1];
+	ev[7][2][0] = &ev[3][5];
+	ev[7][3][0] = &ev[3][6];
+
+	ev[8][0][0] = &ev[4][2];
+	ev[8][1][0] = &ev[6][1];
+	ev[8][2][0] = &ev[1][7];
+	ev[8][3][0] = &ev[1][8];
+
+	return ev[0][0];
 }
 
 
@@ -347,93 +385,97 @@ static void **tlb_prepnaive_splice(void *base, uintptr_t targ)
 	uintptr_t l1t = TDL1(targ);
 	uintptr_t l2t = TSL2(targ);
 	//fprintf(stderr, "%" PRIxPTR " %" PRIxPTR "\n", l1t, l2t);
+	static const unsigned char line[24] = {
+		0, 2, 4, 6, 8, 10, 12, 14, 16, 19, 22, 25,
+		28, 30, 32, 34, 36, 38, 40, 42, 44, 47, 50, 53
+	};
 	void *p = base;
-	void **ev[24];
+	tlb_line *ev[24];
 	for (int i = 0; i < 24; i++) {
-		ev[i] = (void **)tlb_nexthit(p, l1t, l2t);
+		ev[i] = tlb_lines(tlb_nexthit(p, l1t, l2t), line[i]);
 		p = ev[i];
 	}
-	ev[0][0] = &ev[1][0];
-	ev[0][1] = &ev[1][1];
+	ev[0][0][0] = &ev[1][0];
+	ev[0][1][0] = &ev[1][1];
 
-	ev[1][0] = &ev[2][0];
-	ev[1][1] = &ev[2][1];
+	ev[1][0][0] = &ev[2][0];
+	ev[1][1][0] = &ev[2][1];
 
-	ev[2][0] = &ev[3][0];
-	ev[2][1] = &ev[3][1];
+	ev[2][0][0] = &ev[3][0];
+	ev[2][1][0] = &ev[3][1];
 
-	ev[3][0] = &ev[4][0];
-	ev[3][1] = &ev[4][1];
+	ev[3][0][0] = &ev[4][0];
+	ev[3][1][0] = &ev[4][1];
 
-	ev[4][0] = &ev[5][0];
-	ev[4][1] = &ev[5][1];
+	ev[4][0][0] = &ev[5][0];
+	ev[4][1][0] = &ev[5][1];
 
-	ev[5][0] = &ev[6][0];
-	ev[5][1] = &ev[6][1];
+	ev[5][0][0] = &ev[6][0];
+	ev[5][1][0] = &ev[6][1];
 
-	ev[6][0] = &ev[7][0];
-	ev[6][1] = &ev[7][1];
+	ev[6][0][0] = &ev[7][0];
+	ev[6][1][0] = &ev[7][1];
 
-	ev[7][0] = &ev[8][0];
-	ev[7][1] = &ev[8][2];
+	ev[7][0][0] = &ev[8][0];
+	ev[7][1][0] = &ev[8][2];
 
-	ev[8][0] = &ev[9][0];
-	ev[8][1] = &ev[9][1];
-	ev[8][2] = &ev[9][2];
+	ev[8][0][0] = &ev[9][0];
+	ev[8][1][0] = &ev[9][1];
+	ev[8][2][0] = &ev[9][2];
 
-	ev[9][0] = &ev[10][0];
-	ev[9][1] = &ev[10][1];
-	ev[9][2] = &ev[10][2];
+	ev[9][0][0] = &ev[10][0];
+	ev[9][1][0] = &ev[10][1];
+	ev[9][2][0] = &ev[10][2];
 
-	ev[10][0] = &ev[11][0];
-	ev[10][1] = &ev[11][1];
-	ev[10][2] = &ev[11][2];
+	ev[10][0][0] = &ev[11][0];
+	ev[10][1][0] = &ev[11][1];
+	ev[10][2][0] = &ev[11][2];
 
-	ev[11][0] = &ev[8][1];
-	ev[11][1] = &ev[0][1];
-	ev[11][2] = &ev[12][0];
+	ev[11][0][0] = &ev[8][1];
+	ev[11][1][0] = &ev[0][1];
+	ev[11][2][0] = &ev[12][0];
 
-	ev[12][0] = &ev[13][0];
-	ev[12][1] = &ev[13][1];
+	ev[12][0][0] = &ev[13][0];
+	ev[12][1][0] = &ev[13][1];
 
-	ev[13][0] = &ev[14][0];
-	ev[13][1] = &ev[14][1];
+	ev[13][0][0] = &ev[14][0];
+	ev[13][1][0] = &ev[14][1];
 
-	ev[14][0] = &ev[15][0];
-	ev[14][1] = &ev[15][1];
+	ev[14][0][0] = &ev[15][0];
+	ev[14][1][0] = &ev[15][1];
 
-	ev[15][0] = &ev[16][0];
-	ev[15][1] = &ev[16][1];
+	ev[15][0][0] = &ev[16][0];
+	ev[15][1][0] = &ev[16][1];
 
-	ev[16][0] = &ev[17][0];
-	ev[16][1] = &ev[17][1];
+	ev[16][0][0] = &ev[17][0];
+	ev[16][1][0] = &ev[17][1];
 
-	ev[17][0] = &ev[18][0];
-	ev[17][1] = &ev[18][1];
+	ev[17][0][0] = &ev[18][0];
+	ev[17][1][0] = &ev[18][1];
 
-	ev[18][0] = &ev[19][0];
-	ev[18][1] = &ev[19][1];
+	ev[18][0][0] = &ev[19][0];
+	ev[18][1][0] = &ev[19][1];
 
-	ev[19][0] = &ev[20][0];
-	ev[19][1] = &ev[20][2];
+	ev[19][0][0] = &ev[20][0];
+	ev[19][1][0] = &ev[20][2];
 
-	ev[20][0] = &ev[21][0];
-	ev[20][1] = &ev[21][1];
-	ev[20][2] = &ev[21][2];
+	ev[20][0][0] = &ev[21][0];
+	ev[20][1][0] = &ev[21][1];
+	ev[20][2][0] = &ev[21][2];
 
-	ev[21][0] = &ev[22][0];
-	ev[21][1] = &ev[22][1];
-	ev[21][2] = &ev[22][2];
+	ev[21][0][0] = &ev[22][0];
+	ev[21][1][0] = &ev[22][1];
+	ev[21][2][0] = &ev[22][2];
 
-	ev[22][0] = &ev[23][0];
-	ev[22][1] = &ev[23][1];
-	ev[22][2] = &ev[23][2];
+	ev[22][0][0] = &ev[23][0];
+	ev[22][1][0] = &ev[23][1];
+	ev[22][2][0] = &ev[23][2];
 
-	ev[23][0] = &ev[20][1];
-	ev[23][1] = &ev[12][1];
-	ev[23][2] = &ev[0][0];
+	ev[23][0][0] = &ev[20][1];
+	ev[23][1][0] = &ev[12][1];
+	ev[23][2][0] = &ev[0][0];
 
-	return ev[0];
+	return ev[0][0];
 }
 
 
@@ -463,6 +505,81 @@ static void **tlb_prepnaive_splice(void *base, uintptr_t targ)
 	: [probe]"+r" (head), "=a" (tim) : "c" (niter) : "rdx", "rdi", "rsi", "cc"\
 )
 
+/* Straight-line versions of ipchase()/ipfwd() for every chain length up to JIT_MAXN, emitted at
+ * startup: no loop counter, no taken branches between the two timestamps. Each takes a pointer
+ * to the chain cursor and advances it, like the macros; the timed ones return the cycle count. */
+#define JIT_MAXN (64)
+typedef uint32_t (jit_chase_f)(void ***cur);
+typedef void (jit_fwd_f)(void ***cur);
+static jit_chase_f *jit_chase[JIT_MAXN + 1];
+static jit_fwd_f *jit_fwd[JIT_MAXN + 1];
+
+static const unsigned char JIT_LOAD[] = {0x48, 0x8b, 0x37};      /* mov (%rdi),%rsi */
+static const unsigned char JIT_HOP[] = {0x48, 0x8b, 0x36};       /* mov (%rsi),%rsi */
+static const unsigned char JIT_LFENCE[] = {0x0f, 0xae, 0xe8};
+static const unsigned char JIT_T0[] = {0x0f, 0x31, 0x41, 0x89, 0xc0}; /* rdtsc; mov %eax,%r8d */
+static const unsigned char JIT_T1[] = {0x0f, 0x01, 0xf9, 0x44, 0x29, 0xc0}; /* rdtscp; sub %r8d,%eax */
+static const unsigned char JIT_STORE[] = {0x48, 0x89, 0x37, 0xc3}; /* mov %rsi,(%rdi); ret */
+
+#define JIT_EMIT(p, ins) ((unsigned char *)memcpy((p), (ins), sizeof(ins)) + sizeof(ins))
+
+static unsigned char *jit_emit(unsigned char *p, unsigned n, int timed)
+{
+	p = JIT_EMIT(p, JIT_LOAD);
+	p = JIT_EMIT(p, JIT_LFENCE);
+	if (timed)
+		p = JIT_EMIT(p, JIT_T0);
+	while (n--)
+		p = JIT_EMIT(p, JIT_HOP);
+	p = JIT_EMIT(p, JIT_LFENCE);
+	if (timed)
+		p = JIT_EMIT(p, JIT_T1);
+	return JIT_EMIT(p, JIT_STORE);
+}
+
+static int jit_setup(void)
+{
+	const size_t maxsz = sizeof(JIT_LOAD) + 2*sizeof(JIT_LFENCE) + sizeof(JIT_T0) + sizeof(JIT_T1) +
+	                     JIT_MAXN * sizeof(JIT_HOP) + sizeof(JIT_STORE);
+	const size_t sz = 2 * (JIT_MAXN + 1) * maxsz;
+	unsigned char *buf = mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	unsigned char *p = buf;
+	if (buf == MAP_FAILED)
+		return -1;
+	for (unsigned n = 0; n <= JIT_MAXN; n++) {
+		jit_chase[n] = (jit_chase_f *)p;
+		p = jit_emit(p, n, 1);
+		jit_fwd[n] = (jit_fwd_f *)p;
+		p = jit_emit(p, n, 0);
+	}
+	if (mprotect(buf, sz, PROT_READ|PROT_EXEC)) {
+		memset(jit_chase, 0, sizeof(jit_chase));
+		memset(jit_fwd, 0, sizeof(jit_fwd));
+		munmap(buf, sz);
+		return -1;
+	}
+	return 0;
+}
+
+/* What the probe loops call: the JIT routines with suboption 'x', the asm loops otherwise */
+#define tchase(head, niter, tim) do {\
+	if (use_jit) {\
+		assert((niter) <= JIT_MAXN);\
+		(tim) = jit_chase[niter](&(head));\
+	} else {\
+		ipchase(head, niter, tim);\
+	}\
+} while (0)
+
+#define tfwd(head, niter) do {\
+	if (use_jit) {\
+		assert((niter) <= JIT_MAXN);\
+		jit_fwd[niter](&(head));\
+	} else {\
+		ipfwd(head, niter);\
+	}\
+} while (0)
+
 static void pprint(void **head, size_t n)
 {
 	while (n--) {
@@ -476,6 +593,33 @@ static void pprint(void **head, size_t n)
 
 #define NINJA_ROUNDS (16*_K)
 #define NINJA_THRESH (2048)
+#include "ninja_resync.h"
+#ifdef NINJA_RS_NNODES
+#error "ninja_resync.h holds a re-sync table; madtlb follows only the fixed schedules gen -R emits when there is none"
+#endif
+/* Rounds between re-syncs on the planned schedule; 0 means the chain needs none after the first */
+#define NINJA_RS_THRESH (NINJA_RS_PERIOD ? NINJA_RS_PERIOD : LONG_MAX)
+
+/* Full reset on the planned schedule: fresh pages, the lead-in and the rounds too early to time.
+ * Returns the chain position, with the phase timed next in *ph. */
+static void **rs_reset(void *tebuf, uintptr_t targ, void **njhead, unsigned *ph)
+{
+	void **c = njhead;
+
+	tlb_evrun(tebuf, targ, NINJA_RS_PREP);
+	tfwd(c, NINJA_RS_LEADIN);
+	for (*ph = 0; *ph < NINJA_RS_SKIP; (*ph)++)
+		tfwd(c, (unsigned)ninja_steps[*ph % NINJA_NSTEPS]);
+	*ph %= NINJA_NSTEPS;
+	return c;
+}
+/* Cycles above which a timed step counts as slow, until calibrated; as TIMETHRESH_NINJA in covert-chan */
+#define RESYNC_SLOW (108)
+
+#include "thresh.h"
+
+static struct thresh slow_th = {RESYNC_SLOW, {0, 0}, 0};
+
 #define TIMSZ (32)
 
 //static void prtim(uint32_t tim[TIMSZ])
@@ -583,7 +727,8 @@ static void do_walkup(void *tebuf)
 	}
 }
 
-static void do_recv(void *tebuf, const int oneshot, const int use_l2, const int use_ninja)
+/* Returns the rate of the last measurement, in samples per second */
+static long do_recv(void *tebuf, const int oneshot, const int use_l2, const int use_ninja)
 {
 	//volatile char const *dummy = tlb_nexthit(tebuf, TDL1((uintptr_t)TARGET), TSL2((uintptr_t)TARGET));
 	//#define DUMMY() do { (void)*dummy; } while (0)
@@ -594,6 +739,7 @@ static void do_recv(void *tebuf, const int oneshot, const int use_l2, const int
 	char *evmode;
 	int evpplen;
 	long int it = NMEAS;
+	long rps;
 
 	if (use_l2) {
 		if (use_ninja) {
@@ -636,12 +782,12 @@ static void do_recv(void *tebuf, const int oneshot, const int use_l2, const int
 				for (size_t r = NINJA_ROUNDS; r-- > 0;) {
 					njcur = njhead;
 					tlb_evrun(tebuf, (uintptr_t)TARGET, TLB_PREPSZ);
-					ipchase(njcur, NINJA_L2_INIT, tim[0]);
+					tchase(njcur, NINJA_L2_INIT, tim[0]);
 
 					for (size_t n = NINJA_THRESH/TIMSZ; n-- > 0;) {
 						for (size_t ti = 0; ti < TIMSZ; ti++) {
 							DUMMY();
-							ipchase(njcur, NINJA_L2_STEP, tim[ti]);
+							tchase(njcur, NINJA_L2_STEP, tim[ti]);
 						}
 						//prtim(tim);
 					}
@@ -651,7 +797,7 @@ static void do_recv(void *tebuf, const int oneshot, const int use_l2, const int
 				for (size_t r = NINJA_ROUNDS*NINJA_THRESH/TIMSZ; r-- > 0;) {
 					for (size_t ti = 0; ti < TIMSZ; ti++) {
 						DUMMY();
-						ipchase(njcur, TLB_PREPSZ, tim[ti]);
+						tchase(njcur, TLB_PREPSZ, tim[ti]);
 					}
 				}
 			}
@@ -659,12 +805,12 @@ static void do_recv(void *tebuf, const int oneshot, const int use_l2, const int
 			if (use_ninja) {
 				for (size_t r = NINJA_ROUNDS; r-- > 0;) {
 					njcur = njhead;
-					ipchase(njcur, NINJA_L1_INIT, tim[0]);
+					tchase(njcur, NINJA_L1_INIT, tim[0]);
 
 					for (size_t n = NINJA_THRESH/TIMSZ; n-- > 0;) {
 						for (size_t ti = 0; ti < TIMSZ; ti++) {
 							DUMMY();
-							ipchase(njcur, NINJA_L1_STEP, tim[ti]);
+							tchase(njcur, NINJA_L1_STEP, tim[ti]);
 						}
 					}
 				}
@@ -672,19 +818,52 @@ static void do_recv(void *tebuf, const int oneshot, const int use_l2, const int
 				for (size_t r = NINJA_ROUNDS*NINJA_THRESH/TIMSZ; r-- > 0;) {
 					for (size_t ti = 0; ti < TIMSZ; ti++) {
 						DUMMY();
-						ipchase(njcur, TLB_PREPSZ_L1, tim[ti]);
+						tchase(njcur, TLB_PREPSZ_L1, tim[ti]);
 					}
 				}
 			}
 		}
 		clock_gettime(CLOCK_REALTIME, &t);
 		diff = usecdiff(&t0, &t);
-		long rps = NINJA_ROUNDS*NINJA_THRESH*1000000L/diff;
+		rps = NINJA_ROUNDS*NINJA_THRESH*1000000L/diff;
 		double mps = (double)(NINJA_ROUNDS*NINJA_THRESH)/diff;
 		if (!oneshot)
 			fprintf(stderr, "Recv'd %lu bits in %ld us (rate: %ld / sec ~= %4.1f M / sec)\n",
 		            NINJA_ROUNDS*NINJA_THRESH, diff, rps, mps);
 	} while (!oneshot && --it);
+	return rps;
+}
+
+/* Receive-rate of every strategy, with the ipchase loops and with the JIT routines */
+static void do_bench(void *tebuf)
+{
+	static const struct {
+		const char *name;
+		int l2, ninja, l1short;
+	} strat[] = {
+		{"Naive L1 (TLBleed-like)", 0, 0, 0},
+		{"Ninja L1", 0, 1, 0},
+		{"Ninja L1 (short lead-in)", 0, 1, 1},
+		{"Naive L2", 1, 0, 0},
+		{"Ninja L2", 1, 1, 0},
+	};
+	const int jit = use_jit;
+	const int hasjit = jit_chase[1] != NULL;
+	fputs("Strategy                   loop M/s   JIT M/s\n", stderr);
+	for (size_t i = 0; i < sizeof(strat) / sizeof(*strat); i++) {
+		double mps[2];
+		l1_short = strat[i].l1short;
+		for (use_jit = 0; use_jit < 2; use_jit++) {
+			if (use_jit && !hasjit) {
+				mps[1] = 0;
+				continue;
+			}
+			(void)do_recv(tebuf, 1, strat[i].l2, strat[i].ninja);
+			mps[use_jit] = do_recv(tebuf, 1, strat[i].l2, strat[i].ninja) / 1e6;
+		}
+		fprintf(stderr, "%-24s %10.1f %9.1f\n", strat[i].name, mps[0], mps[1]);
+	}
+	use_jit = jit;
 }
 
 
@@ -695,51 +874,277 @@ static void do_recv(void *tebuf, const int oneshot, const int use_l2, const int
 
 #include <alloca.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Sample output format: raw 32-bit cycle counts, 16/8-bit counts above arg saturating at the top,
+ * or one bit per sample, set when above arg, packed LSB first */
+enum { OUT_RAW, OUT_U16, OUT_U8, OUT_BITS };
+struct outfmt {
+	int enc;
+	uint32_t arg;
+};
+
+/* raw, u16[=BASE], u8[=BASE] or bits[=THRESH] */
+static int parse_outfmt(const char *s, struct outfmt *f)
+{
+	static const char *const names[] = {"raw", "u16", "u8", "bits"};
+	const char *eq = strchr(s, '=');
+	size_t len = eq ? (size_t)(eq - s) : strlen(s);
 
-static void do_probe(void *tebuf, const int use_l2, const int use_ninja, int ofd)
+	for (int i = 0; i < 4; i++) {
+		if (strlen(names[i]) == len && !strncmp(s, names[i], len)) {
+			f->enc = i;
+			f->arg = eq ? strtoul(eq + 1, NULL, 0) : i == OUT_BITS ? RESYNC_SLOW : 0;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Streaming output: the probe loop fills sample buffers taken from a single-producer single-
+ * consumer ring and hands them back full; a writer thread encodes and writes them out, so that
+ * the probe core never waits on I/O unless the whole ring is backed up. */
+#define RING_NBUF (8)
+#define RING_POLL_NS (50000)
+
+struct ring {
+	uint32_t *buf[RING_NBUF];
+	size_t n;
+	int fd;
+	struct outfmt fmt;
+	_Atomic size_t head, tail;
+	atomic_int done;
+	long stalls;
+	pthread_t thr;
+};
+
+static size_t ring_encode(const struct ring *r, const uint32_t *in, void *out)
 {
-	void ***njhead, ***njcur;
-	uint32_t *timbuf;
-	int nsets;
-	long ninjacnt = -1;
-	long int it = NMEAS;
+	switch (r->fmt.enc) {
+		case OUT_U16:
+			for (size_t i = 0; i < r->n; i++) {
+				uint32_t v = in[i] > r->fmt.arg ? in[i] - r->fmt.arg : 0;
+				((uint16_t *)out)[i] = v < UINT16_MAX ? v : UINT16_MAX;
+			}
+			return r->n * sizeof(uint16_t);
+		case OUT_U8:
+			for (size_t i = 0; i < r->n; i++) {
+				uint32_t v = in[i] > r->fmt.arg ? in[i] - r->fmt.arg : 0;
+				((uint8_t *)out)[i] = v < UINT8_MAX ? v : UINT8_MAX;
+			}
+			return r->n;
+		case OUT_BITS:
+			memset(out, 0, (r->n + 7) / 8);
+			for (size_t i = 0; i < r->n; i++)
+				((uint8_t *)out)[i / 8] |= (in[i] > r->fmt.arg) << (i % 8);
+			return (r->n + 7) / 8;
+		default:
+			memcpy(out, in, r->n * sizeof(*in));
+			return r->n * sizeof(*in);
+	}
+}
+
+static void *ring_writer(void *arg)
+{
+	struct ring *r = arg;
+	const struct timespec poll = {0, RING_POLL_NS};
+	void *enc = malloc(r->n * sizeof(uint32_t));
+	size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	for (;;) {
+		if (t == atomic_load_explicit(&r->head, memory_order_acquire)) {
+			if (atomic_load_explicit(&r->done, memory_order_acquire) &&
+			    t == atomic_load_explicit(&r->head, memory_order_acquire))
+				break;
+			nanosleep(&poll, NULL);
+			continue;
+		}
+		size_t len = ring_encode(r, r->buf[t % RING_NBUF], enc);
+		if (write(r->fd, enc, len) != (ssize_t)len)
+			perror("Error writing samples");
+		atomic_store_explicit(&r->tail, ++t, memory_order_release);
+	}
+	free(enc);
+	return NULL;
+}
+
+/* A ring of buffers of n samples each, written to fd in format fmt */
+static struct ring *ring_open(int fd, struct outfmt fmt, size_t n)
+{
+	struct ring *r = calloc(1, sizeof(*r));
+	r->n = n;
+	r->fd = fd;
+	r->fmt = fmt;
+	for (int i = 0; i < RING_NBUF; i++)
+		r->buf[i] = calloc(n, sizeof(**r->buf));
+	if (pthread_create(&r->thr, NULL, ring_writer, r)) {
+		perror("Error starting writer thread");
+		exit(2);
+	}
+	return r;
+}
+
+/* Next buffer to fill; spins only if the writer has fallen a whole ring behind */
+static uint32_t *ring_get(struct ring *r)
+{
+	size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+	if (h - atomic_load_explicit(&r->tail, memory_order_acquire) == RING_NBUF) {
+		r->stalls++;
+		while (h - atomic_load_explicit(&r->tail, memory_order_acquire) == RING_NBUF)
+			asm volatile ("pause");
+	}
+	return r->buf[h % RING_NBUF];
+}
+
+/* Hand the buffer from ring_get() to the writer */
+static void ring_put(struct ring *r)
+{
+	atomic_fetch_add_explicit(&r->head, 1, memory_order_release);
+}
+
+/* Flush what is queued and tear the ring down */
+static void ring_close(struct ring *r)
+{
+	atomic_store_explicit(&r->done, 1, memory_order_release);
+	pthread_join(r->thr, NULL);
+	if (r->stalls)
+		fprintf(stderr, "Output stalled the probe %ld times\n", r->stalls);
+	for (int i = 0; i < RING_NBUF; i++)
+		free(r->buf[i]);
+	free(r);
+}
+
+/* Chains for every set probed by do_probe(); returns the number of sets */
+static int probe_prep(const int use_l2, const int use_ninja, void ***njhead, void ***njcur)
+{
+	const int nsets = use_l2 ? L2SSETS : L1DSETS;
+	void **(*prep)(void *, uintptr_t);
 
 	if (use_l2) {
-		njhead = alloca(L2SSETS * sizeof(*njhead));
-		njcur = alloca(L2SSETS * sizeof(*njcur));
-		nsets = L2SSETS;
 		if (use_ninja) {
 			fputs("Ninja L2 probe\n", stderr);
-			for (int i = 0; i < L2SSETS; i++) {
-				njhead[i] = tlb_prepninja(TBUFBASE, (uintptr_t)TBUFBASE + i * PAGESZ);
-				njcur[i] = njhead[i];
-			}
+			prep = tlb_prepninja;
 		} else {
 			fputs("Naive L2 probe\n", stderr);
-			for (int i = 0; i < L2SSETS; i++) {
-				njhead[i] = tlb_prepnaive(TBUFBASE, (uintptr_t)TBUFBASE + i * PAGESZ);
-				njcur[i] = njhead[i];
-			}
+			prep = tlb_prepnaive;
 		}
 	} else {
-		njhead = alloca(L1DSETS * sizeof(*njhead));
-		njcur = alloca(L1DSETS * sizeof(*njcur));
-		nsets = L1DSETS;
 		if (use_ninja) {
 			fputs("Ninja L1 probe\n", stderr);
-			for (int i = 0; i < L1DSETS; i++) {
-				njhead[i] = tlb_prepninja_l1(TBUFBASE, (uintptr_t)TBUFBASE + i * PAGESZ);
-				njcur[i] = njhead[i];
-			}
+			prep = tlb_prepninja_l1;
 		} else {
 			fputs("Naive L1 (TLBleed-like) probe\n", stderr);
-			for (int i = 0; i < L1DSETS; i++) {
-				njhead[i] = tlb_prep_l1(TBUFBASE, (uintptr_t)TBUFBASE + i * PAGESZ);
-				njcur[i] = njhead[i];
+			prep = tlb_prep_l1;
+		}
+	}
+	for (int i = 0; i < nsets; i++) {
+		njhead[i] = prep(TBUFBASE, (uintptr_t)TBUFBASE + i * PAGESZ);
+		njcur[i] = njhead[i];
+	}
+	return nsets;
+}
+
+/* Advance k independent chains by n hops each, round-robin, so that their misses overlap */
+static inline void lockstep(void ***cur, int k, unsigned n)
+{
+	while (n--)
+		for (int i = 0; i < k; i++)
+			cur[i] = *cur[i];
+}
+
+#define SCAN_NPERM (16)
+
+/* Set order of probe_scan() pass rot: one of SCAN_NPERM random permutations of the nsets sets,
+ * drawn on first use */
+static const unsigned char *scan_order(int nsets, unsigned rot)
+{
+	static unsigned char perm[SCAN_NPERM][L2SSETS];
+	static int pn = 0;
+
+	if (pn != nsets) {
+		uint16_t rn = 0xace1;
+		for (int p = 0; p < SCAN_NPERM; p++) {
+			for (int i = 0; i < nsets; i++)
+				perm[p][i] = i;
+			for (int i = nsets - 1; i > 0; i--) {
+				rn = nxr(rn);
+				const int j = rn % (i + 1);
+				const unsigned char t = perm[p][i];
+				perm[p][i] = perm[p][j];
+				perm[p][j] = t;
+			}
+		}
+		pn = nsets;
+	}
+	return perm[rot % SCAN_NPERM];
+}
+
+/* One pass over all sets, k at a time. k == 1 times each set's whole step, as always. With k > 1,
+ * the group's chains run their whole steps in lockstep, with up to k page walks in flight, and
+ * the region is timed as one: every set in the group gets the group's sample. A timestamp per
+ * chain would not tell them apart either, since each waits for all loads before it, the other
+ * chains' included. Instead the groups change from pass to pass (see scan_order()), so that a set
+ * that stays slow for a few passes stands out from the partners it shared a group with in each. */
+static void probe_scan(void *tebuf, const int use_l2, const int use_ninja, void ***njhead, void ***njcur,
+                       int nsets, int k, unsigned rot, int resync, uint32_t *tim)
+{
+	const unsigned char *ord = k > 1 ? scan_order(nsets, rot) : NULL;
+	unsigned n;
+
+	if (!use_ninja)
+		n = use_l2 ? TLB_PREPSZ : TLB_PREPSZ_L1;
+	else if (resync)
+		n = use_l2 ? NINJA_L2_INIT : NINJA_L1_INIT;
+	else
+		n = use_l2 ? NINJA_L2_STEP : NINJA_L1_STEP;
+
+	for (int g = 0; g < nsets; g += k) {
+		const int gk = k < nsets - g ? k : nsets - g;
+		int set[gk];
+		void **cur[gk];
+		for (int i = 0; i < gk; i++)
+			set[i] = ord ? ord[g + i] : g + i;
+		if (use_ninja && resync) {
+			for (int i = 0; i < gk; i++) {
+				njcur[set[i]] = njhead[set[i]];
+				if (use_l2)
+					tlb_evrun(tebuf, (uintptr_t)TBUFBASE + set[i] * PAGESZ, TLB_PREPSZ);
 			}
 		}
+		if (gk == 1) {
+			tchase(njcur[set[0]], n, tim[set[0]]);
+			continue;
+		}
+		for (int i = 0; i < gk; i++)
+			cur[i] = njcur[set[i]];
+		uint64_t t0, t1;
+		rdtscp(t0);
+		lockstep(cur, gk, n);
+		rdtscp(t1);
+		for (int i = 0; i < gk; i++) {
+			njcur[set[i]] = cur[i];
+			tim[set[i]] = t1 - t0;
+		}
 	}
-	timbuf = calloc(nsets * PROBEROUNDS, sizeof(*timbuf));
+}
+
+static void do_probe(void *tebuf, const int use_l2, const int use_ninja, int ofd, struct outfmt fmt, int k)
+{
+	void ***njhead = alloca(L2SSETS * sizeof(*njhead));
+	void ***njcur = alloca(L2SSETS * sizeof(*njcur));
+	uint32_t *timbuf;
+	int nsets;
+	long ninjacnt = -1;
+	long int it = NMEAS;
+	unsigned scan = 0;
+
+	nsets = probe_prep(use_l2, use_ninja, njhead, njcur);
+	struct ring *out = ring_open(ofd, fmt, nsets * PROBEROUNDS);
+	if (k < 1)
+		k = 1;
+	if (k > 1)
+		fprintf(stderr, "Interleaving %d sets\n", k);
 
 	fputs("Ready to probe...", stderr);
 	(void)getchar();
@@ -749,63 +1154,197 @@ static void do_probe(void *tebuf, const int use_l2, const int use_ninja, int ofd
 	clock_gettime(CLOCK_REALTIME, &t0);
 
 	do {
+		timbuf = ring_get(out);
 		for (int rnd = 0; rnd < PROBEROUNDS; rnd++) {
-			uint32_t *tim = timbuf + rnd * nsets;
-			for (int set = 0; set < nsets; set++) {
-				if (use_l2) {
-					if (use_ninja) {
-						if (ninjacnt < 0) {
-							// Re-sync
-							njcur[set] = njhead[set];
-							tlb_evrun(tebuf, (uintptr_t)TBUFBASE + set * PAGESZ, TLB_PREPSZ);
-							ipchase(njcur[set], NINJA_L2_INIT, tim[set]);
-						} else {
-							ipchase(njcur[set], NINJA_L2_STEP, tim[set]);
-						}
-					} else {
-						ipchase(njcur[set], TLB_PREPSZ, tim[set]);
-					}
-				} else {
-					if (use_ninja) {
-						if (ninjacnt < 0) {
-							// Re-sync
-							njcur[set] = njhead[set];
-							ipchase(njcur[set], NINJA_L1_INIT, tim[set]);
-						} else {
-							ipchase(njcur[set], NINJA_L1_STEP, tim[set]);
-						}
-					} else {
-						ipchase(njcur[set], TLB_PREPSZ_L1, tim[set]);
-					}
-				}
-			}
+			probe_scan(tebuf, use_l2, use_ninja, njhead, njcur, nsets, k, scan++, ninjacnt < 0, timbuf + rnd * nsets);
 			if (ninjacnt < 0)
 				ninjacnt = NINJA_THRESH;
 			ninjacnt--;
 		}
 		// Output timbuf
-		write(ofd, timbuf, nsets * PROBEROUNDS * sizeof(*timbuf));
+		ring_put(out);
 	} while (--it);
 
 	clock_gettime(CLOCK_REALTIME, &t);
 	diff = usecdiff(&t0, &t);
 	fprintf(stderr, "Probed for %lu us (%lu us/rnd)\n", diff, diff/NMEAS/PROBEROUNDS);
+	ring_close(out);
+}
+
+#define KSWEEP_MAX (32)
+#define KSWEEP_TRIALS (1024)
+#define KSWEEP_SCANS (8)
+
+/* Full scans per second against interleave factor k, and how well scans still attribute a miss
+ * to its set: each trial touches a foreign page in one set behind the prober's back before each
+ * of KSWEEP_SCANS scans, as do_calib() does once, and counts as attributed if that set alone
+ * showed the slowest sample most often. Every set of the slowest group shows it, so this is
+ * scored per set for every k, against the same 1/nsets chance as sequential probing. */
+static void do_ksweep(void *tebuf, const int use_l2, const int use_ninja)
+{
+	void ***njhead = alloca(L2SSETS * sizeof(*njhead));
+	void ***njcur = alloca(L2SSETS * sizeof(*njcur));
+	uint32_t tim[L2SSETS];
+	int hits[L2SSETS];
+	const int nsets = probe_prep(use_l2, use_ninja, njhead, njcur);
+	int bestk = 1;
+	double best = 0, acc1 = 0;
+	unsigned scan = 0;
+
+	fprintf(stderr, "    k   scans/sec  attributed (chance %.1f%%)\n", 100.0 / nsets);
+	for (int k = 1; k <= KSWEEP_MAX && k <= nsets; k *= 2) {
+		struct timespec t0, t;
+		int good = 0;
+
+		probe_scan(tebuf, use_l2, use_ninja, njhead, njcur, nsets, k, scan++, 1, tim);
+		clock_gettime(CLOCK_REALTIME, &t0);
+		for (int rnd = 0; rnd < PROBEROUNDS; rnd++)
+			probe_scan(tebuf, use_l2, use_ninja, njhead, njcur, nsets, k, scan++, 0, tim);
+		clock_gettime(CLOCK_REALTIME, &t);
+		const double sps = PROBEROUNDS * 1e6 / usecdiff(&t0, &t);
+
+		for (int tr = 0; tr < KSWEEP_TRIALS; tr++) {
+			const int v = tr % nsets;
+			int top = 0, ntop = 0;
+			memset(hits, 0, sizeof(hits));
+			probe_scan(tebuf, use_l2, use_ninja, njhead, njcur, nsets, k, scan++, 1, tim);
+			probe_scan(tebuf, use_l2, use_ninja, njhead, njcur, nsets, k, scan++, 0, tim);
+			for (int sc = 0; sc < KSWEEP_SCANS; sc++) {
+				uint32_t slow = 0;
+				tlb_evrun(tebuf, (uintptr_t)TBUFBASE + v * PAGESZ, 1);
+				probe_scan(tebuf, use_l2, use_ninja, njhead, njcur, nsets, k, scan++, 0, tim);
+				for (int s = 0; s < nsets; s++)
+					if (tim[s] > slow)
+						slow = tim[s];
+				for (int s = 0; s < nsets; s++)
+					hits[s] += tim[s] == slow;
+			}
+			for (int s = 0; s < nsets; s++) {
+				if (hits[s] > hits[top]) {
+					top = s;
+					ntop = 1;
+				} else if (hits[s] == hits[top]) {
+					ntop++;
+				}
+			}
+			good += top == v && ntop == 1;
+		}
+		const double acc = (double)good / KSWEEP_TRIALS;
+		if (k == 1)
+			acc1 = acc;
+		fprintf(stderr, "%5d %11.0f %10.1f%%\n", k, sps, 100 * acc);
+		/* Keep attribution within a few points of sequential probing */
+		if (acc >= acc1 - 0.05 && sps > best) {
+			best = sps;
+			bestk = k;
+		}
+	}
+	fprintf(stderr, "Best k: %d (%.0f scans/sec)\n", bestk, best);
+}
+
+#define CAL_BSZ (2)
+#define CAL_BNR (1024)
+#define CAL_TRIALS (4096)
+
+/* Set th to the cut that best separates the fast samples in h[0] from the slow ones in h[1] (which
+ * it sums into h[0] when verbose). Returns its error rate. */
+static double calib_cut(uint32_t (*h)[CAL_BNR], struct thresh *th, int verbose)
+{
+	double err;
+	const int cb = hist_cut(h[0], h[1], CAL_BNR, &err);
+	const uint32_t cut = (cb + 1) * CAL_BSZ - 1;
+	const uint32_t fast = hist_mean(h[0], CAL_BNR, CAL_BSZ), slow = hist_mean(h[1], CAL_BNR, CAL_BSZ);
+	thresh_init(th, cut, fast, slow);
+	if (verbose) {
+		for (int b = 0; b < CAL_BNR; b++)
+			h[0][b] += h[1][b];
+		fprintf(stderr, "fast mean %u, slow mean %u: cut %u (%.2f%% misclassified), Otsu %u\n",
+		        fast, slow, cut, 100 * err, (hist_otsu(h[0], CAL_BNR) + 1) * CAL_BSZ - 1);
+	}
+	return err;
+}
+
+/* Collect fast and slow samples of every set's probe, slow ones by touching a foreign page in
+ * the set (as a victim would) just before the step, and set th to the cut that separates them
+ * best. Returns its error rate. */
+static double do_calib(void *tebuf, const int use_l2, const int use_ninja, struct thresh *th, int verbose)
+{
+	void ***njhead = alloca(L2SSETS * sizeof(*njhead));
+	void ***njcur = alloca(L2SSETS * sizeof(*njcur));
+	uint32_t tim[L2SSETS];
+	uint32_t (*h)[CAL_BNR] = calloc(2, sizeof(*h));
+	const int nsets = probe_prep(use_l2, use_ninja, njhead, njcur);
+	double err;
+
+	for (int tr = 0; tr < CAL_TRIALS; tr++) {
+		const int v = tr % nsets;
+		probe_scan(tebuf, use_l2, use_ninja, njhead, njcur, nsets, 1, 0, 1, tim);
+		probe_scan(tebuf, use_l2, use_ninja, njhead, njcur, nsets, 1, 0, 0, tim);
+		tlb_evrun(tebuf, (uintptr_t)TBUFBASE + v * PAGESZ, 1);
+		probe_scan(tebuf, use_l2, use_ninja, njhead, njcur, nsets, 1, 0, 0, tim);
+		for (int s = 0; s < nsets; s++) {
+			const uint32_t b = tim[s] / CAL_BSZ;
+			h[s == v][b < CAL_BNR ? b : CAL_BNR - 1]++;
+		}
+	}
+	err = calib_cut(h, th, verbose);
+	free(h);
+	return err;
+}
+
+/* do_calib() for -Pj2b: samples of the very rounds it times, single steps of the ninja_prep()
+ * chain of targ on the planned schedule, with a congruent foreign page touched before every
+ * other one */
+static double rs_calib(void *tebuf, uintptr_t targ, void **njhead, struct thresh *th, int verbose)
+{
+	uint32_t (*h)[CAL_BNR] = calloc(2, sizeof(*h));
+	void **njcur = NULL;
+	unsigned ph = 0;
+	uint32_t tim;
+	double err;
+
+	for (long tr = 0; tr < 2 * CAL_TRIALS; tr++) {
+		const int v = tr & 1;
+		if (tr % NINJA_RS_THRESH == 0)
+			njcur = rs_reset(tebuf, targ, njhead, &ph);
+		if (v)
+			tlb_evrun(tebuf, targ, 1);
+		tchase(njcur, (unsigned)ninja_steps[ph], tim);
+		ph = (ph + 1) % NINJA_NSTEPS;
+		const uint32_t b = tim / CAL_BSZ;
+		h[v][b < CAL_BNR ? b : CAL_BNR - 1]++;
+	}
+	err = calib_cut(h, th, verbose);
+	free(h);
+	return err;
 }
 
 #define SPROBEROUNDS (PROBEROUNDS)
 #define SPROBEIT (4096)
 
-static void do_setprobe(void *tebuf, const int use_l2, const int use_ninja, int ofd, int l1s, int l2s)
+static void do_setprobe(void *tebuf, const int use_l2, const int use_ninja, int ofd, struct outfmt fmt, int l1s, int l2s)
 {
 	void **njhead, **njcur;
 	uint32_t *timbuf;
 	long ninjacnt = -1;
 	const uintptr_t SPTARG = (uintptr_t)tlb_nexthit(TBUFBASE, l1s, l2s);
+	/* Cyclic round of the planned schedule timed next */
+	unsigned rsph = 0;
+	const int rsplan = use_l2 && use_ninja && use_resync;
+	/* With re-sync, bits output is classified by the calibrated cut as it tracks drift */
+	const int rsbits = rsplan && fmt.enc == OUT_BITS;
 
 	if (use_l2) {
 		if (use_ninja) {
 			fputs("Ninja L2 probe\n", stderr);
-			njhead = tlb_prepninja(TBUFBASE, SPTARG);
+			if (use_resync) {
+				/* Same chain as tlb_prepninja(), along with its schedule */
+				njhead = ninja_prep(TBUFBASE, SPTARG);
+				/* Bits are classified on the fly: get the cut right first, on these very rounds */
+				rs_calib(tebuf, SPTARG, njhead, &slow_th, 1);
+			} else {
+				njhead = tlb_prepninja(TBUFBASE, SPTARG);
+			}
 			njcur = njhead;
 		} else {
 			fputs("Naive L2 probe\n", stderr);
@@ -823,7 +1362,9 @@ static void do_setprobe(void *tebuf, const int use_l2, const int use_ninja, int
 			njcur = njhead;
 		}
 	}
-	timbuf = calloc(SPROBEROUNDS, sizeof(*timbuf));
+	if (rsbits)
+		fmt.arg = 0;
+	struct ring *out = ring_open(ofd, fmt, SPROBEROUNDS);
 
 	//fputs("Ready to probe...", stderr);
 	//(void)getchar();
@@ -838,54 +1379,63 @@ static void do_setprobe(void *tebuf, const int use_l2, const int use_ninja, int
 		clock_gettime(CLOCK_REALTIME, &t0);
 
 		do {
+			timbuf = ring_get(out);
 			for (int rnd = 0; rnd < SPROBEROUNDS; rnd++) {
 				//for (int set = 0; set < nsets; set++) {
 					if (use_l2) {
 						if (use_ninja) {
-							if (ninjacnt < 0) {
+							if (use_resync) {
+								if (ninjacnt < 0)
+									njcur = rs_reset(tebuf, SPTARG, njhead, &rsph);
+								tchase(njcur, (unsigned)ninja_steps[rsph], timbuf[rnd]);
+								rsph = (rsph + 1) % NINJA_NSTEPS;
+								if (rsbits)
+									timbuf[rnd] = thresh_slow(&slow_th, timbuf[rnd]);
+							} else if (ninjacnt < 0) {
 								// Re-sync
 								njcur = njhead;
 								tlb_evrun(tebuf, SPTARG, TLB_PREPSZ);
-								ipchase(njcur, NINJA_L2_INIT, timbuf[rnd]);
+								tchase(njcur, NINJA_L2_INIT, timbuf[rnd]);
 							} else {
 								/* HACK: time last access only */
-								ipchase(njcur, NINJA_L2_STEP, timbuf[rnd]);
+								tchase(njcur, NINJA_L2_STEP, timbuf[rnd]);
 								//ipchase(njcur, NINJA_L2_STEP - 1, timbuf[rnd]);
 								//ipchase(njcur, 1, timbuf[rnd]);
 							}
 						} else {
-							ipchase(njcur, TLB_PREPSZ, timbuf[rnd]);
+							tchase(njcur, TLB_PREPSZ, timbuf[rnd]);
 						}
 					} else {
 						if (use_ninja) {
 							if (ninjacnt < 0) {
 								// Re-sync
 								njcur = njhead;
-								ipchase(njcur, NINJA_L1_INIT, timbuf[rnd]);
+								tchase(njcur, NINJA_L1_INIT, timbuf[rnd]);
 							} else {
-								ipchase(njcur, NINJA_L1_STEP, timbuf[rnd]);
+								tchase(njcur, NINJA_L1_STEP, timbuf[rnd]);
 							}
 						} else {
-							ipchase(njcur, TLB_PREPSZ_L1, timbuf[rnd]);
+							tchase(njcur, TLB_PREPSZ_L1, timbuf[rnd]);
 						}
 					}
 				//}
 				if (ninjacnt < 0)
-					ninjacnt = NINJA_THRESH;
+					ninjacnt = rsplan ? NINJA_RS_THRESH : NINJA_THRESH;
 				ninjacnt--;
 			}
 			// Output timbuf
-			write(ofd, timbuf, SPROBEROUNDS * sizeof(*timbuf));
+			ring_put(out);
 		} while (--it);
 
 		clock_gettime(CLOCK_REALTIME, &t);
 		diff = usecdiff(&t0, &t);
 		fprintf(stderr, "Probed for %lu us (%lu ns/rnd ; %f M/sec)\n", diff, diff*1000/SPROBEIT/SPROBEROUNDS, SPROBEIT*SPROBEROUNDS*1.0/diff);
 	} while (--measit);
+	ring_close(out);
 }
 
 
-static void do_splice_setprobe_ninja(void *tebuf, int ofd, int l1s, int l2s)
+static void do_splice_setprobe_ninja(void *tebuf, int ofd, struct outfmt fmt, int l1s, int l2s)
 {
 	void **njhead, **njcur;
 	uint32_t *timbuf;
@@ -896,7 +1446,7 @@ static void do_splice_setprobe_ninja(void *tebuf, int ofd, int l1s, int l2s)
 	njhead = tlb_prepninja_splice(TBUFBASE, SPTARG);
 	njcur = njhead;
 
-	timbuf = calloc(2 * SPROBEROUNDS, sizeof(*timbuf));
+	struct ring *out = ring_open(ofd, fmt, 2 * SPROBEROUNDS);
 
 	//fputs("Ready to probe...", stderr);
 	//(void)getchar();
@@ -911,31 +1461,33 @@ static void do_splice_setprobe_ninja(void *tebuf, int ofd, int l1s, int l2s)
 		clock_gettime(CLOCK_REALTIME, &t0);
 
 		do {
+			timbuf = ring_get(out);
 			for (int rnd = 0; rnd < SPROBEROUNDS; rnd++) {
 				if (ninjacnt < 0) {
 					// Re-sync
 					njcur = njhead;
 					tlb_evrun(tebuf, SPTARG, TLB_PREPSZ);
-					ipchase(njcur, NINJA_SPLICE_INIT, timbuf[2*rnd]);
+					tchase(njcur, NINJA_SPLICE_INIT, timbuf[2*rnd]);
 					timbuf[2*rnd + 1] = 0;
 					ninjacnt = NINJA_THRESH;
 				} else {
-					ipchase(njcur, NINJA_SPLICE_L1_STEP, timbuf[2*rnd]);
-					ipchase(njcur, NINJA_SPLICE_L2_STEP, timbuf[2*rnd + 1]);
+					tchase(njcur, NINJA_SPLICE_L1_STEP, timbuf[2*rnd]);
+					tchase(njcur, NINJA_SPLICE_L2_STEP, timbuf[2*rnd + 1]);
 				}
 				ninjacnt--;
 			}
 			// Output timbuf
-			write(ofd, timbuf, 2 * SPROBEROUNDS * sizeof(*timbuf));
+			ring_put(out);
 		} while (--it);
 
 		clock_gettime(CLOCK_REALTIME, &t);
 		diff = usecdiff(&t0, &t);
 		fprintf(stderr, "Probed for %lu us (%lu ns/rnd ; %f M/sec)\n", diff, diff*1000/SPROBEIT/SPROBEROUNDS, SPROBEIT*SPROBEROUNDS*1.0/diff);
 	} while (--measit);
+	ring_close(out);
 }
 
-static void do_splice_setprobe_naive(void *tebuf, int ofd, int l1s, int l2s)
+static void do_splice_setprobe_naive(void *tebuf, int ofd, struct outfmt fmt, int l1s, int l2s)
 {
 	void **cur;
 	uint32_t *timbuf;
@@ -944,7 +1496,7 @@ static void do_splice_setprobe_naive(void *tebuf, int ofd, int l1s, int l2s)
 	fputs("Naive Spliced L1+L2 probe\n", stderr);
 	cur = tlb_prepnaive_splice(TBUFBASE, SPTARG);
 
-	timbuf = calloc(2 * SPROBEROUNDS, sizeof(*timbuf));
+	struct ring *out = ring_open(ofd, fmt, 2 * SPROBEROUNDS);
 
 	//fputs("Ready to probe...", stderr);
 	//(void)getchar();
@@ -959,19 +1511,21 @@ static void do_splice_setprobe_naive(void *tebuf, int ofd, int l1s, int l2s)
 		clock_gettime(CLOCK_REALTIME, &t0);
 
 		do {
+			timbuf = ring_get(out);
 			for (int rnd = 0; rnd < SPROBEROUNDS; rnd++) {
-				ipfwd(cur, NAIVE_SPLICE_PRIME);
-				ipchase(cur, NAIVE_SPLICE_L1, timbuf[2*rnd]);
-				ipchase(cur, NAIVE_SPLICE_L2, timbuf[2*rnd + 1]);
+				tfwd(cur, NAIVE_SPLICE_PRIME);
+				tchase(cur, NAIVE_SPLICE_L1, timbuf[2*rnd]);
+				tchase(cur, NAIVE_SPLICE_L2, timbuf[2*rnd + 1]);
 			}
 			// Output timbuf
-			write(ofd, timbuf, 2 * SPROBEROUNDS * sizeof(*timbuf));
+			ring_put(out);
 		} while (--it);
 
 		clock_gettime(CLOCK_REALTIME, &t);
 		diff = usecdiff(&t0, &t);
 		fprintf(stderr, "Probed for %lu us (%lu ns/rnd ; %f M/sec)\n", diff, diff*1000/SPROBEIT/SPROBEROUNDS, SPROBEIT*SPROBEROUNDS*1.0/diff);
 	} while (--measit);
+	ring_close(out);
 }
 
 
@@ -1042,24 +1596,24 @@ static void do_hist(void *tebuf, const int use_l2, const int use_ninja)
 							// Re-sync
 							njcur[set] = njhead[set];
 							tlb_evrun(tebuf, (uintptr_t)TBUFBASE + set * PAGESZ, TLB_PREPSZ);
-							ipchase(njcur[set], NINJA_L2_INIT, tim);
+							tchase(njcur[set], NINJA_L2_INIT, tim);
 						} else {
-							ipchase(njcur[set], NINJA_L2_STEP, tim);
+							tchase(njcur[set], NINJA_L2_STEP, tim);
 						}
 					} else {
-						ipchase(njcur[set], TLB_PREPSZ, tim);
+						tchase(njcur[set], TLB_PREPSZ, tim);
 					}
 				} else {
 					if (use_ninja) {
 						if (ninjacnt < 0) {
 							// Re-sync
 							njcur[set] = njhead[set];
-							ipchase(njcur[set], NINJA_L1_INIT, tim);
+							tchase(njcur[set], NINJA_L1_INIT, tim);
 						} else {
-							ipchase(njcur[set], NINJA_L1_STEP, tim);
+							tchase(njcur[set], NINJA_L1_STEP, tim);
 						}
 					} else {
-						ipchase(njcur[set], TLB_PREPSZ_L1, tim);
+						tchase(njcur[set], TLB_PREPSZ_L1, tim);
 					}
 				}
 				int buck = tim/HIST_BSZ;
@@ -1072,13 +1626,16 @@ static void do_hist(void *tebuf, const int use_l2, const int use_ninja)
 			ninjacnt--;
 		}
 		// Output timbuf
+		uint32_t all[HIST_BNR] = {0};
 		for (int set = 0; set < nsets; set++) {
 			for (int b = 0; b < HIST_BNR; b++) {
 				printf("%5u ", timbuf[set * HIST_BNR + b]);
+				all[b] += timbuf[set * HIST_BNR + b];
 			}
 			putchar('\n');
 		}
 		putchar('\n');
+		fprintf(stderr, "Otsu cut: %d cycles\n", (hist_otsu(all, HIST_BNR) + 1) * HIST_BSZ);
 		memset(timbuf, 0, nsets * HIST_BNR * sizeof(*timbuf));
 	} while (--it);
 
@@ -1134,24 +1691,24 @@ static void do_sethist(void *tebuf, const int use_l2, const int use_ninja, int l
 						// Re-sync
 						njcur = njhead;
 						tlb_evrun(tebuf, SPTARG, TLB_PREPSZ);
-						ipchase(njcur, NINJA_L2_INIT, tim);
+						tchase(njcur, NINJA_L2_INIT, tim);
 					} else {
-						ipchase(njcur, NINJA_L2_STEP, tim);
+						tchase(njcur, NINJA_L2_STEP, tim);
 					}
 				} else {
-					ipchase(njcur, TLB_PREPSZ, tim);
+					tchase(njcur, TLB_PREPSZ, tim);
 				}
 			} else {
 				if (use_ninja) {
 					if (ninjacnt < 0) {
 						// Re-sync
 						njcur = njhead;
-						ipchase(njcur, NINJA_L1_INIT, tim);
+						tchase(njcur, NINJA_L1_INIT, tim);
 					} else {
-						ipchase(njcur, NINJA_L1_STEP, tim);
+						tchase(njcur, NINJA_L1_STEP, tim);
 					}
 				} else {
-					ipchase(njcur, TLB_PREPSZ_L1, tim);
+					tchase(njcur, TLB_PREPSZ_L1, tim);
 				}
 			}
 			int buck = tim/HIST_BSZ;
@@ -1167,6 +1724,7 @@ static void do_sethist(void *tebuf, const int use_l2, const int use_ninja, int l
 			printf("%5u ", timbuf[b]);
 		}
 		putchar('\n');
+		fprintf(stderr, "Otsu cut: %d cycles\n", (hist_otsu(timbuf, HIST_BNR) + 1) * HIST_BSZ);
 		memset(timbuf, 0, HIST_BNR * sizeof(*timbuf));
 	} while (--it);
 
@@ -1177,7 +1735,15 @@ static void do_sethist(void *tebuf, const int use_l2, const int use_ninja, int l
 
 
 
-const char USAGE[] = "usage:\n'%s -s' : run as sender\n'%s -r[nj12]' : run as receiver\n'%s -h' : print this message\n";
+const char USAGE[] = "usage:\n'%s -s' : run as sender\n'%s -r[nj12sbx]' : run as receiver\n"
+	"'%s -p[nj12sx] FILE [K [FMT]]' : probe all sets, K at a time in lockstep, to FILE\n"
+	"\tFMT (also after the set numbers of -P/-S): raw (default), u16[=BASE], u8[=BASE]: cycles\n"
+	"\tabove BASE, saturating; bits[=THRESH]: 1 bit per sample, set if above THRESH\n"
+	"'%s -k[nj12sx]' : sweep K for 'p', reporting scan rate and attribution of misses\n"
+	"'%s -t[nj12sx]' : calibrate the fast/slow cut of a strategy's samples (bits=THRESH)\n"
+	"'%s -b' : benchmark the receive rate of every strategy\n'%s -h' : print this message\n"
+	"receiver suboptions: n/j naive/ninja, 1/2 L1 dTLB/sTLB, s short ninja L1 lead-in,\n"
+	"\tb belief-state re-sync (set probes), x JIT-unrolled chase\n";
 
 int main(int argc, char *argv[])
 {
@@ -1196,12 +1762,21 @@ int main(int argc, char *argv[])
 			perror("Error setting up eviction buf");
 			return 2;
 		}
+		if (jit_setup())
+			perror("Error setting up JIT chase routines");
 
 		if (argv[1][0] == '-') {
 			switch (argv[1][1]) {
 				case 'w':
 					do_walkup(tebuf);
 					break;
+				case 'b':
+					if (!argv[1][2]) {
+						do_bench(tebuf);
+						break;
+					}
+					fprintf(stderr, "Unknown option: '%s'\n", argv[1]);
+					goto err_usage;
 				case 's':
 					if (!argv[1][2]) {
 						do_send(tebuf);
@@ -1217,12 +1792,23 @@ int main(int argc, char *argv[])
 				case 'P':
 				case 'h':
 				case 'H':
+				case 'k':
+				case 't':
 					for (char *c = &argv[1][2]; *c; c++) {
 						switch (*c) {
 							case 'n': case 'N': use_ninja = 0; break;
 							case 'j': case 'J': use_ninja = 1; break;
 							case '1': use_l2 = 0; break;
 							case '2': use_l2 = 1; break;
+							case 's': l1_short = 1; break;
+							case 'b': use_resync = 1; break;
+							case 'x':
+								if (!jit_chase[1]) {
+									fputs("JIT chase routines unavailable\n", stderr);
+									return 2;
+								}
+								use_jit = 1;
+								break;
 							default:
 								fprintf(stderr, "Unknown suboption to -%c: '%s'\n", argv[1][1], c);
 								goto err_usage;
@@ -1236,15 +1822,22 @@ int main(int argc, char *argv[])
 						case 'p':
 						case 'P':
 						{
+							/* Output format follows the numeric arguments */
+							const int fa = argv[1][1] == 'p' ? 4 : 5;
+							struct outfmt fmt = {OUT_RAW, 0};
+							if (argc > fa && parse_outfmt(argv[fa], &fmt)) {
+								fprintf(stderr, "Unknown output format: '%s'\n", argv[fa]);
+								goto err_usage;
+							}
 							int fd = open(argv[2], O_RDWR|O_CREAT|O_TRUNC, 0664);
 							if (fd < 0) {
 								perror("Unable to open output file");
 								goto err_usage;
 							}
 							if (argv[1][1] == 'p') {
-								do_probe(tebuf, use_l2, use_ninja, fd);
+								do_probe(tebuf, use_l2, use_ninja, fd, fmt, argc > 3 ? atoi(argv[3]) : 1);
 							} else {
-								do_setprobe(tebuf, use_l2, use_ninja, fd, atoi(argv[3]), atoi(argv[4]));
+								do_setprobe(tebuf, use_l2, use_ninja, fd, fmt, atoi(argv[3]), atoi(argv[4]));
 							}
 							close(fd);
 						}
@@ -1255,10 +1848,21 @@ int main(int argc, char *argv[])
 						case 'H':
 							do_sethist(tebuf, use_l2, use_ninja, atoi(argv[2]), atoi(argv[3]));
 							break;
+						case 'k':
+							do_ksweep(tebuf, use_l2, use_ninja);
+							break;
+						case 't':
+							do_calib(tebuf, use_l2, use_ninja, &slow_th, 1);
+							break;
 					}
 					break;
 				case 'S':
 				{
+					struct outfmt fmt = {OUT_RAW, 0};
+					if (argc > 5 && parse_outfmt(argv[5], &fmt)) {
+						fprintf(stderr, "Unknown output format: '%s'\n", argv[5]);
+						goto err_usage;
+					}
 					int fd = open(argv[2], O_RDWR|O_CREAT|O_TRUNC, 0664);
 					if (fd < 0) {
 						perror("Unable to open output file");
@@ -1266,10 +1870,10 @@ int main(int argc, char *argv[])
 					}
 					switch (argv[1][2]) {
 						case 'j':
-							do_splice_setprobe_ninja(tebuf, fd, atoi(argv[3]), atoi(argv[4]));
+							do_splice_setprobe_ninja(tebuf, fd, fmt, atoi(argv[3]), atoi(argv[4]));
 							break;
 						case 'n':
-							do_splice_setprobe_naive(tebuf, fd, atoi(argv[3]), atoi(argv[4]));
+							do_splice_setprobe_naive(tebuf, fd, fmt, atoi(argv[3]), atoi(argv[4]));
 							break;
 					}
 					close(fd);
@@ -1283,6 +1887,6 @@ int main(int argc, char *argv[])
 	}
 	return 0;
 err_usage:
-	fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+	fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 	return 1;
 }
@@ -0,0 +1,108 @@
+/* Generated by cache-ninja; do not edit.
+ * gen -p TLB::KABYLAKE -l max -s stlb -n ninja -o data -a bfs -r 100 -R 64 -P 0.001 --prep 12
+ *
+ * Pages accessed per eviction round; the parenthesized rounds repeat:
+ * 0 1 2 3 4 5 0 2 1 6 | 3 0 2 7 | (4 1 0 8 | 6 2 1 5 | 7 0 2 3 | 8 1 0 4 | 5 2 1 6 | 3 0 2 7)
+ */
+#ifndef NINJA_RESYNC_H
+#define NINJA_RESYNC_H
+
+#include <stdint.h>
+
+#define NINJA_NPAGES (9)
+#define NINJA_NSLOTS (7) /* pointer slots used per page */
+#define NINJA_LINESZ (64)
+/* First cache line of each page's pointer slots: slot k of page i sits in line
+ * ninja_line[i] + k, so that no two hops share an L1D or L2 set */
+static const unsigned char ninja_line[NINJA_NPAGES] = {0, 7, 13, 20, 24, 27, 30, 33, 36};
+#define NINJA_INIT (18)
+#define NINJA_STEP (4)
+#define NINJA_NSTEPS (6)
+static const unsigned char ninja_steps[NINJA_NSTEPS] = {4, 4, 4, 4, 4, 4};
+
+static void *ninja_nexthit(void *cur, uintptr_t targ)
+{
+	uintptr_t t = targ >> 12;
+	uintptr_t p = (uintptr_t)cur >> 12;
+	do {
+		p++;
+	} while (p == t || (p & 0xf) != (t & 0xf) ||
+	         ((p ^ (p >> 7)) & 0x7f) != ((t ^ (t >> 7)) & 0x7f));
+	return (void *)(p << 12);
+}
+
+static void **ninja_prep(void *base, uintptr_t targ)
+{
+	void *p = base;
+	void *(*ev[NINJA_NPAGES])[NINJA_LINESZ / sizeof(void *)];
+	for (int i = 0; i < NINJA_NPAGES; i++) {
+		p = ninja_nexthit(p, targ);
+		ev[i] = (void *)(((uintptr_t)p & ~(uintptr_t)0xfff) + NINJA_LINESZ * ninja_line[i]);
+	}
+	ev[0][0][0] = &ev[1][0];
+	ev[0][1][0] = &ev[2][1];
+	ev[0][2][0] = &ev[2][2];
+	ev[0][3][0] = &ev[8][0];
+	ev[0][4][0] = &ev[2][4];
+	ev[0][5][0] = &ev[4][2];
+	ev[0][6][0] = &ev[2][6];
+
+	ev[1][0][0] = &ev[2][0];
+	ev[1][1][0] = &ev[6][0];
+	ev[1][2][0] = &ev[0][3];
+	ev[1][3][0] = &ev[5][1];
+	ev[1][4][0] = &ev[0][5];
+	ev[1][5][0] = &ev[6][2];
+
+	ev[2][0][0] = &ev[3][0];
+	ev[2][1][0] = &ev[1][1];
+	ev[2][2][0] = &ev[7][0];
+	ev[2][3][0] = &ev[1][3];
+	ev[2][4][0] = &ev[3][2];
+	ev[2][5][0] = &ev[1][5];
+	ev[2][6][0] = &ev[7][2];
+
+	ev[3][0][0] = &ev[4][0];
+	ev[3][1][0] = &ev[0][2];
+	ev[3][2][0] = &ev[8][1];
+	ev[3][3][0] = &ev[0][6];
+
+	ev[4][0][0] = &ev[5][0];
+	ev[4][1][0] = &ev[1][2];
+	ev[4][2][0] = &ev[5][2];
+
+	ev[5][0][0] = &ev[0][1];
+	ev[5][1][0] = &ev[7][1];
+	ev[5][2][0] = &ev[2][5];
+
+	ev[6][0][0] = &ev[3][1];
+	ev[6][1][0] = &ev[2][3];
+	ev[6][2][0] = &ev[3][3];
+
+	ev[7][0][0] = &ev[4][1];
+	ev[7][1][0] = &ev[0][4];
+	ev[7][2][0] = &ev[4][1]; // <-- looplink here
+
+	ev[8][0][0] = &ev[6][1];
+	ev[8][1][0] = &ev[1][4];
+
+	return ev[0][0];
+}
+
+/* Online re-synchronization: no table exists for this chain. No timed round's
+ * outcome changes what the chain can be in after it, so a receiver has nothing to
+ * follow. Instead, after a full reset (NINJA_RS_PREP fresh pages, then NINJA_RS_LEADIN
+ * accesses from the head), chase NINJA_RS_SKIP cyclic rounds untimed, then time every
+ * round; reset again after NINJA_RS_PERIOD timed rounds, or never if 0.
+ *
+ * Simulated with random target accesses and noise 0.001 per component and round:
+ *   a foreign insertion may flip timed rounds for 2 rounds at most
+ *   no resets: 849 errors in 1048576 rounds, 4 resync accesses (0.0000 per round, 0.00% of all)
+ *   fixed: 1107 errors in 1048576 rounds, 13312 resync accesses (0.0127 per round, 0.32% of all)
+ */
+#define NINJA_RS_PREP (12)
+#define NINJA_RS_LEADIN (14)
+#define NINJA_RS_SKIP (1)
+#define NINJA_RS_PERIOD (0)
+
+#endif /* NINJA_RESYNC_H */
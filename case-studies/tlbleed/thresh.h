@@ -0,0 +1,113 @@
+/* Hit/miss thresholds and timing histograms, shared by madtlb and the covert channel */
+#ifndef THRESH_H
+#define THRESH_H
+
+#include <stdint.h>
+
+/* Fast/slow classification of probe timings: slow iff above cut. Once both class means are
+ * known, every classified sample pulls its class mean along by 2^-TH_EWMA and the cut follows,
+ * keeping its place between the means, so that it tracks drift (frequency changes, a busier
+ * sibling thread) during long runs. */
+#define TH_EWMA (8)
+
+struct thresh {
+	uint32_t cut;
+	uint32_t mu[2];		/* class means << TH_EWMA; mu[1] == 0 while unknown (or fixed cut) */
+	uint32_t pos;		/* cut position between the means, in 1/256 */
+};
+
+static void thresh_init(struct thresh *th, uint32_t cut, uint32_t fast, uint32_t slow)
+{
+	th->cut = cut;
+	th->mu[0] = th->mu[1] = 0;
+	th->pos = 0;
+	if (slow > fast && cut >= fast && cut < slow) {
+		th->mu[0] = fast << TH_EWMA;
+		th->mu[1] = slow << TH_EWMA;
+		th->pos = (cut - fast) * 256 / (slow - fast);
+	}
+}
+
+static inline int thresh_slow(struct thresh *th, uint32_t tim)
+{
+	const int slow = tim > th->cut;
+	if (th->mu[1]) {
+		/* Interrupts and the like are not drift */
+		const uint32_t lim = 2 * (th->mu[1] >> TH_EWMA);
+		if (tim > lim)
+			tim = lim;
+		th->mu[slow] += tim - (th->mu[slow] >> TH_EWMA);
+		const uint32_t f = th->mu[0] >> TH_EWMA, s = th->mu[1] >> TH_EWMA;
+		if (s > f)
+			th->cut = f + (s - f) * th->pos / 256;
+	}
+	return slow;
+}
+
+/* Otsu's method: the cut between buckets b and b + 1 that maximizes the between-class variance
+ * of h[0..n-1]; returns b */
+static int hist_otsu(const uint32_t *h, int n)
+{
+	double tot = 0, sum = 0, w0 = 0, s0 = 0, best = -1;
+	int bb = 0;
+
+	for (int b = 0; b < n; b++) {
+		tot += h[b];
+		sum += (double)b * h[b];
+	}
+	for (int b = 0; b < n - 1; b++) {
+		w0 += h[b];
+		s0 += (double)b * h[b];
+		if (w0 == 0 || w0 == tot)
+			continue;
+		const double d = s0 / w0 - (sum - s0) / (tot - w0);
+		const double v = w0 * (tot - w0) * d * d;
+		if (v > best) {
+			best = v;
+			bb = b;
+		}
+	}
+	return bb;
+}
+
+/* Cut between buckets b and b + 1 with the lowest error rate, averaged over the classes, given
+ * the histograms of known fast (h0) and slow (h1) samples: the Bayes cut for equal priors. Of a
+ * run of equally good cuts (a gap between the classes) it takes the middle. Returns b, and the
+ * error rate in *err. */
+static int hist_cut(const uint32_t *h0, const uint32_t *h1, int n, double *err)
+{
+	double n0 = 0, n1 = 0, e0, e1 = 0, best = 2;
+	int lo = 0, hi = 0;
+
+	for (int b = 0; b < n; b++) {
+		n0 += h0[b];
+		n1 += h1[b];
+	}
+	e0 = n0;
+	for (int b = 0; b < n - 1; b++) {
+		e0 -= h0[b];
+		e1 += h1[b];
+		const double e = (e0 / n0 + e1 / n1) / 2;
+		if (e < best) {
+			best = e;
+			lo = hi = b;
+		} else if (e == best && hi == b - 1) {
+			hi = b;
+		}
+	}
+	*err = best;
+	return (lo + hi) / 2;
+}
+
+/* Mean of the samples in h, in the units of bucket size bsz */
+static uint32_t hist_mean(const uint32_t *h, int n, uint32_t bsz)
+{
+	double w = 0, s = 0;
+	for (int b = 0; b < n; b++) {
+		w += h[b];
+		s += (b + 0.5) * h[b];
+	}
+	return w ? s * bsz / w : 0;
+}
+
+#endif